@@ -12,6 +12,8 @@ void cond_init(struct cond *cond, char *name);
 
 int cond_wait(struct cond *cond, struct spinlock *mutex);
 
+int cond_wait_uninterruptible(struct cond *cond, struct spinlock *mutex);
+
 void cond_signal(struct cond *cond);
 
 void cond_broadcast(struct cond *cond);
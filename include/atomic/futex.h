@@ -21,14 +21,37 @@
 #define FUTEX_CMP_REQUEUE 4
 #define FUTEX_CMP_REQUEUE_PI 12
 #define FUTEX_WAKE_OP 5
+#define FUTEX_WAKE_BITSET 10
 
-#define FLAGS_SHARED 0x00
+#define FLAGS_SHARED 0x01
 #define FLAGS_CLOCKRT 0x02
 #define FUTEX_BITSET_MATCH_ANY 0xffffffff
 
-struct futex {
-    struct spinlock lock; // uncessary, using p->lock is ok
-    struct Queue waiting_queue;
+// FUTEX_WAKE_OP, val3 = (op << 28) | (cmp << 24) | (oparg << 12) | cmparg
+#define FUTEX_OP_SET 0  // uaddr2 = oparg
+#define FUTEX_OP_ADD 1  // uaddr2 += oparg
+#define FUTEX_OP_OR 2   // uaddr2 |= oparg
+#define FUTEX_OP_ANDN 3 // uaddr2 &= ~oparg
+#define FUTEX_OP_XOR 4  // uaddr2 ^= oparg
+#define FUTEX_OP_OPARG_SHIFT 8 // use (1 << oparg) as operand
+
+#define FUTEX_OP_CMP_EQ 0 // wake waiters of uaddr2 if oldval == cmparg
+#define FUTEX_OP_CMP_NE 1
+#define FUTEX_OP_CMP_LT 2
+#define FUTEX_OP_CMP_LE 3
+#define FUTEX_OP_CMP_GT 4
+#define FUTEX_OP_CMP_GE 5
+
+// a futex is (mm, user address), or (inode, file offset) in a MAP_SHARED file mapping
+struct futex_key {
+    void *mm;
+    uint64 addr;
+};
+
+// waiters of all futexes hashed to this bucket, the lock of the queue is the bucket lock
+// a waiter is its tcb, see tcb->futex_key
+struct futex_hash_bucket {
+    struct Queue waiters;
 };
 
 struct robust_list {
@@ -60,11 +83,11 @@ struct robust_list_head {
     struct robust_list *list_op_pending;
 };
 
-struct futex *get_futex(uint64 uaddr, int assert);
-void futex_init(struct futex *fp, char *name);
-int futex_wait(uint64 uaddr, uint val, struct timespec *ts);
-int futex_wakeup(uint64 uaddr, int nr_wake);
-int futex_requeue(uint64 uaddr1, int nr_wake, uint64 uaddr2, int nr_requeue);
+void futex_hash_init(void);
+int futex_wait(uint64 uaddr, int flags, uint val, uint64 timeout, uint bitset);
+int futex_wakeup(uint64 uaddr, int flags, int nr_wake, uint bitset);
+int futex_requeue(uint64 uaddr1, int flags, int nr_wake, uint64 uaddr2, int nr_requeue, uint *cmpval);
+int futex_wake_op(uint64 uaddr1, int flags, int nr_wake, uint64 uaddr2, int nr_wake2, uint op);
 
 int do_futex(uint64 uaddr, int op, uint32 val, struct timespec *ts, uint64 uaddr2, uint32 val2, uint32 val3);
 
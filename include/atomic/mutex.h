@@ -0,0 +1,26 @@
+#ifndef __MUTEX_H__
+#define __MUTEX_H__
+#include "common.h"
+#include "atomic/spinlock.h"
+#include "atomic/cond.h"
+
+#define MUTEX_FLAG_WAITERS 0x1UL // somebody sleeps on the mutex, unlock hands it off
+
+// sleep lock with an owner
+// a locker spins while the owner runs on another cpu, and sleeps otherwise.
+// unlock hands the mutex to the first sleeper, so sleepers are served in order.
+struct mutex {
+    volatile uint64 owner;     // struct tcb * of the holder | MUTEX_FLAG_WAITERS, 0 if unlocked
+    struct spinlock wait_lock; // protects wait
+    struct cond wait;          // sleepers, in order
+    char *name;
+};
+
+void mutex_init(struct mutex *lock, char *name);
+void mutex_lock(struct mutex *lock);
+int mutex_trylock(struct mutex *lock);
+void mutex_unlock(struct mutex *lock);
+int mutex_is_locked(struct mutex *lock);
+int mutex_holding(struct mutex *lock);
+
+#endif // __MUTEX_H__
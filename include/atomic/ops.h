@@ -52,6 +52,18 @@ static inline int atomic_sub_return(atomic_t *v, int i) {
     return __sync_fetch_and_sub(&v->counter, i);
 }
 
+// 非零时自增, 返回是否成功
+static inline int atomic_inc_not_zero(atomic_t *v) {
+    int old;
+    do {
+        old = atomic_read(v);
+        if (old == 0) {
+            return 0;
+        }
+    } while (!__sync_bool_compare_and_swap(&v->counter, old, old + 1));
+    return 1;
+}
+
 // ==========================bit ops================================
 #define __WORDSIZE 64
 #define BITS_PER_LONG __WORDSIZE
@@ -0,0 +1,61 @@
+#ifndef __RCU_H__
+#define __RCU_H__
+#include "common.h"
+#include "atomic/ops.h"
+#include "atomic/spinlock.h"
+#include "lib/list.h"
+
+// read-copy-update
+// a reader runs with interrupt off and never sleeps, so a cpu which takes a clock interrupt,
+// switches threads or idles has left all its read sections (a quiescent state).
+// an object unlinked by a writer is freed by call_rcu after every cpu has passed one.
+
+struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+
+static inline void rcu_read_lock(void) {
+    push_off();
+}
+
+static inline void rcu_read_unlock(void) {
+    pop_off();
+}
+
+#define rcu_dereference(p) READ_ONCE(p)
+
+// publish an initialized object
+#define rcu_assign_pointer(p, v) \
+    do {                         \
+        __sync_synchronize();    \
+        WRITE_ONCE(p, v);        \
+    } while (0)
+
+// writers of these lists are serialized by a lock, readers hold rcu_read_lock
+static inline void list_add_tail_rcu(struct list_head *pnew, struct list_head *head) {
+    struct list_head *prev = head->prev;
+    pnew->next = head;
+    pnew->prev = prev;
+    head->prev = pnew;
+    rcu_assign_pointer(prev->next, pnew);
+}
+
+// entry->next is kept for readers standing on entry
+static inline void list_del_rcu(struct list_head *entry) {
+    __list_del(entry->prev, entry->next);
+    entry->prev = NULL;
+}
+
+#define list_for_each_entry_rcu(pos, head, member)                                  \
+    for (pos = list_entry(rcu_dereference((head)->next), typeof(*pos), member);     \
+         &pos->member != (head);                                                    \
+         pos = list_entry(rcu_dereference(pos->member.next), typeof(*pos), member))
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head));
+void rcu_check_callbacks(void);
+void rcu_note_context_switch(void);
+void rcu_idle_enter(void);
+void rcu_idle_exit(void);
+
+#endif // __RCU_H__
@@ -18,6 +18,10 @@ void sema_init(sem *S, int value, char *name);
 
 void sema_wait(sem *S);
 
+void sema_wait_uninterruptible(sem *S);
+
+int sema_trywait(sem *S);
+
 void sema_signal(sem *S);
 
 #endif
\ No newline at end of file
@@ -5,24 +5,42 @@
 
 struct thread_cpu;
 
+#ifdef __LOCKTRACE__
+// contention statistics of all locks with the same name, see lock_stat_print
+struct lock_stat {
+    char *name;
+    uint64 nr_acquire;
+    uint64 nr_contended; // had to wait for others
+    uint64 spin_time;    // rdtime spent waiting
+};
+#endif
+
 // Mutual exclusion lock.
+// a ticket lock, cpus get the lock in the order they ask for it
 struct spinlock {
-    uint locked; // Is the lock held?
+    volatile uint next;  // next ticket to hand out
+    volatile uint owner; // ticket holding the lock, the lock is held if owner != next
 
     // For debugging:
     char *name;             // Name of lock.
     struct thread_cpu *cpu; // The cpu holding the lock.
 #ifdef __LOCKTRACE__
     int debug;
+    struct lock_stat *stat;
 #endif
 };
 
 typedef struct spinlock spinlock_t;
-#define INIT_SPINLOCK(NAME)                     \
-    (spinlock_t) {                              \
-        .locked = 0, .name = #NAME, .cpu = NULL \
+#define INIT_SPINLOCK(NAME)                                  \
+    (spinlock_t) {                                           \
+        .next = 0, .owner = 0, .name = #NAME, .cpu = NULL \
     }
 
+// racy, only a hint
+static inline int spin_is_locked(struct spinlock *lk) {
+    return lk->owner != lk->next;
+}
+
 #define acquire(lock) wrap_acquire(__FILE__, __LINE__, (lock))
 #define release(lock) wrap_release(__FILE__, __LINE__, (lock))
 void wrap_acquire(char *file, int line, struct spinlock *lock);
@@ -33,5 +51,8 @@ void initlock(struct spinlock *, char *);
 void push_off(void);
 void pop_off(void);
 int atomic_read4(int *addr);
+#ifdef __LOCKTRACE__
+void lock_stat_print(void);
+#endif
 
 #endif // __SPINLOCK_H__
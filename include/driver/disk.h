@@ -5,13 +5,8 @@ struct buffer_head;
 struct bio;
 struct bio_vec;
 
-// #define BLOCK_SEL BLOCK_OLD
-#define BLOCK_SEL BLOCK_NEW
-#define BLOCK_OLD 0 // buffer header
-#define BLOCK_NEW 1 // bio
-
-// b is a pointer to struct bio_vec
-void disk_rw(void *b, int write, int type);
+// queue all bio_vecs of bio, bio_vec_endio() is called when each of them is done
+void disk_submit_bio(struct bio *bio);
 void disk_intr();
 void disk_init();
 void dma_intr(int irq);
@@ -42,3 +42,6 @@
 #define EPIPE 32  /* Broken pipe */
 #define EDOM 33   /* Math argument out of domain of func */
 #define ERANGE 34 /* Math result not representable */
+#define ENOSYS 38 /* Function not implemented */
+
+#define ETIMEDOUT 110 /* Connection timed out */
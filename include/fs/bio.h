@@ -5,6 +5,7 @@
 #include "lib/list.h"
 #include "atomic/ops.h"
 #include "atomic/semaphore.h"
+#include "atomic/mutex.h"
 #include "fs/vfs/fs_macro.h"
 #include "lib/list.h"
 
@@ -13,11 +14,12 @@
 
 // we reserve buffer_head of xv6
 struct buffer_head {
-    struct semaphore sem_lock;
-    struct semaphore sem_disk_done;
+    struct mutex lock;
     uint blockno;
     atomic_t refcnt;
-    list_head_t lru; // LRU cache list
+    list_head_t hash;       // hash chain of bcache bucket
+    int referenced;         // second chance bit of clock replacement
+    list_head_t dirty_list; // delayed write list, holds a reference
     uchar data[BSIZE];
     int valid; // has data been read from disk?
     int dirty; // dirty
@@ -25,21 +27,46 @@ struct buffer_head {
     uint dev;
 };
 
+struct bio;
+typedef void (*bio_end_io_t)(struct bio *);
+
 // similar to bio of Linux
 struct bio {
     uint bi_bdev;                // device no
     uint64 bi_rw;                // read or write
     struct list_head list_entry; // entry
+
+    // completion
+    atomic_t bi_remaining;    // number of bio_vecs in flight
+    bio_end_io_t bi_end_io;   // called when all bio_vecs are done (maybe in interrupt)
+    void *bi_private;         // for bi_end_io
+    struct semaphore bi_done; // used by submit_bio
+};
+
+#define BIO_MAX_SEGS 16 // max segments of a bio_vec allocated by bio_vec_alloc
+
+struct page;
+
+// a piece of memory, the same as bio_vec of Linux
+struct bio_seg {
+    struct page *page;
+    uint offset; // in page
+    uint len;    // multiple of BSIZE, may cross pages if they are contiguous
 };
 
 // different from Linux
+// blocks are contiguous on disk, but the memory is scattered in segments
 struct bio_vec {
-    struct semaphore sem_disk_done;
     struct list_head list;
     uint blockno_start;
     uint block_len;
-    uchar *data;
+    int nseg;
+    int max_seg;
+    struct bio_seg *segs;      // segs[0..nseg), total len is block_len * BSIZE
+    struct bio_seg seg_inline; // segs of a single-segment bio_vec
     int disk;
+    struct bio *bio;           // the bio it belongs to
+    struct bio_vec *done_next; // completion list of disk driver
 };
 // start : 2
 // len : 4
@@ -50,10 +77,19 @@ void binit(void);
 struct buffer_head *bread(uint, uint);
 void brelse(struct buffer_head *);
 void bwrite(struct buffer_head *);
+void bcache_flush(void);
+void bcache_stat_print(void);
 // bio
 void disk_rw_bio(struct buffer_head *b, int rw);
 void init_bio(struct bio *bio_p, struct bio_vec *vec_p, struct buffer_head *b, int rw);
 void submit_bio(struct bio *bio, int free);
+void submit_bio_async(struct bio *bio, bio_end_io_t end_io, void *private);
+struct bio_vec *bio_vec_alloc(void);
+void bio_vec_init(struct bio_vec *vec, struct bio_seg *segs, int max_seg);
+int bio_vec_add_seg(struct bio_vec *vec, void *data, uint len);
+uchar *bio_seg_data(struct bio_seg *seg);
+void bio_vec_endio(struct bio_vec *vec);
+void bio_free_vecs(struct bio *bio);
 void bio_print(struct bio *bio);
 
 #endif // __BIO_H__
\ No newline at end of file
@@ -279,7 +279,6 @@ void fat32_i_mapping_writeback(struct inode *ip);
 void fat32_i_mapping_destroy(struct inode *ip);
 
 // ignore it, a rough process
-void alloc_fail(void);
 
 void shutdown_writeback(void);
 // ======================= abandon， may be ============================
@@ -5,6 +5,7 @@
 #include "param.h"
 #include "atomic/spinlock.h"
 #include "atomic/semaphore.h"
+#include "atomic/mutex.h"
 #include "fs/stat.h"
 #include "fs/fcntl.h"
 #include "fs/fat/fat32_mem.h"
@@ -139,12 +140,13 @@ struct inode {
     long i_atime;        // access time
     long i_mtime;        // modify time
     long i_ctime;        // create time
+    uint64 i_version;    // bumped when the data changes (write, truncate), see load_elf_interp
     blksize_t i_blksize; // bytes of one block
     blkcnt_t i_blocks;   // numbers of blocks
 
-    struct semaphore i_sem;            /* binary semaphore */
-    struct semaphore i_read_lock;      // special for mpage_read
-    struct semaphore i_writeback_lock; // special for write back and clear cache
+    struct mutex i_mutex;          // sleep lock of the inode, see fat32_inode_lock
+    struct mutex i_read_lock;      // special for mpage_read
+    struct mutex i_writeback_lock; // special for write back and clear cache
 
     const struct inode_operations *i_op;
     struct _superblock *i_sb;
@@ -190,9 +192,21 @@ struct address_space {
     struct inode *host;               /* owner: inode*/
     struct radix_tree_root page_tree; /* radix tree(root) of all pages */
     uint64 nrpages;                   /* number of total pages */
-    uint64 last_index;                // 2 4 6 8 ... read head policy
-    uint64 read_ahead_cnt;            // the number of read ahead
-    uint64 read_ahead_end;            // the end index of read ahead
+
+    // read ahead window : [ra_start, ra_start + ra_size)
+    // the marker page (PG_readahead) is ra_start + ra_size - ra_async_size,
+    // the next window is read in the background when the reader gets there
+    uint64 ra_start;
+    uint64 ra_size;
+    uint64 ra_async_size;
+
+    // read ahead statistics
+    uint64 ra_sync_cnt;  // windows read because of miss
+    uint64 ra_async_cnt; // windows read because of marker
+    uint64 ra_pages;     // pages read ahead
+    uint64 ra_hits;      // pages found in page cache by reader
+    uint64 ra_misses;    // pages not found in page cache by reader
+    uint64 ra_waits;     // pages found under read
 };
 
 struct file_operations {
@@ -2,6 +2,7 @@
 #define __HASH_H__
 
 #include "atomic/spinlock.h"
+#include "atomic/rcu.h"
 #include "lib/list.h"
 #include "param.h"
 
@@ -14,21 +15,22 @@ struct hash_node {
     };
     void *value; // value
     struct list_head list;
+    struct rcu_head rcu; // a deleted node is freed after readers of hash_find
 };
 
+// every bucket has its own lock, writers and hash_lookup take it, hash_find does not
 struct hash_entry {
+    struct spinlock lock;
     struct list_head list;
 };
 
 enum hash_type { PID_MAP,
                  TID_MAP,
                  IPC_IDX_MAP,
-                 FUTEX_MAP,
                  INODE_MAP
 };
 
 struct hash_table {
-    struct spinlock lock;
     enum hash_type type;
     uint64 size;                  // table size
     struct hash_entry *hash_head; // hash entry
@@ -36,6 +38,7 @@ struct hash_table {
 
 struct hash_entry *hash_get_entry(struct hash_table *table, void *key, int holding);
 struct hash_node *hash_lookup(struct hash_table *table, void *key, struct hash_entry **entry, int release, int holding);
+void *hash_find(struct hash_table *table, void *key);
 void hash_insert(struct hash_table *table, void *key, void *value, int holding);
 void hash_delete(struct hash_table *table, void *key, int holding, int release);
 void hash_destroy(struct hash_table *table, int free);
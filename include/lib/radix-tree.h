@@ -98,6 +98,7 @@ int radix_tree_tag_get(struct radix_tree_root *root, uint64 index, uint32 tag);
 // auxiliary functions
 uint64 radix_tree_maxindex(uint height);
 // allocate
+void radix_tree_init(void);
 struct radix_tree_node *radix_tree_node_alloc(struct radix_tree_root *root);
 // search
 void *radix_tree_lookup_node(struct radix_tree_root *root, uint64 index);
@@ -0,0 +1,45 @@
+#ifndef __RBTREE_H__
+#define __RBTREE_H__
+#include "common.h"
+#include "lib/list.h"
+
+// red-black tree, the node is embedded in the object like list_head.
+// the user walks down the tree to find the place, links the node with rb_link_node,
+// then rebalances with rb_insert_color.
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+struct rb_node {
+    struct rb_node *rb_parent;
+    struct rb_node *rb_left;
+    struct rb_node *rb_right;
+    int rb_color;
+};
+
+struct rb_root {
+    struct rb_node *rb_node;
+};
+
+#define RB_ROOT \
+    (struct rb_root) { NULL }
+#define RB_EMPTY_ROOT(root) ((root)->rb_node == NULL)
+#define rb_entry(ptr, type, member) container_of(ptr, type, member)
+
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent, struct rb_node **link) {
+    node->rb_parent = parent;
+    node->rb_left = node->rb_right = NULL;
+    node->rb_color = RB_RED;
+    *link = node;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root);
+void rb_erase(struct rb_node *node, struct rb_root *root);
+
+// in order
+struct rb_node *rb_first(const struct rb_root *root);
+struct rb_node *rb_last(const struct rb_root *root);
+struct rb_node *rb_next(const struct rb_node *node);
+struct rb_node *rb_prev(const struct rb_node *node);
+
+#endif // __RBTREE_H__
@@ -113,6 +113,8 @@ w_sip(uint64 x) {
 #define SIE_SEIE (1L << 9) // external
 #define SIE_STIE (1L << 5) // timer
 #define SIE_SSIE (1L << 1) // software
+// Supervisor Interrupt Pending
+#define SIP_SSIP (1L << 1) // software
 static inline uint64
 r_sie() {
     uint64 x;
@@ -328,6 +330,13 @@ intr_get() {
     return (x & SSTATUS_SIE) != 0;
 }
 
+// wait for interrupt
+// it returns when an interrupt is pending, even if device interrupts are disabled
+static inline void
+wfi() {
+    asm volatile("wfi");
+}
+
 static inline uint64
 r_sp() {
     uint64 x;
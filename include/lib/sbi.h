@@ -8,6 +8,7 @@
 #define SHUTDOWN_EXT 0x08L
 #define TIMER_EXT 0x54494D45L
 #define HSM_EXT 0x48534DL
+#define IPI_EXT 0x735049L
 
 #define SBI_SUCCESS 0
 
@@ -55,6 +56,11 @@ static inline int sbi_hart_get_status(uint64 hartid) {
     return (ret.error == 0 ? (int)ret.value : (int)ret.error);
 }
 
+// raise a supervisor software interrupt on the harts in hart_mask
+static inline struct sbiret sbi_send_ipi(uint64 hart_mask, uint64 hart_mask_base) {
+    return SBI_CALL_2(IPI_EXT, 0, hart_mask, hart_mask_base);
+}
+
 // return the error code. On success, SBI_SUCCESS is returned
 static inline int sbi_hart_start(uint64 hartid, uint64 start, uint64 arg) {
     return SBI_CALL_3(HSM_EXT, 0, hartid, start, arg).error;
@@ -8,15 +8,36 @@
 #include "lib/riscv.h"
 #include "memory/memlayout.h"
 
-// #define SET_TIMER() sbi_legacy_set_timer(*(uint64 *)CLINT_MTIME + CLINT_INTERVAL)
-#define SET_TIMER() sbi_legacy_set_timer(rdtime() + CLINT_INTERVAL)
+// the cpu which counts ticks and signals cond_ticks
+#if defined(SIFIVE_U) || defined(SIFIVE_B)
+#define TICK_CPU 1 // bugs: can't be 0 when based on sifive_u
+#else
+#define TICK_CPU 0 // QEMU : cpuid is 0
+#endif
 #define TIME_OUT(timer_cur) (TIME2NS(rdtime()) > ((timer_cur)->expires_end))
 
 typedef void (*timer_expire)(void *); // uint64
 
-struct timer_entry {
+// per-cpu timing wheel, see timer.c
+#define TIMER_GRAN_NS 1000000UL // 1ms, unit of the wheel clock
+#define LVL_BITS 6
+#define LVL_SIZE (1 << LVL_BITS) // slots of a level
+#define LVL_CLK_SHIFT 3          // each level is 8 times coarser than the one below
+#define LVL_DEPTH 6              // level 5 : slots of 32s, 34 minutes in all
+#define WHEEL_SIZE (LVL_SIZE * LVL_DEPTH)
+
+struct timer_base {
     struct spinlock lock;
-    struct list_head entry;
+    uint64 clk;                      // wheel clock, the next jiffy to be processed
+    uint64 pending[LVL_DEPTH];       // bit i : slot i of the level is not empty
+    struct list_head vectors[WHEEL_SIZE];
+    struct timer_list *running_timer; // a periodic timer whose function is running
+    struct list_head hrtimers;       // sorted by expires
+    struct hrtimer *running_hrtimer; // an hrtimer whose function is running
+    uint64 next_tick;                // rdtime of the next periodic clock interrupt
+    int tick_stopped;                // idle without periodic clock interrupts
+    uint64 nr_expired;
+    uint64 nr_hrtimer_expired;
 };
 
 struct timer_list {
@@ -29,12 +50,32 @@ struct timer_list {
     int cycle;                // for every clock interrupt
     int over;                 // for pselect
     uint64 interval;          // for setitimer
+    struct timer_base *base;  // the wheel it was added to
+    int idx;                  // slot in base->vectors
 };
 
-void timer_entry_init(struct timer_entry *t_entry, char *name);
+// high resolution one-shot timer, the timer of the cpu is programmed for it
+// function runs in clock interrupt
+struct hrtimer {
+    struct list_head list;
+    uint64 expires; // ns, absolute
+    timer_expire function;
+    void *data;
+    struct timer_base *base; // NULL if not pending
+};
+
+void hrtimer_init(struct hrtimer *timer, timer_expire function, void *data);
+void hrtimer_start(struct hrtimer *timer, uint64 expires);
+int hrtimer_cancel(struct hrtimer *timer);
+
 void add_timer_atomic(struct timer_list *timer, uint64 expires, timer_expire function, void *data);
 void delete_timer_atomic(struct timer_list *timer);
-void timer_list_decrease_atomic(struct timer_entry *head);
+void run_local_timers(void);
+void timer_init_hart(void);
+int timer_interrupt(void);
+void tick_nohz_idle_enter(void);
+void tick_nohz_idle_exit(void);
 void clockintr();
+void timer_stat_print(void);
 
 #endif
\ No newline at end of file
@@ -2,7 +2,10 @@
 #define __ALLOCATOR_H__
 
 #include "common.h"
-#define PAGES_THRESHOLD 500
+// watermarks of free pages
+#define PAGES_THRESHOLD 500                   // min
+#define PAGES_WMARK_LOW (PAGES_THRESHOLD * 2)  // wake up kswapd
+#define PAGES_WMARK_HIGH (PAGES_THRESHOLD * 3) // kswapd goes to sleep
 
 /* reserve this to be compatible with the old kalloc call
  * use kmalloc(PGSIZE) instead
@@ -13,8 +16,10 @@ void kfree(void *);
 void *kzalloc(size_t size);
 void *kmalloc(size_t size);
 void share_page(uint64 pa);
+void drain_local_pages(void);
 
 /* get available memory size */
 uint64 get_free_mem();
+uint64 nr_free_pages(void);
 
 #endif // __ALLOCATOR_H__
@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "lib/elf.h"
+#include "atomic/mutex.h"
 
 struct mm;
 struct inode;
@@ -26,6 +27,7 @@ struct binprm {
 
     /* interpreter */
     int interp;
+    uint64 interp_entry;
 
     /* sh interp*/
     int sh;
@@ -44,7 +46,12 @@ struct binprm {
     int stack_limit;
 };
 
+/* the loaded image of the interpreter, cached while the file is not changed.
+ * processes map its pages copy-on-write */
 struct interpreter {
+    struct mutex lock;
+    struct inode *ip;
+    uint64 version; // i_version of ip when it was loaded
     struct mm_struct *mm;
     uint64 size;
     uint64 entry;
@@ -54,4 +61,5 @@ struct interpreter {
 };
 
 int do_execve(char *path, struct binprm *bprm);
+void ldso_cache_init(void);
 #endif // __BINFMT_H__
\ No newline at end of file
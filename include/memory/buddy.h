@@ -32,12 +32,19 @@
 extern struct page *pagemeta_start;
 
 // page status
-#define PG_locked 0x01
+#define PG_locked 0x01    // under read, see wait_on_page_read
 #define PG_dirty 0x02
+#define PG_readahead 0x03 // marker of async read ahead
+#define PG_lru 0x04       // on active or inactive list, see vmscan.c
+#define PG_active 0x05    // on active list
+#define PG_referenced 0x06
+#define PG_slab 0x07      // page of slab allocator, see slab.c
 
 // chage the refcnt of page (atomic)
 #define page_cache_get(page) (atomic_inc_return(&page->refcnt))
 #define page_cache_put(page) (atomic_dec_return(&page->refcnt))
+// fails if the last reference has gone, the page is being freed
+#define page_cache_get_unless_zero(page) (atomic_inc_not_zero(&page->refcnt))
 
 struct page {
     // use for buddy system
@@ -54,6 +61,8 @@ struct page {
     struct address_space *mapping;
     // pagecache index
     uint64 index;
+    // active or inactive list of page cache
+    struct list_head lru;
 };
 
 struct free_list {
@@ -74,11 +83,37 @@ struct phys_mem_pool {
 
     /* The free list of different free-memory-chunk orders. */
     struct free_list freelists[BUDDY_MAX_ORDER + 1];
+
+    /* free pages in freelists, protected by lock, read without lock by nr_free_pages() */
+    uint64 nr_free;
+    /* statistics of other cpus stealing from this pool */
+    atomic_t steal_cnt;
+    atomic_t steal_pages;
 };
 extern struct phys_mem_pool mempools[NCPU];
 
+/*
+ * per-cpu free lists of small pages (order <= PCP_MAX_ORDER) in front of buddy system,
+ * only touched by its own cpu with interrupt off, so no lock is needed.
+ * they are refilled from and drained to buddy system PCP_BATCH pages at a time.
+ */
+#define PCP_MAX_ORDER 3
+#define PCP_HIGH 64  // drain when more than PCP_HIGH >> order blocks are cached
+#define PCP_BATCH 16 // refill/drain PCP_BATCH >> order blocks at a time
+
+struct per_cpu_pages {
+    struct list_head lists[PCP_MAX_ORDER + 1];
+    int count[PCP_MAX_ORDER + 1];
+};
+extern struct per_cpu_pages pcplists[NCPU];
+
 void buddy_free_pages(struct phys_mem_pool *pool, struct page *page);
 struct page *buddy_get_pages(struct phys_mem_pool *pool, uint64 order);
+int buddy_get_pages_bulk(struct phys_mem_pool *pool, uint64 order, int n, struct list_head *list);
+void buddy_free_pages_bulk(struct phys_mem_pool *pool, struct list_head *list);
+void mempool_stat_print(void);
+void split_pages(struct page *page);
+int buddy_free_blocks(struct phys_mem_pool *pool, uint64 order);
 
 static inline void set_page_flags(struct page *page, uint64 flags) {
     set_bit(flags, &page->flags);
@@ -88,6 +123,10 @@ static inline void clear_page_flags(struct page *page, uint64 flags) {
     clear_bit(flags, &page->flags);
 }
 
+static inline int test_page_flags(struct page *page, uint64 flags) {
+    return test_bit(flags, &page->flags);
+}
+
 static inline uint64 page_to_pa(struct page *page) {
     return (page - pagemeta_start) * PGSIZE + START_MEM;
 }
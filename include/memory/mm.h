@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "lib/list.h"
+#include "lib/rbtree.h"
 #include "atomic/semaphore.h"
 
 typedef unsigned long vm_flags_t;
@@ -11,6 +12,8 @@ typedef unsigned long vm_flags_t;
 struct vma;
 struct mm_struct {
     struct list_head head_vma;
+    struct rb_root vma_rb;
+    uint64 vmacache_seq; // changed when a vma is removed, see find_vma_for_va
     pagetable_t pagetable; // User page table
 
     paddr_t start_brk, brk; /* program break */
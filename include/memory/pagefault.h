@@ -11,6 +11,9 @@
                                 || ((cause) == LOAD_PAGEFAULT && (vma->perm & PERM_READ)) \
                                 || ((cause) == INSTUCTION_PAGEFAULT && (vma->perm & PERM_EXEC)))
 
+extern paddr_t zero_page;
+void zero_page_init(void);
+
 /* copy-on write */
 int cow(pte_t *pte, int level, paddr_t pa, int flags);
 int is_a_cow_page(int flags);
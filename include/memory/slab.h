@@ -0,0 +1,49 @@
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include "common.h"
+#include "param.h"
+#include "atomic/spinlock.h"
+#include "lib/list.h"
+
+#define SLAB_MAG_SIZE 16 // objects cached by each cpu for a kmem_cache
+
+// per-cpu magazine of free objects, only touched by its own cpu with interrupt off
+struct kmem_magazine {
+    int count;
+    void *objs[SLAB_MAG_SIZE];
+};
+
+struct kmem_cache {
+    const char *name;
+    uint obj_size;
+    uint objs_per_slab;
+
+    struct spinlock lock;
+    struct list_head partial; // slabs with some free objects
+    struct list_head full;    // slabs without free objects
+    struct list_head empty;   // at most one slab is kept
+    int nr_slabs;             // protected by lock
+    int nr_empty;             // protected by lock
+    int nr_objs;              // objects out of slabs (in use or in magazines), protected by lock
+
+    struct kmem_magazine mag[NCPU];
+    struct list_head chain; // all caches, see slab_stat_print
+};
+
+// a slab is a page, the objects follow this header
+struct slab {
+    struct list_head list;
+    struct kmem_cache *cache;
+    void *freelist; // next free object is stored in the first word of a free object
+    int inuse;
+};
+
+void kmem_cache_init(void);
+struct kmem_cache *kmem_cache_create(const char *name, uint size);
+void *kmem_cache_alloc(struct kmem_cache *cachep);
+void *kmem_cache_zalloc(struct kmem_cache *cachep);
+void kmem_cache_free(struct kmem_cache *cachep, void *obj);
+void slab_stat_print(void);
+
+#endif // __SLAB_H__
@@ -4,12 +4,14 @@
 #include "common.h"
 #define COMMONPAGE 0
 #define SUPERPAGE 1 /* 2MB superpage */
+#define SUPERPAGE_ORDER 9 /* buddy order of a superpage */
 
 struct mm_struct;
 void kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm, int lowlevel);
 int walk(pagetable_t pagetable, uint64 va, int alloc, int lowlevel, pte_t **pte);
 paddr_t getphyaddr(pagetable_t pagetable, vaddr_t va);
 uint64 walkaddr(pagetable_t pagetable, uint64 va);
+uint64 walkaddr_fault(pagetable_t pagetable, uint64 va);
 int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm, int lowlevel);
 pagetable_t uvmcreate(void);
 vaddr_t uvmalloc(pagetable_t pagetable, vaddr_t startva, vaddr_t endva, int perm);
@@ -17,6 +19,7 @@ uint64 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz);
 int uvmcopy(struct mm_struct *srcmm, struct mm_struct *dstmm);
 void uvmfree(struct mm_struct *mm);
 void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free, int on_demand);
+int split_superpage(pagetable_t pagetable, vaddr_t va);
 void uvmclear(pagetable_t pagetable, uint64 va);
 void freewalk(pagetable_t pagetable, int level);
 
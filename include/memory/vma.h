@@ -3,10 +3,8 @@
 
 #include "common.h"
 #include "lib/list.h"
+#include "lib/rbtree.h"
 #include "memory/mm.h"
-#include "lib/list.h"
-
-#define NVMA 3000
 
 // mmap
 #define MAP_FILE 0
@@ -39,26 +37,30 @@ typedef enum {
 /* virtual memory area */
 struct vma {
     vmatype type;
-    struct list_head node;
+    struct list_head node; // in mm->head_vma, sorted by startva
+    struct rb_node rb;     // in mm->vma_rb, keyed by startva
     vaddr_t startva;
     size_t size;
     uint32 perm;
 
-    // temp
-    int used;
-
     /* for VMA_FILE */
     // int fd;
     uint64 offset;
     struct file *vm_file;
+
+    /* for VMA_TEXT of an elf segment, read from vm_inode at offset on demand,
+       the bytes from file_end to the end of vma are bss */
+    struct inode *vm_inode;
+    vaddr_t file_end;
 };
 
-extern struct vma vmas[NVMA];
 int vma_map_file(struct mm_struct *mm, uint64 va, size_t len, uint64 perm, uint64 type, off_t offset, struct file *fp);
 int vma_map(struct mm_struct *mm, uint64 va, size_t len, uint64 perm, uint64 type);
+int vma_map_elf(struct mm_struct *mm, uint64 va, size_t len, uint64 perm, off_t offset, struct inode *ip, vaddr_t file_end);
 int vmspace_unmap(struct mm_struct *mm, vaddr_t va, size_t len);
 
 struct vma *find_vma_for_va(struct mm_struct *mm, vaddr_t addr);
+void vmacache_invalidate(struct mm_struct *mm);
 vaddr_t find_mapping_space(struct mm_struct *mm, vaddr_t start, size_t size);
 int split_vma(struct mm_struct *mm, struct vma *vma, unsigned long addr, int new_below);
 int vmacopy(struct mm_struct *srcmm, struct mm_struct *dstmm);
@@ -66,7 +68,7 @@ void free_all_vmas(struct mm_struct *mm);
 void print_vma(struct list_head *head_vma);
 
 // for mmap
-void del_vma_from_vmspace(struct list_head *vma_head, struct vma *vma);
+void del_vma_from_vmspace(struct mm_struct *mm, struct vma *vma);
 void *do_mmap(vaddr_t addr, size_t length, int prot, int flags, struct file *fp, off_t offset);
 
 #endif // __VMA_H__
\ No newline at end of file
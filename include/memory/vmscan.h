@@ -0,0 +1,19 @@
+#ifndef __VMSCAN_H__
+#define __VMSCAN_H__
+
+#include "common.h"
+#include "memory/buddy.h"
+
+#define SWAP_CLUSTER_MAX 32 // max pages isolated from LRU at a time
+#define COMPACT_MAX_TRY 4    // max blocks freed by a compaction
+
+void lru_init(void);
+void lru_cache_add(struct page *page);
+void lru_cache_del(struct page *page);
+void mark_page_accessed(struct page *page);
+void wakeup_kswapd(void);
+void kswapd_init(void);
+void lru_stat_print(void);
+int compact_pages(uint64 order);
+
+#endif // __VMSCAN_H__
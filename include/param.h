@@ -15,13 +15,16 @@
 #define MAXENV 32                 // max exec environment arguments
 #define MAXOPBLOCKS 10            // max # of blocks any FS op writes
 #define LOGSIZE (MAXOPBLOCKS * 3) // max data blocks in on-disk log
-#define NBUF (MAXOPBLOCKS * 3)    // size of disk block cache
+#define NBUF_MIN (MAXOPBLOCKS * 3) // min size of disk block cache
+#define NBUF_MAX 4096              // max size of disk block cache
+#define BCACHE_MEM_SHIFT 7         // disk block cache takes 1/128 of free memory
 #define FSSIZE 2000               // size of file system in blocks
 #define MAXPATH 128               // maximum file path name
 
 #define NAME_LONG_MAX 255
 #define PATH_LONG_MAX 260
-#define FUTEX_NUM 32 // number of futex queue
+#define FUTEX_NUM 256 // number of futex hash buckets
+#define THP_ENABLE 1 // back aligned anonymous memory with 2MB superpages on page fault
 
 // // in xv6
 // #define MAXPATH 128 // maximum file path name
@@ -3,7 +3,8 @@
 
 #include "common.h"
 
-void virtio_disk_rw(void *, int, int);
+struct bio;
+void virtio_disk_submit(struct bio *);
 void virtio_disk_intr(void);
 
 //
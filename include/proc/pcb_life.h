@@ -78,6 +78,11 @@ struct proc {
     struct timer_list real_timer;
     // for futex
     struct robust_list_head *robust_list;
+    // for vfork
+    int vfork;                   // the parent sleeps on sem_vfork until it execs or exits
+    struct semaphore sem_vfork;
+    struct mm_struct *vfork_mm;  // its own mm while it runs in the memory of the parent
+    uint64 vfork_trapframe;      // the trapframe of the parent, mapped back on release
 
     uint64 utime, stime, last_in, last_out;
     uint64 stub_time;
@@ -125,6 +130,7 @@ int do_clone(uint64 flags, vaddr_t stack, uint64 ptid, uint64 tls, uint64 ctid);
 void exit_wakeup(struct proc *p, struct tcb *t); // for futex
 void do_exit_group(struct proc *p);
 void do_exit(int status);
+void vfork_release(struct proc *p);
 int waitpid(pid_t pid, uint64 status, int options);
 void reparent(struct proc *p);
 
@@ -7,6 +7,48 @@
 struct proc;
 struct tcb;
 
+// scheduling policies, same as linux
+#define SCHED_OTHER 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+#define SCHED_RESET_ON_FORK 0x40000000
+
+#define MAX_RT_PRIO 99
+#define NICE_MIN (-20)
+#define NICE_MAX 19
+#define NICE_0_WEIGHT 1024
+
+// time slices, the clock interrupt is the granularity of preemption
+#define SCHED_LATENCY_NS (200 * 1000000UL)         // every SCHED_OTHER thread runs once in it
+#define SCHED_MIN_GRANULARITY_NS (10 * 1000000UL) // min slice of SCHED_OTHER
+#define RR_TIMESLICE_NS (100 * 1000000UL)
+
+#define CPU_MASK_ALL ((1UL << NCPU) - 1)
+
+#define rt_policy(policy) ((policy) == SCHED_FIFO || (policy) == SCHED_RR)
+
+struct sched_param {
+    int sched_priority;
+};
+
+// per-cpu run queue
+// a thread is queued on the cpu which makes it runnable, idle cpus steal from the busiest one
+// realtime threads run first by priority, then SCHED_OTHER threads by vruntime
+struct rq {
+    struct spinlock lock;
+    struct list_head rt;      // SCHED_FIFO and SCHED_RR, higher priority first
+    struct list_head fair;    // SCHED_OTHER, smaller vruntime first
+    volatile int nr_running;  // threads in rt and fair, read by other cpus without lock
+    volatile int nr_migratory; // threads allowed on other cpus, which can be stolen
+    uint64 load_weight;       // weights of threads in fair
+    uint64 min_vruntime;      // only increases
+    volatile int need_resched; // a queued thread should preempt the running one
+    volatile int idle;        // the cpu waits for interrupt in the scheduler
+    uint64 nr_switches;       // only changed by its own cpu
+    uint64 nr_steals;         // threads stolen from other cpus, only changed by its own cpu
+};
+extern struct rq runqueues[NCPU];
+
 void PCB_Q_ALL_INIT(void);
 void PCB_Q_changeState(struct proc *, enum procstate);
 
@@ -15,7 +57,14 @@ void TCB_Q_changeState(struct tcb *t, enum thread_state state_new);
 
 void thread_wakeup_atomic(void *t);
 void thread_wakeup(struct tcb *t);
+int thread_wakeup_chan(struct tcb *t, struct Queue *chan);
 void thread_yield(void);
+void sched_fork(struct tcb *t);
+int sched_tick(void);
+int need_resched(void);
+int sched_setattr(struct tcb *t, int policy, int rt_priority, int nice);
+int sched_setaffinity(struct tcb *t, uint64 mask);
+void sched_stat_print(void);
 
 int thread_sched(void);
 void thread_scheduler(void) __attribute__((noreturn));
@@ -7,6 +7,7 @@
 #include "proc/pcb_life.h"
 #include "atomic/spinlock.h"
 #include "atomic/ops.h"
+#include "atomic/futex.h"
 #include "ipc/signal.h"
 #include "lib/riscv.h"
 #include "lib/queue.h"
@@ -63,6 +64,8 @@ struct tcb {
     int killed;
     // tcb state queue
     struct list_head state_list;
+    // the cpu whose run queue it is on or it last ran on, see sched.c
+    int cpu;
     // signal
     int sig_pending_cnt;       // have signal?
     struct sighand *sig;       // signal
@@ -88,6 +91,24 @@ struct tcb {
     uint64 clear_child_tid;
     // used for nanosleep and futex
     uint64 time_out;
+    int timer_woken; // woken up by the timer of thread_sched
+    // futex waited on, valid while it is in a futex bucket
+    struct futex_key futex_key;
+    uint futex_bitset;
+    uint64 futex_requeue_seq; // picked by a futex_requeue, under the bucket lock
+    // the last vma found by find_vma_for_va, valid while vmacache_seq equals that of its mm
+    struct vma *vmacache;
+    uint64 vmacache_seq;
+    // scheduling, see sched.c
+    int policy;              // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+    int rt_priority;         // 1 ~ 99 for SCHED_FIFO and SCHED_RR
+    int nice;                // -20 ~ 19 for SCHED_OTHER
+    int sched_reset_on_fork; // children start with SCHED_OTHER and nice 0
+    uint64 vruntime;         // ns, weighted by nice
+    uint64 exec_start;       // ns, last time the runtime was accounted
+    uint64 slice_start;      // ns, when it was switched in
+    uint64 sum_exec_runtime; // ns
+    uint64 cpus_allowed;     // bit i for cpu i, see sched_setaffinity
 };
 
 // =============================== tid management =========================
@@ -105,6 +126,7 @@ void create_thread(struct proc *p, struct tcb *t, char *name, thread_callback ca
 void tginit(struct thread_group *tg);
 
 void thread_forkret(void);
+int do_sleep_until(struct tcb *t, uint64 deadline);
 int do_sleep_ns(struct tcb *t, struct timespec ts);
 void free_thread(struct tcb *t);
 int thread_killed(struct tcb *t);
@@ -10,22 +10,26 @@ extern struct proc proc[NPROC];
 extern struct tcb thread[NTCB];
 
 extern Queue_t unused_p_q, used_p_q, zombie_p_q;
-extern Queue_t unused_t_q, runnable_t_q, sleeping_t_q;
 
 // init
 void cond_init(struct cond *cond, char *name) {
     Queue_init(&cond->waiting_queue, name, TCB_WAIT_QUEUE);
 }
 
-// wait
-int cond_wait(struct cond *cond, struct spinlock *mutex) {
+// wait, a killed thread exits when it wakes up unless uninterruptible
+static int __cond_wait(struct cond *cond, struct spinlock *mutex, int killable) {
     struct tcb *t = thread_current();
 
     acquire(&t->lock);
 
     TCB_Q_changeState(t, TCB_SLEEPING);
 
-    Queue_push_back(&cond->waiting_queue, (void *)t);
+    // cond_sleep and cond_ticks waiters pass the channel lock itself as mutex
+    if (mutex == &cond->waiting_queue.lock) {
+        Queue_push_back(&cond->waiting_queue, (void *)t);
+    } else {
+        Queue_push_back_atomic(&cond->waiting_queue, (void *)t);
+    }
 
     t->wait_chan_entry = &cond->waiting_queue; // !!!
 
@@ -36,7 +40,7 @@ int cond_wait(struct cond *cond, struct spinlock *mutex) {
     // ==========special for signal==============
     int killed = t->killed;
     release(&t->lock);
-    if (killed) {
+    if (killed && killable) {
         do_exit(-1);
     }
     // ==========special for signal ==============
@@ -46,43 +50,36 @@ int cond_wait(struct cond *cond, struct spinlock *mutex) {
     return ret;
 }
 
+int cond_wait(struct cond *cond, struct spinlock *mutex) {
+    return __cond_wait(cond, mutex, 1);
+}
+
+// the caller must recheck its condition, a signal sent to the thread wakes it up too
+int cond_wait_uninterruptible(struct cond *cond, struct spinlock *mutex) {
+    return __cond_wait(cond, mutex, 0);
+}
+
 // just signal a object!!!
 void cond_signal(struct cond *cond) {
     struct tcb *t;
 
-    if (!Queue_isempty_atomic(&cond->waiting_queue)) {
-        t = (struct tcb *)Queue_provide_atomic(&cond->waiting_queue, 1); // remove it
+    while ((t = (struct tcb *)Queue_provide_atomic(&cond->waiting_queue, 1)) != NULL) { // remove it
         acquire(&t->lock);
-        if (t == NULL)
-            panic("cond signal : this cond has no object waiting queue");
-        if (t->state != TCB_SLEEPING) {
-            printf("%s\n", t->state);
-            panic("cond signal : this thread is not sleeping");
-        }
-        ASSERT(t->wait_chan_entry != NULL);
-        t->wait_chan_entry = NULL;
-        TCB_Q_changeState(t, TCB_RUNNABLE);
+        int woken = thread_wakeup_chan(t, &cond->waiting_queue);
         release(&t->lock);
+        if (woken) {
+            break;
+        }
     }
 }
 
 // signal all object!!!
 void cond_broadcast(struct cond *cond) {
     struct tcb *t;
-    while (!Queue_isempty_atomic(&cond->waiting_queue)) {
-        t = (struct tcb *)Queue_provide_atomic(&cond->waiting_queue, 1); // remove it
 
+    while ((t = (struct tcb *)Queue_provide_atomic(&cond->waiting_queue, 1)) != NULL) { // remove it
         acquire(&t->lock);
-        if (t == NULL)
-            panic("cond signal : this cond has no object waiting queue");
-        if (t->state != TCB_SLEEPING) {
-            printf("%s\n", cond->waiting_queue.name);
-            printf("%s\n", t->state);
-            panic("cond broadcast : this thread is not sleeping");
-        }
-        ASSERT(t->wait_chan_entry != NULL);
-        t->wait_chan_entry = NULL;
-        TCB_Q_changeState(t, TCB_RUNNABLE);
+        thread_wakeup_chan(t, &cond->waiting_queue);
         release(&t->lock);
     }
-}
\ No newline at end of file
+}
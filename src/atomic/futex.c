@@ -1,230 +1,464 @@
 #include "atomic/futex.h"
 #include "atomic/spinlock.h"
 #include "proc/sched.h"
+#include "proc/pcb_life.h"
+#include "proc/tcb_life.h"
+#include "memory/vm.h"
+#include "memory/pagefault.h"
+#include "memory/vma.h"
+#include "fs/vfs/fs.h"
 #include "lib/list.h"
 #include "lib/queue.h"
 #include "common.h"
+#include "errno.h"
 #include "debug.h"
-#include "lib/hash.h"
-#include "common.h"
 
-extern struct hash_table futex_map;
+// futexes are hashed on their key into FUTEX_NUM buckets, a waiter sleeps in the queue of its bucket.
+// lock order : t->lock -> bucket lock, as the timer (thread_wakeup_atomic) does,
+// so a waker finds a waiter with the bucket lock, then checks it again with t->lock.
+
+static struct futex_hash_bucket futex_queues[FUTEX_NUM];
 
-void futex_init(struct futex *fp, char *name) {
-    initlock(&fp->lock, name);
-    Queue_init(&fp->waiting_queue, name, TCB_WAIT_QUEUE);
+void futex_hash_init(void) {
+    for (int i = 0; i < FUTEX_NUM; i++) {
+        Queue_init(&futex_queues[i].waiters, "futex_bucket", TCB_WAIT_QUEUE);
+    }
 }
 
-// it is promised to be atomic
-struct futex *get_futex(uint64 uaddr, int assert) {
-    struct hash_node *node;
+static struct futex_hash_bucket *hash_futex(struct futex_key *key) {
+    uint64 hash = ((uint64)key->mm ^ (key->addr >> 2)) * 0x9E3779B97F4A7C15UL;
+    return &futex_queues[(hash >> 32) % FUTEX_NUM];
+}
 
-    node = hash_lookup(&futex_map, (void *)uaddr, NULL, 1, 0); // release it, not holding lock
-    if (node) {
-        // find it
-        return (struct futex *)(node->value);
-    } else {
-        if (assert == 1) {
-            return NULL;
+static inline int match_futex(struct futex_key *key1, struct futex_key *key2) {
+    return key1->mm == key2->mm && key1->addr == key2->addr;
+}
+
+// a futex of a private mapping is keyed by (mm, uaddr), its physical page changes on cow.
+// only a MAP_SHARED file mapping is shared by other mms, it is keyed by (inode, file offset)
+static int get_futex_key(uint64 uaddr, int flags, struct futex_key *key) {
+    struct mm_struct *mm = proc_current()->mm;
+    struct vma *vma;
+
+    if (uaddr % sizeof(uint) != 0) {
+        return -EINVAL;
+    }
+    if (flags & FLAGS_SHARED) {
+        if ((vma = find_vma_for_va(mm, uaddr)) == NULL) {
+            return -EFAULT;
         }
-        // create it
-        struct futex *fp = (struct futex *)kzalloc(sizeof(struct futex));
-        if (fp == NULL) {
-            printf("mm : %d\n", get_free_mem());
-            panic("get_futex : no free space\n");
+        if (vma->type == VMA_FILE && (vma->perm & PERM_SHARED)) {
+            key->mm = vma->vm_file->f_tp.f_inode;
+            key->addr = vma->offset + (uaddr - vma->startva);
+            return 0;
         }
-        futex_init(fp, "futex");
-        hash_insert(&futex_map, (void *)uaddr, (void *)fp, 0); // not holding lock
-        return fp;
     }
+    key->mm = mm;
+    key->addr = uaddr;
+    return 0;
 }
 
-// remember to release its memory
-void futex_free(uint64 uaddr) {
-    hash_delete(&futex_map, (void *)uaddr, 0, 1); // not holding lock, release lock
-    // printfGreen("mm ++: %d\n", get_free_mem());
+// read *uaddr, a page not mapped yet is faulted in only if no spinlock is held,
+// otherwise it fails and the caller retries after dropping its locks
+static int get_futex_value(uint64 uaddr, uint *val) {
+    return copyin(proc_current()->mm->pagetable, (char *)val, uaddr, sizeof(uint));
 }
 
-int futex_wait(uint64 uaddr, uint val, struct timespec *ts) {
-    uint u_val;
-    struct proc *p = proc_current();
+// make uaddr writable (break cow) and return its kernel address, or 0
+static uint *futex_user_writable(uint64 uaddr) {
+    pagetable_t pagetable = proc_current()->mm->pagetable;
+    pte_t *pte;
 
-    acquire(&p->lock);
-    if (copyin(p->mm->pagetable, (char *)&u_val, uaddr, sizeof(uint)) < 0) {
-        release(&p->lock);
-        return -1;
+    if (uaddr >= MAXVA) {
+        return NULL;
     }
-
-    if (u_val == val) {
-        struct futex *fp = get_futex(uaddr, 0); // without assert
-        struct tcb *t = thread_current();
-
-        acquire(&t->lock);
-        TCB_Q_changeState(t, TCB_SLEEPING);
-        Queue_push_back(&fp->waiting_queue, t);
-
-        release(&p->lock);
-        if (ts != NULL) {
-            t->time_out = TIMESEPC2NS((*ts));
+    walk(pagetable, uaddr, 0, 0, &pte);
+    if (pte == NULL || *pte == 0 || ((*pte & PTE_W) == 0 && is_a_cow_page(PTE_FLAGS(*pte)))) {
+        if (pagefault(STORE_PAGEFAULT, pagetable, uaddr) < 0) {
+            return NULL;
         }
-        t->wait_chan_entry = &fp->waiting_queue; // !!!!!
-
-#ifdef __DEBUG_FUTEX__
-        printfYELLOW("futex wait sleep, fp : %x, tid : %d, timeout : %d ns (%d s), uaddr %x\n", fp, t->tid, t->time_out, t->time_out / 1000 / 1000 / 1000, uaddr);
-#endif
-        int ret = thread_sched();
-        release(&t->lock);
+        walk(pagetable, uaddr, 0, 0, &pte);
+    }
+    if (pte == NULL || (*pte & PTE_W) == 0) {
+        return NULL;
+    }
+    uint64 pa = walkaddr(pagetable, PGROUNDDOWN(uaddr));
+    return pa == 0 ? NULL : (uint *)(pa + (uaddr - PGROUNDDOWN(uaddr)));
+}
 
-#ifdef __DEBUG_FUTEX__
-        if (ts != NULL) {
-            if (ret)
-                printfMAGENTA("futex wait wakeup, tid : %d, after time out wakeup, uaddr %x\n", t->tid, uaddr);
-            else
-                printfBlue("futex wait wakeup, tid : %d, before time out wakeup, uaddr %x\n", t->tid, uaddr);
+// first waiter of key in hb, holding hb->waiters.lock
+// with requeue_seq != 0, only a waiter picked by that futex_requeue
+static struct tcb *futex_first_waiter(struct futex_hash_bucket *hb, struct futex_key *key, uint bitset, uint64 requeue_seq) {
+    struct tcb *t;
+    list_for_each_entry(t, &hb->waiters.list, wait_list) {
+        if (match_futex(&t->futex_key, key) && (t->futex_bitset & bitset)
+            && (requeue_seq == 0 || t->futex_requeue_seq == requeue_seq)) {
+            return t;
         }
-#endif
-        if (ts != NULL)
-            return ret ? -1 : 0;
-        else
-            return 0;
-    } else {
-        release(&p->lock);
-        return 0;
     }
+    return NULL;
 }
 
-int futex_wakeup(uint64 uaddr, int nr_wake) {
-    struct proc *p = proc_current();
-    acquire(&p->lock);
+// holding t->lock, is t still waiting on key in hb?
+static inline int futex_still_waiting(struct tcb *t, struct futex_hash_bucket *hb, struct futex_key *key) {
+    return t->state == TCB_SLEEPING && t->wait_chan_entry == &hb->waiters && match_futex(&t->futex_key, key);
+}
 
-    // ========atomic=========
-    struct futex *fp = get_futex(uaddr, 1); // with assert
-    if (fp == NULL) {
-        release(&p->lock);
-        return 0;
+static void double_lock_hb(struct futex_hash_bucket *hb1, struct futex_hash_bucket *hb2) {
+    if (hb1 > hb2) {
+        struct futex_hash_bucket *tmp = hb1;
+        hb1 = hb2;
+        hb2 = tmp;
+    }
+    acquire(&hb1->waiters.lock);
+    if (hb1 != hb2) {
+        acquire(&hb2->waiters.lock);
     }
+}
 
-    struct tcb *t = NULL;
-    int ret = 0;
+static void double_unlock_hb(struct futex_hash_bucket *hb1, struct futex_hash_bucket *hb2) {
+    release(&hb1->waiters.lock);
+    if (hb1 != hb2) {
+        release(&hb2->waiters.lock);
+    }
+}
 
-    while (!Queue_isempty(&fp->waiting_queue) && ret < nr_wake) {
-        t = (struct tcb *)Queue_provide_atomic(&fp->waiting_queue, 1); // remove it
+// wake at most nr_wake waiters of key whose bitset matches
+static int futex_wake_key(struct futex_key *key, int nr_wake, uint bitset) {
+    struct futex_hash_bucket *hb = hash_futex(key);
+    struct tcb *t;
+    int ret = 0;
 
-        if (t == NULL)
-            panic("futex wakeup : no waiting queue");
-        if (t->state != TCB_SLEEPING) {
-            printf("%s\n", fp->waiting_queue.name);
-            printf("%s\n", t->state);
-            panic("futex wakeup : this thread is not sleeping");
+    while (ret < nr_wake) {
+        acquire(&hb->waiters.lock);
+        t = futex_first_waiter(hb, key, bitset, 0);
+        release(&hb->waiters.lock);
+        if (t == NULL) {
+            break;
         }
+
         acquire(&t->lock);
-        ASSERT(t->wait_chan_entry != NULL);
-        t->wait_chan_entry = NULL;
-        TCB_Q_changeState(t, TCB_RUNNABLE);
+        // its timer or a signal may wake it up meanwhile
+        if (futex_still_waiting(t, hb, key)) {
 #ifdef __DEBUG_FUTEX__
-        printfGreen("tid : %d futex wakeup tid : %d, uaddr : %x\n", thread_current()->tid, t->tid, uaddr);
+            printfGreen("tid : %d futex wakeup tid : %d, uaddr : %x\n", thread_current()->tid, t->tid, key->addr);
 #endif
+            thread_wakeup(t);
+            ret++;
+        }
         release(&t->lock);
-        ret++;
     }
+    return ret;
+}
 
-    if (Queue_isempty_atomic(&fp->waiting_queue)) {
+// timeout : ns from now, 0 for no timeout
+int futex_wait(uint64 uaddr, int flags, uint val, uint64 timeout, uint bitset) {
+    struct tcb *t = thread_current();
+    struct futex_key key;
+    struct futex_hash_bucket *hb;
+    uint uval;
+    int ret;
+
+    if (bitset == 0) {
+        return -EINVAL;
+    }
+    if ((ret = get_futex_key(uaddr, flags, &key)) < 0) {
+        return ret;
+    }
+    hb = hash_futex(&key);
+
+retry:
+    acquire(&t->lock);
+    acquire(&hb->waiters.lock);
+    // a waker changes *uaddr before it takes the bucket lock, so either we see the new value or we are woken up
+    if (get_futex_value(uaddr, &uval) < 0) {
+        release(&hb->waiters.lock);
+        release(&t->lock);
+        if (get_futex_value(uaddr, &uval) < 0) {
+            return -EFAULT;
+        }
+        goto retry;
+    }
+    if (uval != val) {
+        release(&hb->waiters.lock);
+        release(&t->lock);
+        return -EAGAIN;
+    }
+
+    t->futex_key = key;
+    t->futex_bitset = bitset;
+    t->futex_requeue_seq = 0;
+    Queue_push_back(&hb->waiters, t);
+    t->wait_chan_entry = &hb->waiters;
+    release(&hb->waiters.lock);
+    // a waker waits for t->lock, it sees TCB_SLEEPING
+    TCB_Q_changeState(t, TCB_SLEEPING);
+
+    t->time_out = timeout;
 #ifdef __DEBUG_FUTEX__
-        printf("wakeup futex free, fp : %x, uaddr : %x\n", fp, uaddr);
+    printfYELLOW("futex wait sleep, tid : %d, timeout : %d ns, uaddr %x\n", t->tid, timeout, uaddr);
 #endif
-        futex_free(uaddr); // !!! avoid memory leak
-    }
+    int timed_out = thread_sched();
+    release(&t->lock);
 
-    // ==========atomic==========
-    release(&p->lock);
-    return ret;
+    return (timeout != 0 && timed_out) ? -ETIMEDOUT : 0;
 }
 
-// 唤醒最多nr_wake个在uaddr1队列上等待的线程，其余的线程阻塞在uaddr2的队列
-int futex_requeue(uint64 uaddr1, int nr_wake, uint64 uaddr2, int nr_requeue) {
-    futex_wakeup(uaddr1, nr_wake);
-    // int nr_wake1 = futex_wakeup(uaddr1, nr_wake);
-    // #ifdef __DEBUG_FUTEX__
-    // printfRed("futex_requeue : has wakeup %d threads in uaddr1 : %x\n", nr_wake1, uaddr1); // debug
-    // #endif
+int futex_wakeup(uint64 uaddr, int flags, int nr_wake, uint bitset) {
+    struct futex_key key;
+    int ret;
 
-    struct proc *p = proc_current();
+    if (bitset == 0) {
+        return -EINVAL;
+    }
+    if ((ret = get_futex_key(uaddr, flags, &key)) < 0) {
+        return ret;
+    }
+    return futex_wake_key(&key, nr_wake, bitset);
+}
 
-    acquire(&p->lock);
-    // ==========atomic=========
-    struct futex *fp_old = get_futex(uaddr1, 1); // with assert
-    if (fp_old == NULL) {
-        release(&p->lock);
-        return 0;
+static uint64 futex_requeue_gen;
+
+// wake at most nr_wake waiters of uaddr1, and move at most nr_requeue of the rest to uaddr2.
+// FUTEX_CMP_REQUEUE gives cmpval, nothing is done unless *uaddr1 == *cmpval.
+// return the number of waiters woken up or requeued
+// the waiters are woken up with t->lock, which is taken before the bucket locks, so they are
+// picked under the bucket locks together with the compare, and handled after the locks are dropped.
+// a waiter which comes after the compare is not picked.
+int futex_requeue(uint64 uaddr1, int flags, int nr_wake, uint64 uaddr2, int nr_requeue, uint *cmpval) {
+    struct futex_key key1, key2;
+    struct futex_hash_bucket *hb1, *hb2;
+    struct tcb *t;
+    uint64 seq;
+    long nr_picked;
+    uint uval;
+    int ret;
+
+    if ((ret = get_futex_key(uaddr1, flags, &key1)) < 0) {
+        return ret;
+    }
+    if ((ret = get_futex_key(uaddr2, flags, &key2)) < 0) {
+        return ret;
+    }
+    hb1 = hash_futex(&key1);
+    hb2 = hash_futex(&key2);
+    seq = __sync_add_and_fetch(&futex_requeue_gen, 1);
+
+retry:
+    double_lock_hb(hb1, hb2);
+    if (cmpval != NULL) {
+        if (get_futex_value(uaddr1, &uval) < 0) {
+            double_unlock_hb(hb1, hb2);
+            if (get_futex_value(uaddr1, &uval) < 0) {
+                return -EFAULT;
+            }
+            goto retry;
+        }
+        if (uval != *cmpval) {
+            double_unlock_hb(hb1, hb2);
+            return -EAGAIN;
+        }
     }
+    nr_picked = 0;
+    list_for_each_entry(t, &hb1->waiters.list, wait_list) {
+        if (nr_picked >= (long)nr_wake + nr_requeue) {
+            break;
+        }
+        if (match_futex(&t->futex_key, &key1)) {
+            t->futex_requeue_seq = seq;
+            nr_picked++;
+        }
+    }
+    double_unlock_hb(hb1, hb2);
+
+    ret = 0;
+    while (ret < nr_wake) {
+        acquire(&hb1->waiters.lock);
+        t = futex_first_waiter(hb1, &key1, FUTEX_BITSET_MATCH_ANY, seq);
+        release(&hb1->waiters.lock);
+        if (t == NULL) {
+            break;
+        }
 
-    struct futex *fp_new = get_futex(uaddr2, 0); // without assert
-    if (fp_new == NULL) {
-        panic("not tested\n");
+        acquire(&t->lock);
+        // its timer or a signal may wake it up meanwhile
+        if (futex_still_waiting(t, hb1, &key1)) {
+            thread_wakeup(t);
+            ret++;
+        }
+        release(&t->lock);
+    }
+    if (match_futex(&key1, &key2)) {
+        return ret;
     }
-    struct tcb *t = NULL;
-    int ret = 0;
 
-    while (!Queue_isempty_atomic(&fp_old->waiting_queue) && ret < nr_requeue) {
-        t = (struct tcb *)Queue_provide_atomic(&fp_old->waiting_queue, 1); // remove it
-        if (t == NULL)
-            panic("futex requeue : no waiting queue");
-        if (t->state != TCB_SLEEPING) {
-            printf("%s\n", fp_old->waiting_queue.name);
-            printf("%s\n", t->state);
-            panic("futex requeue : this thread is not sleeping");
-        }
-        Queue_push_back_atomic(&fp_new->waiting_queue, (void *)t); // move the rest of threads to new queue
-        ret++;
+    int nr_moved = 0;
+    while (nr_moved < nr_requeue) {
+        acquire(&hb1->waiters.lock);
+        t = futex_first_waiter(hb1, &key1, FUTEX_BITSET_MATCH_ANY, seq);
+        release(&hb1->waiters.lock);
+        if (t == NULL) {
+            break;
+        }
+
+        acquire(&t->lock);
+        if (futex_still_waiting(t, hb1, &key1)) {
+            double_lock_hb(hb1, hb2);
+            t->futex_key = key2;
+            t->futex_requeue_seq = 0;
+            if (hb1 != hb2) {
+                Queue_remove(t, TCB_WAIT_QUEUE);
+                Queue_push_back(&hb2->waiters, t);
+                t->wait_chan_entry = &hb2->waiters;
+            }
+            double_unlock_hb(hb1, hb2);
 #ifdef __DEBUG_FUTEX__
-        printfGreen("tid : %d futex requeue tid : %d from uaddr1 : %x to uaddr2 : %x\n", thread_current()->tid, t->tid, uaddr1, uaddr2);
+            printfGreen("tid : %d futex requeue tid : %d from uaddr1 : %x to uaddr2 : %x\n", thread_current()->tid, t->tid, uaddr1, uaddr2);
 #endif
+            nr_moved++;
+        }
+        release(&t->lock);
     }
-    if (Queue_isempty_atomic(&fp_old->waiting_queue)) {
-#ifdef __DEBUG_FUTEX__
-        printf("requeue futex free, fp : %x, uaddr : %x\n", fp_old, uaddr1);
-#endif
-        futex_free(uaddr1); // !!! avoid memory leak
+
+    return ret + nr_moved;
+}
+
+// do op on *uaddr atomically, return the old value
+static uint futex_atomic_op(uint *uaddr, int op, uint oparg) {
+    switch (op) {
+    case FUTEX_OP_SET:
+        return __sync_lock_test_and_set(uaddr, oparg);
+    case FUTEX_OP_ADD:
+        return __sync_fetch_and_add(uaddr, oparg);
+    case FUTEX_OP_OR:
+        return __sync_fetch_and_or(uaddr, oparg);
+    case FUTEX_OP_ANDN:
+        return __sync_fetch_and_and(uaddr, ~oparg);
+    default: // FUTEX_OP_XOR
+        return __sync_fetch_and_xor(uaddr, oparg);
+    }
+}
+
+static int futex_op_cmp(int cmp, int oldval, int cmparg) {
+    switch (cmp) {
+    case FUTEX_OP_CMP_EQ:
+        return oldval == cmparg;
+    case FUTEX_OP_CMP_NE:
+        return oldval != cmparg;
+    case FUTEX_OP_CMP_LT:
+        return oldval < cmparg;
+    case FUTEX_OP_CMP_LE:
+        return oldval <= cmparg;
+    case FUTEX_OP_CMP_GT:
+        return oldval > cmparg;
+    default: // FUTEX_OP_CMP_GE
+        return oldval >= cmparg;
+    }
+}
+
+// change *uaddr2 by op, wake at most nr_wake waiters of uaddr1,
+// and at most nr_wake2 waiters of uaddr2 if the old value of *uaddr2 passes the compare of op
+int futex_wake_op(uint64 uaddr1, int flags, int nr_wake, uint64 uaddr2, int nr_wake2, uint op) {
+    struct futex_key key1, key2;
+    struct futex_hash_bucket *hb2;
+    int opcode = (op >> 28) & 0xf;
+    int cmp = (op >> 24) & 0xf;
+    int oparg = ((int)(op << 8)) >> 20; // sign extended 12 bits
+    int cmparg = ((int)(op << 20)) >> 20;
+    uint *kaddr;
+    int ret;
+
+    if (opcode & FUTEX_OP_OPARG_SHIFT) {
+        if (oparg < 0 || oparg > 31) {
+            return -EINVAL;
+        }
+        oparg = 1 << oparg;
+        opcode &= ~FUTEX_OP_OPARG_SHIFT;
+    }
+    if (opcode > FUTEX_OP_XOR || cmp > FUTEX_OP_CMP_GE) {
+        return -ENOSYS;
+    }
+    if ((ret = get_futex_key(uaddr1, flags, &key1)) < 0) {
+        return ret;
+    }
+    if ((kaddr = futex_user_writable(uaddr2)) == NULL) {
+        return -EFAULT;
+    }
+    if ((ret = get_futex_key(uaddr2, flags, &key2)) < 0) {
+        return ret;
     }
+    hb2 = hash_futex(&key2);
 
-    // ========atomic========
-    release(&p->lock);
+    // a waiter of uaddr2 checks it with hb2 locked
+    acquire(&hb2->waiters.lock);
+    int oldval = (int)futex_atomic_op(kaddr, opcode, oparg);
+    release(&hb2->waiters.lock);
 
+    ret = futex_wake_key(&key1, nr_wake, FUTEX_BITSET_MATCH_ANY);
+    if (futex_op_cmp(cmp, oldval, cmparg)) {
+        ret += futex_wake_key(&key2, nr_wake2, FUTEX_BITSET_MATCH_ANY);
+    }
     return ret;
 }
 
-// #ifdef __DEBUG_FUTEX__
-// static char *futex_cmd[] = {
-//     [FUTEX_WAIT] "futex_wait",
-//     [FUTEX_WAKE] "futex_wake",
-//     [FUTEX_REQUEUE] "futex_requeue"};
-// #endif
-
 int do_futex(uint64 uaddr, int op, uint32 val, struct timespec *ts,
              uint64 uaddr2, uint32 val2, uint32 val3) {
     int cmd = op & FUTEX_CMD_MASK;
+    int flags = 0;
+    uint64 timeout = 0;
+
+    if (!(op & FUTEX_PRIVATE_FLAG)) {
+        flags |= FLAGS_SHARED;
+    }
+    if (op & FUTEX_CLOCK_REALTIME) {
+        // CLOCK_REALTIME is CLOCK_MONOTONIC here, both are rdtime
+        flags |= FLAGS_CLOCKRT;
+    }
 
-    int ret = -1;
+    int ret = -ENOSYS;
     switch (cmd) {
     case FUTEX_WAIT:
-        ret = futex_wait(uaddr, val, ts);
+        val3 = FUTEX_BITSET_MATCH_ANY;
+        // fall through
+    case FUTEX_WAIT_BITSET:
+        if (ts != NULL) {
+            timeout = TIMESEPC2NS((*ts));
+            if (cmd == FUTEX_WAIT_BITSET) {
+                // absolute time
+                uint64 now = TIME2NS(rdtime());
+                if (timeout <= now) {
+                    return -ETIMEDOUT;
+                }
+                timeout -= now;
+            }
+            // 0 means no timeout for thread_sched
+            timeout = MAX(timeout, 1);
+        }
+        ret = futex_wait(uaddr, flags, val, timeout, val3);
         break;
 
     case FUTEX_WAKE:
-        ret = futex_wakeup(uaddr, val);
+        val3 = FUTEX_BITSET_MATCH_ANY;
+        // fall through
+    case FUTEX_WAKE_BITSET:
+        ret = futex_wakeup(uaddr, flags, val, val3);
         break;
 
     case FUTEX_REQUEUE:
-        ret = futex_requeue(uaddr, val, uaddr2, val2); // must use val2 as a limit of requeue
+        ret = futex_requeue(uaddr, flags, val, uaddr2, val2, NULL); // must use val2 as a limit of requeue
+        break;
+
+    case FUTEX_CMP_REQUEUE:
+        ret = futex_requeue(uaddr, flags, val, uaddr2, val2, &val3);
+        break;
+
+    case FUTEX_WAKE_OP:
+        ret = futex_wake_op(uaddr, flags, val, uaddr2, val2, val3);
         break;
 
     default:
-        panic("do_futex : error\n");
         break;
     }
 
-    // #ifdef __DEBUG_FUTEX__
-    //         printfMAGENTA("futex, futex_cmd : %s, retval %d\n",futex_cmd[cmd], ret);
-    // #endif
     return ret;
-}
\ No newline at end of file
+}
@@ -0,0 +1,104 @@
+#include "proc/tcb_life.h"
+#include "proc/sched.h"
+#include "atomic/cond.h"
+#include "atomic/mutex.h"
+#include "kernel/cpu.h"
+#include "debug.h"
+
+static inline struct tcb *mutex_owner(uint64 owner) {
+    return (struct tcb *)(owner & ~MUTEX_FLAG_WAITERS);
+}
+
+void mutex_init(struct mutex *lock, char *name) {
+    lock->owner = 0;
+    lock->name = name;
+    initlock(&lock->wait_lock, name);
+    cond_init(&lock->wait, name);
+}
+
+// return 1 if the mutex is acquired, 0 if it would block
+int mutex_trylock(struct mutex *lock) {
+    return __sync_bool_compare_and_swap(&lock->owner, 0, (uint64)thread_current());
+}
+
+// spin while the owner is running (on another cpu), return 1 if the mutex is acquired
+// the mutex is handed off to sleepers, so don't spin if any
+static int mutex_optimistic_spin(struct mutex *lock, struct tcb *t) {
+    for (;;) {
+        uint64 owner = lock->owner;
+        if (owner == 0) {
+            if (__sync_bool_compare_and_swap(&lock->owner, 0, (uint64)t)) {
+                return 1;
+            }
+            continue;
+        }
+        if ((owner & MUTEX_FLAG_WAITERS) || mutex_owner(owner)->state != TCB_RUNNING || need_resched()) {
+            return 0;
+        }
+    }
+}
+
+void mutex_lock(struct mutex *lock) {
+    struct tcb *t = thread_current();
+
+    ASSERT(t != NULL && mutex_owner(lock->owner) != t);
+    if (mutex_trylock(lock) || mutex_optimistic_spin(lock, t)) {
+        return;
+    }
+
+    acquire(&lock->wait_lock);
+    for (;;) {
+        uint64 owner = lock->owner;
+        if (owner == 0) {
+            // sleepers keep the flag for the next unlock
+            uint64 flag = Queue_isempty(&lock->wait.waiting_queue) ? 0 : MUTEX_FLAG_WAITERS;
+            if (__sync_bool_compare_and_swap(&lock->owner, 0, (uint64)t | flag)) {
+                break;
+            }
+            continue;
+        }
+        if (mutex_owner(owner) == t) {
+            // handed off by mutex_unlock
+            break;
+        }
+        if (!(owner & MUTEX_FLAG_WAITERS)
+            && !__sync_bool_compare_and_swap(&lock->owner, owner, owner | MUTEX_FLAG_WAITERS)) {
+            continue;
+        }
+        // woken up by a handoff. a killed waiter keeps sleeping, the mutex
+        // may have been handed to it already, it dies at the next safe point
+        cond_wait_uninterruptible(&lock->wait, &lock->wait_lock);
+    }
+    release(&lock->wait_lock);
+}
+
+void mutex_unlock(struct mutex *lock) {
+    struct tcb *t = thread_current();
+
+    ASSERT(mutex_owner(lock->owner) == t);
+    if (__sync_bool_compare_and_swap(&lock->owner, (uint64)t, 0)) {
+        return;
+    }
+
+    // somebody sleeps, hand the mutex off to the first one
+    acquire(&lock->wait_lock);
+    Queue_t *q = &lock->wait.waiting_queue;
+    __sync_synchronize();
+    if (Queue_isempty(q)) {
+        lock->owner = 0;
+    } else {
+        struct tcb *next = (struct tcb *)queue_first_node(q);
+        uint64 flag = (next->wait_list.next == &q->list) ? 0 : MUTEX_FLAG_WAITERS;
+        lock->owner = (uint64)next | flag;
+        cond_signal(&lock->wait);
+    }
+    release(&lock->wait_lock);
+}
+
+int mutex_is_locked(struct mutex *lock) {
+    return lock->owner != 0;
+}
+
+int mutex_holding(struct mutex *lock) {
+    return mutex_owner(lock->owner) == thread_current();
+}
@@ -0,0 +1,88 @@
+#include "common.h"
+#include "param.h"
+#include "atomic/spinlock.h"
+#include "atomic/rcu.h"
+#include "kernel/cpu.h"
+
+// callbacks queued by call_rcu wait in next_list until the current grace period (wait_list) ends,
+// then they form the next one. a grace period ends after every cpu has counted a quiescent
+// state since it began, or is idle. it is checked on clock interrupts, so with all cpus idle
+// the callbacks wait for the next tick.
+static struct {
+    struct spinlock lock;
+    struct rcu_head *next_list; // waiting for a grace period to begin
+    struct rcu_head *wait_list; // waiting for the current grace period
+    uint64 snap[NCPU];          // rcu_qs when the current grace period began
+    uint64 gp_seq;              // number of finished grace periods
+} rcu_state = {.lock = INIT_SPINLOCK(rcu_state)};
+
+// written by its own cpu only
+static volatile uint64 rcu_qs[NCPU]; // quiescent states passed by each cpu
+static volatile int rcu_idle[NCPU];  // the cpu idles in wfi, it is quiescent
+
+// holding rcu_state.lock
+static int rcu_gp_passed(void) {
+    for (int i = 0; i < NCPU; i++) {
+        if (rcu_qs[i] == rcu_state.snap[i] && !rcu_idle[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// func(head) is called on a clock interrupt after all current readers have left
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head)) {
+    head->func = func;
+    acquire(&rcu_state.lock);
+    head->next = rcu_state.next_list;
+    rcu_state.next_list = head;
+    release(&rcu_state.lock);
+}
+
+// called on every tick with interrupt off, it is a quiescent state of this cpu
+void rcu_check_callbacks(void) {
+    struct rcu_head *done = NULL;
+
+    rcu_qs[cpuid()]++;
+    // racy, a callback missed here is seen on the next tick
+    if (rcu_state.wait_list == NULL && rcu_state.next_list == NULL) {
+        return;
+    }
+
+    acquire(&rcu_state.lock);
+    if (rcu_state.wait_list != NULL && rcu_gp_passed()) {
+        done = rcu_state.wait_list;
+        rcu_state.wait_list = NULL;
+        rcu_state.gp_seq++;
+    }
+    if (rcu_state.wait_list == NULL && rcu_state.next_list != NULL) {
+        rcu_state.wait_list = rcu_state.next_list;
+        rcu_state.next_list = NULL;
+        for (int i = 0; i < NCPU; i++) {
+            rcu_state.snap[i] = rcu_qs[i];
+        }
+    }
+    release(&rcu_state.lock);
+
+    while (done != NULL) {
+        struct rcu_head *next = done->next;
+        done->func(done);
+        done = next;
+    }
+}
+
+// interrupt off, before swtch
+void rcu_note_context_switch(void) {
+    rcu_qs[cpuid()]++;
+}
+
+// interrupt off, around wfi
+void rcu_idle_enter(void) {
+    rcu_idle[cpuid()] = 1;
+}
+
+void rcu_idle_exit(void) {
+    int cpu = cpuid();
+    rcu_qs[cpu]++;
+    rcu_idle[cpu] = 0;
+}
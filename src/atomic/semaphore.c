@@ -21,6 +21,31 @@ void sema_wait(sem *S) {
     release(&S->sem_lock);
 }
 
+// a killed waiter keeps waiting, for one which must not exit before sema_signal
+void sema_wait_uninterruptible(sem *S) {
+    acquire(&S->sem_lock);
+    S->value--;
+    if (S->value < 0) {
+        do {
+            cond_wait_uninterruptible(&S->sem_cond, &S->sem_lock);
+        } while (S->wakeup == 0);
+        S->wakeup--;
+    }
+    release(&S->sem_lock);
+}
+
+// return 1 if S is acquired, 0 if it would block
+int sema_trywait(sem *S) {
+    int ret = 0;
+    acquire(&S->sem_lock);
+    if (S->value > 0) {
+        S->value--;
+        ret = 1;
+    }
+    release(&S->sem_lock);
+    return ret;
+}
+
 void sema_signal(sem *S) {
     acquire(&S->sem_lock);
     S->value++;
@@ -35,18 +35,93 @@ char *blacklist[DEBUG_LOCK_BLACKLIST] = {
     "proc_0",
     "proc_1",
     // "proc_2",
-    "timer_entry",
+    "timer_base",
     "cons",
 };
 
 int all = 1;
 
+#ifdef __LOCKTRACE__
+#define LOCK_STAT_MAX 256
+#define LOCK_NAME_MAX 32
+// by name, the last one counts the locks which don't fit
+static struct lock_stat lock_stats[LOCK_STAT_MAX];
+static int nr_lock_stats;
+static volatile uint lock_stats_guard; // a bare test-and-set lock, the table is used by acquire
+
+static struct lock_stat *lock_stat_of(char *name) {
+    struct lock_stat *st = NULL;
+
+    push_off();
+    while (__sync_lock_test_and_set(&lock_stats_guard, 1) != 0)
+        ;
+    for (int i = 0; i < nr_lock_stats; i++) {
+        if (strncmp(lock_stats[i].name, name, LOCK_NAME_MAX) == 0) {
+            st = &lock_stats[i];
+            break;
+        }
+    }
+    if (st == NULL && nr_lock_stats < LOCK_STAT_MAX - 1) {
+        st = &lock_stats[nr_lock_stats++];
+        st->name = name;
+    } else if (st == NULL) {
+        st = &lock_stats[LOCK_STAT_MAX - 1];
+        st->name = "others";
+        nr_lock_stats = LOCK_STAT_MAX;
+    }
+    __sync_lock_release(&lock_stats_guard);
+    pop_off();
+    return st;
+}
+
+// start : rdtime when it began to wait, 0 if the lock was free
+static void lock_stat_account(struct spinlock *lk, uint64 start) {
+    if (lk->stat == NULL) {
+        if (lk->name == NULL) {
+            return;
+        }
+        lk->stat = lock_stat_of(lk->name);
+    }
+    struct lock_stat *st = lk->stat;
+    __sync_fetch_and_add(&st->nr_acquire, 1);
+    if (start != 0) {
+        __sync_fetch_and_add(&st->nr_contended, 1);
+        __sync_fetch_and_add(&st->spin_time, rdtime() - start);
+    }
+}
+
+// debug, locks by time spent waiting for them (racy, but it is enough)
+void lock_stat_print(void) {
+    struct lock_stat *sorted[LOCK_STAT_MAX];
+    int n = nr_lock_stats;
+
+    for (int i = 0; i < n; i++) {
+        struct lock_stat *st = &lock_stats[i];
+        int j = i;
+        for (; j > 0 && sorted[j - 1]->spin_time < st->spin_time; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = st;
+    }
+    printf("%-24s %12s %12s %16s\n", "lock", "acquire", "contended", "spin time");
+    for (int i = 0; i < n; i++) {
+        if (sorted[i]->nr_acquire == 0) {
+            continue;
+        }
+        printf("%-24s %12ld %12ld %16ld\n", sorted[i]->name, sorted[i]->nr_acquire,
+               sorted[i]->nr_contended, sorted[i]->spin_time);
+    }
+}
+#endif
+
 void initlock(struct spinlock *lk, char *name) {
     lk->name = name;
-    lk->locked = 0;
+    lk->next = 0;
+    lk->owner = 0;
     lk->cpu = 0;
 #ifdef __LOCKTRACE__
     lk->debug = 0;
+    lk->stat = NULL;
     if (name == NULL) {
         return;
     }
@@ -122,11 +197,13 @@ void _acquire(struct spinlock *lk) {
         panic("acquire");
     }
 
-    // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-    //   a5 = 1
-    //   s1 = &lk->locked
-    //   amoswap.w.aq a5, a5, (s1)
-    while (__sync_lock_test_and_set(&lk->locked, 1) != 0)
+    // take a ticket, on RISC-V it is an amoadd.w
+    // then wait for our turn, waiters only read owner, which is written once per release
+    uint ticket = __sync_fetch_and_add(&lk->next, 1);
+#ifdef __LOCKTRACE__
+    uint64 start = (lk->owner != ticket) ? rdtime() : 0;
+#endif
+    while (lk->owner != ticket)
         ;
 
     // Tell the C compiler and the processor to not move loads or stores
@@ -135,6 +212,9 @@ void _acquire(struct spinlock *lk) {
     // On RISC-V, this emits a fence instruction.
     __sync_synchronize();
 
+#ifdef __LOCKTRACE__
+    lock_stat_account(lk, start);
+#endif
     // Record info about lock acquisition for holding() and debugging.
     lk->cpu = t_mycpu();
 }
@@ -183,14 +263,9 @@ void _release(struct spinlock *lk) {
     // On RISC-V, this emits a fence instruction.
     __sync_synchronize();
 
-    // Release the lock, equivalent to lk->locked = 0.
-    // This code doesn't use a C assignment, since the C standard
-    // implies that an assignment might be implemented with
-    // multiple store instructions.
-    // On RISC-V, sync_lock_release turns into an atomic swap:
-    //   s1 = &lk->locked
-    //   amoswap.w zero, zero, (s1)
-    __sync_lock_release(&lk->locked);
+    // Release the lock, serve the next ticket.
+    // only the holder writes owner, an aligned word store is atomic.
+    lk->owner = lk->owner + 1;
 
     pop_off();
 }
@@ -205,7 +280,7 @@ int holding(struct spinlock *lk) {
 
     // printf("%d, %x\n", lk->locked, lk->cpu);
 
-    r = (lk->locked && lk->cpu == t_mycpu());
+    r = (spin_is_locked(lk) && lk->cpu == t_mycpu());
     return r;
 }
 
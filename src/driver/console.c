@@ -77,19 +77,23 @@ struct console {
 // user write()s to the console go here.
 //
 int consolewrite(int user_src, uint64 src, int n) {
-    int i;
-    acquire(&cons.lock);
-    Info("lock=%d\n", cons.lock.locked);
-    for (i = 0; i < n; i++) {
-        char c;
-        if (either_copyin(&c, user_src, src + i, 1) == -1)
+    int i, j, m;
+    char buf[INPUT_BUF_SIZE];
+
+    // copy outside cons.lock, a fault on a lazily mapped page may sleep
+    for (i = 0; i < n; i += m) {
+        m = MIN(n - i, INPUT_BUF_SIZE);
+        if (either_copyin(buf, user_src, src + i, m) == -1)
             break;
-        // consputc(c);
-        uartputc(c);
-        // printf("%c", 'a');
+        acquire(&cons.lock);
+        Info("lock=%d\n", spin_is_locked(&cons.lock));
+        for (j = 0; j < m; j++) {
+            // consputc(c);
+            uartputc(buf[j]);
+        }
+        release(&cons.lock);
+        Info("lock=%d\n", spin_is_locked(&cons.lock));
     }
-    release(&cons.lock);
-    Info("lock=%d\n", cons.lock.locked);
     return i;
 }
 
@@ -102,9 +106,14 @@ int consolewrite(int user_src, uint64 src, int n) {
 int consoleread(int user_dst, uint64 dst, int n) {
     uint target;
     char c;
+    char buf[INPUT_BUF_SIZE];
+    int cnt = 0;
 
     uint lflag = term.c_lflag;
 
+    // a line never exceeds the input buffer, the bytes are copied out after cons.lock
+    // is released since a fault on a lazily mapped page may sleep
+    n = MIN(n, INPUT_BUF_SIZE);
     target = n;
     acquire(&cons.lock);
     while (n > 0) {
@@ -123,9 +132,7 @@ int consoleread(int user_dst, uint64 dst, int n) {
         c = cons.buf[cons.r++ % INPUT_BUF_SIZE];
 
         if ((lflag & ICANON) == 0) {
-            if (either_copyout(user_dst, dst, &c, 1) == -1)
-                break;
-            dst++;
+            buf[cnt++] = c;
             --n;
             continue;
         }
@@ -141,10 +148,7 @@ int consoleread(int user_dst, uint64 dst, int n) {
 
         // copy the input byte to the user-space buffer.
 
-        if (either_copyout(user_dst, dst, &c, 1) == -1)
-            break;
-
-        dst++;
+        buf[cnt++] = c;
         --n;
 
         if (c == '\n') {
@@ -155,6 +159,8 @@ int consoleread(int user_dst, uint64 dst, int n) {
     }
     release(&cons.lock);
 
+    if (cnt > 0 && either_copyout(user_dst, dst, buf, cnt) == -1)
+        return -1;
     return target - n;
 }
 
@@ -182,6 +188,11 @@ void consoleintr(char c) {
     case C('T'): // Print thread list.
         proc_thread_print();
         break;
+#ifdef __LOCKTRACE__
+    case C('L'): // Print lock statistics.
+        lock_stat_print();
+        break;
+#endif
     case C('U'): // Kill line.
         while (cons.e != cons.w && cons.buf[(cons.e - 1) % INPUT_BUF_SIZE] != '\n') {
             cons.e--;
@@ -1,72 +1,237 @@
 #include "common.h"
 #include "param.h"
 #include "atomic/spinlock.h"
+#include "atomic/cond.h"
 #include "lib/riscv.h"
 #include "fs/bio.h"
 #include "lib/list.h"
 #include "memory/allocator.h"
+#include "memory/buddy.h"
+#include "memory/slab.h"
 #include "driver/disk.h"
+#include "proc/pdflush.h"
 #include "debug.h"
 
-// int hit;
-// int total; // debug
+#define BWB_BATCH 32 // max number of buffers written back in one bio
 
-struct {
+// buffer cache is hashed by (dev, blockno), every bucket has its own lock,
+// so lookups of different blocks don't serialize on one lock.
+struct bcache_bucket {
     struct spinlock lock;
-    struct buffer_head buf[NBUF];
     list_head_t head;
+
+    // statistics, protected by lock
+    uint64 lookups;   // number of bget
+    uint64 hits;      // block found in cache
+    uint64 waits;     // block found, but held by others
+    uint64 contended; // bucket lock is held by others
+    uint64 releases;  // number of brelse
+} __attribute__((aligned(64)));
+
+struct {
+    // evict_lock serializes replacement, lock order : evict_lock -> bucket lock
+    struct spinlock evict_lock;
+    struct buffer_head *buf;
+    int nbuf;
+    int clock_hand; // clock replacement, protected by evict_lock
+    uint64 evicts;  // protected by evict_lock
+
+    struct bcache_bucket *buckets;
+    int nbucket; // power of 2
+
+    // delayed write : dirty buffers stay in cache until they are written
+    // back by pdflush, sync/fsync, shutdown or memory pressure of bcache
+    struct spinlock dirty_lock;
+    list_head_t dirty;
+    int ndirty;
+    int nflushing;  // taken off dirty by bcache_flush, not written back yet
+    struct cond flush_done; // a batch is written back, with dirty_lock
+    int dirty_bg;   // wake up pdflush when ndirty reaches it
+    int dirty_sync; // brelse writes back by itself when ndirty reaches it
+    int wb_pending; // a pdflush work has been queued
+    uint64 flushed; // number of buffers written back
+    uint64 batches; // number of write back bios
 } bcache;
 
+// bio_vec with room for BIO_MAX_SEGS segments, see bio_vec_alloc
+static struct kmem_cache *bio_vec_cachep;
+
+static inline struct bcache_bucket *bucket_of(uint dev, uint blockno) {
+    return &bcache.buckets[(blockno ^ (dev << 16)) & (bcache.nbucket - 1)];
+}
+
+static inline void bucket_lock(struct bcache_bucket *bkt) {
+    int busy = spin_is_locked(&bkt->lock);
+    acquire(&bkt->lock);
+    bkt->contended += busy;
+}
+
+// must hold bkt->lock
+static struct buffer_head *bucket_find(struct bcache_bucket *bkt, uint dev, uint blockno) {
+    struct buffer_head *b;
+    list_for_each_entry(b, &bkt->head, hash) {
+        if (b->dev == dev && b->blockno == blockno) {
+            bkt->hits++;
+            if (atomic_inc_return(&b->refcnt) > 0) {
+                bkt->waits++;
+            }
+            b->referenced = 1;
+            return b;
+        }
+    }
+    return NULL;
+}
+
 void binit(void) {
     struct buffer_head *b;
 
-    initlock(&bcache.lock, "bcache");
+    if ((bio_vec_cachep = kmem_cache_create("bio_vec", sizeof(struct bio_vec) + BIO_MAX_SEGS * sizeof(struct bio_seg))) == NULL) {
+        panic("binit : no free space for bio_vec cache\n");
+    }
+
+    initlock(&bcache.evict_lock, "bcache");
+    initlock(&bcache.dirty_lock, "bcache_dirty");
+    INIT_LIST_HEAD(&bcache.dirty);
+
+    // size the cache from free memory
+    int nbuf = (get_free_mem() >> BCACHE_MEM_SHIFT) / sizeof(struct buffer_head);
+    nbuf = MAX(nbuf, NBUF_MIN);
+    nbuf = MIN(nbuf, NBUF_MAX);
+    // about 4 buffers per bucket
+    int nbucket = 1;
+    while (nbucket * 4 < nbuf)
+        nbucket <<= 1;
 
-    INIT_LIST_HEAD(&bcache.head);
-    for (b = bcache.buf; b < bcache.buf + NBUF; b++) {
-        sema_init(&b->sem_lock, 1, "buffer");
-        sema_init(&b->sem_disk_done, 0, "buffer_disk_done");
-        list_add(&b->lru, &bcache.head);
+    if ((bcache.buf = kzalloc(nbuf * sizeof(struct buffer_head))) == NULL) {
+        panic("binit : no free space for buffer\n");
+    }
+    if ((bcache.buckets = kzalloc(nbucket * sizeof(struct bcache_bucket))) == NULL) {
+        panic("binit : no free space for bucket\n");
+    }
+    bcache.nbuf = nbuf;
+    bcache.nbucket = nbucket;
+    bcache.clock_hand = 0;
+    bcache.ndirty = 0;
+    bcache.nflushing = 0;
+    cond_init(&bcache.flush_done, "bcache_flush_done");
+    bcache.dirty_bg = nbuf / 4;
+    bcache.dirty_sync = nbuf / 2;
+    bcache.wb_pending = 0;
+
+    for (int i = 0; i < nbucket; i++) {
+        initlock(&bcache.buckets[i].lock, "bcache_bucket");
+        INIT_LIST_HEAD(&bcache.buckets[i].head);
+    }
+    // all buffers are unhashed at first
+    for (b = bcache.buf; b < bcache.buf + nbuf; b++) {
+        mutex_init(&b->lock, "buffer");
+        INIT_LIST_HEAD(&b->hash);
+        INIT_LIST_HEAD(&b->dirty_list);
     }
     Info("========= Information of block buffer cache ==========\n");
-    Info("number of block buffer cache : %d\n", NBUF);
+    Info("number of block buffer cache : %d\n", nbuf);
+    Info("number of block buffer bucket : %d\n", nbucket);
     Info("block buffer cache init [ok]\n");
 }
 
+// find a victim using clock replacement
+// dirty buffers are pinned by dirty list, so they are never chosen
+// must hold bcache.evict_lock
+static struct buffer_head *bcache_evict(void) {
+    struct buffer_head *b;
+    struct bcache_bucket *bkt;
+
+    // two rounds : the first round may only clear referenced bits
+    for (int scan = 0; scan < 2 * bcache.nbuf; scan++) {
+        b = &bcache.buf[bcache.clock_hand];
+        bcache.clock_hand = (bcache.clock_hand + 1) % bcache.nbuf;
+
+        if (atomic_read(&b->refcnt) != 0) {
+            continue;
+        }
+        if (b->referenced) {
+            b->referenced = 0;
+            continue;
+        }
+        // never used
+        if (list_empty(&b->hash)) {
+            return b;
+        }
+        // dev and blockno only change under evict_lock, so bkt is stable
+        bkt = bucket_of(b->dev, b->blockno);
+        acquire(&bkt->lock);
+        if (atomic_read(&b->refcnt) == 0) {
+            list_del_reinit(&b->hash);
+            release(&bkt->lock);
+            return b;
+        }
+        release(&bkt->lock);
+    }
+    return NULL;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
 static struct buffer_head *bget(uint dev, uint blockno) {
     struct buffer_head *b;
-
-    acquire(&bcache.lock);
-    // total++;// debug
+    struct bcache_bucket *bkt = bucket_of(dev, blockno);
 
     // Is the block already cached?
-    list_for_each_entry(b, &bcache.head, lru) {
-        if (b->dev == dev && b->blockno == blockno) {
-            atomic_inc_return(&b->refcnt);
-            release(&bcache.lock);
-            sema_wait(&b->sem_lock);
-            // printfRed("hit : %d/%d\n",++hit, total);// debug
-            return b;
-        }
+    bucket_lock(bkt);
+    bkt->lookups++;
+    b = bucket_find(bkt, dev, blockno);
+    release(&bkt->lock);
+    if (b != NULL) {
+        mutex_lock(&b->lock);
+        return b;
     }
 
     // Not cached.
-    // Recycle the least recently used (LRU) unused buffer.
-    list_for_each_entry_reverse(b, &bcache.head, lru) {
-        if (atomic_read(&b->refcnt) == 0) {
-            b->dev = dev;
-            b->blockno = blockno;
-            b->valid = 0;
-            atomic_set(&b->refcnt, 1);
-            release(&bcache.lock);
-            sema_wait(&b->sem_lock);
-            return b;
+retry:
+    acquire(&bcache.evict_lock);
+    // others may cache it while we don't hold the bucket lock
+    bucket_lock(bkt);
+    b = bucket_find(bkt, dev, blockno);
+    release(&bkt->lock);
+    if (b != NULL) {
+        release(&bcache.evict_lock);
+        mutex_lock(&b->lock);
+        return b;
+    }
+
+    // Recycle a least recently used buffer.
+    if ((b = bcache_evict()) == NULL) {
+        release(&bcache.evict_lock);
+        // all buffers are busy or dirty, clean some of them
+        acquire(&bcache.dirty_lock);
+        if (bcache.ndirty == 0) {
+            if (bcache.nflushing == 0) {
+                panic("bget: no buffers");
+            }
+            // others are writing them back
+            cond_wait_uninterruptible(&bcache.flush_done, &bcache.dirty_lock);
+            release(&bcache.dirty_lock);
+            goto retry;
         }
+        release(&bcache.dirty_lock);
+        bcache_flush();
+        goto retry;
     }
-    panic("bget: no buffers");
+    bcache.evicts++;
+    b->dev = dev;
+    b->blockno = blockno;
+    b->valid = 0;
+    b->referenced = 1;
+    atomic_set(&b->refcnt, 1);
+
+    acquire(&bkt->lock);
+    list_add(&b->hash, &bkt->head);
+    release(&bkt->lock);
+
+    release(&bcache.evict_lock);
+    mutex_lock(&b->lock);
+    return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -83,7 +248,8 @@ struct buffer_head *bread(uint dev, uint blockno) {
     return b;
 }
 
-// Write b's contents to disk.  Must be locked.
+// Mark b's contents to be written to disk.  Must be locked.
+// the write is delayed, see brelse
 void bwrite(struct buffer_head *b) {
     b->dirty = 1;
 }
@@ -96,23 +262,176 @@ void bwback(struct buffer_head *b) {
     }
 }
 
+static void bcache_put(struct buffer_head *b) {
+    struct bcache_bucket *bkt = bucket_of(b->dev, b->blockno);
+    bucket_lock(bkt);
+    bkt->releases++;
+    atomic_dec_return(&b->refcnt);
+    release(&bkt->lock);
+}
+
+static void bcache_writeback_work(uint64 arg) {
+    bcache_flush();
+    bcache.wb_pending = 0;
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// a dirty buffer is moved to the dirty list, and the list takes over our reference
 void brelse(struct buffer_head *b) {
+    int queued = 0;
+    int ndirty = 0;
     if (b->dirty == 1) {
-        disk_rw_bio(b, DISK_WRITE);
+        acquire(&bcache.dirty_lock);
+        if (list_empty(&b->dirty_list)) {
+            list_add_tail(&b->dirty_list, &bcache.dirty);
+            bcache.ndirty++;
+            queued = 1;
+        }
+        ndirty = bcache.ndirty;
+        release(&bcache.dirty_lock);
+    }
+    mutex_unlock(&b->lock);
+
+    if (!queued) {
+        bcache_put(b);
+    }
+
+    if (ndirty >= bcache.dirty_sync) {
+        // too many dirty buffers, throttle the writer
+        bcache_flush();
+    } else if (ndirty >= bcache.dirty_bg && __sync_lock_test_and_set(&bcache.wb_pending, 1) == 0) {
+        if (pdflush_operation(bcache_writeback_work, 0) < 0) {
+            // no idle pdflush, the writer will be throttled later
+            bcache.wb_pending = 0;
+        }
+    }
+}
+
+static void bcache_sort(struct buffer_head **bufs, int n) {
+    // insertion sort, n is small
+    for (int i = 1; i < n; i++) {
+        struct buffer_head *b = bufs[i];
+        int j = i - 1;
+        while (j >= 0 && (bufs[j]->dev > b->dev || (bufs[j]->dev == b->dev && bufs[j]->blockno > b->blockno))) {
+            bufs[j + 1] = bufs[j];
+            j--;
+        }
+        bufs[j + 1] = b;
+    }
+}
+
+// write back a batch of buffers (sorted by blockno)
+// buffers are locked in order, so concurrent flushers can't deadlock
+// adjacent blocks are merged into one bio_vec, one segment per buffer
+static void bcache_flush_batch(struct buffer_head **bufs, int n) {
+    struct bio bio_new;
+    struct bio_vec vecs[BWB_BATCH];
+    struct bio_seg segs[BWB_BATCH];
+    struct bio_vec *vec_p = NULL;
+    int nvec = 0;
+    int nblock = 0;
+
+    bcache_sort(bufs, n);
+    INIT_LIST_HEAD(&bio_new.list_entry);
+    bio_new.bi_rw = DISK_WRITE;
+    bio_new.bi_bdev = bufs[0]->dev;
+    for (int i = 0; i < n; i++) {
+        struct buffer_head *b = bufs[i];
+        mutex_lock(&b->lock);
+        if (b->dirty == 0) {
+            // written back by others
+            continue;
+        }
+        nblock++;
+        if (vec_p != NULL && vec_p->blockno_start + vec_p->block_len == b->blockno
+            && bio_vec_add_seg(vec_p, b->data, BSIZE) == 0) {
+            vec_p->block_len++;
+            continue;
+        }
+        // a bio_vec starting at bufs[i] uses at most segs[i..n)
+        vec_p = &vecs[nvec++];
+        bio_vec_init(vec_p, &segs[i], MIN(BIO_MAX_SEGS, n - i));
+        vec_p->blockno_start = b->blockno;
+        vec_p->block_len = 1;
+        vec_p->disk = b->disk;
+        bio_vec_add_seg(vec_p, b->data, BSIZE);
+        list_add_tail(&vec_p->list, &bio_new.list_entry);
+    }
+
+    if (nvec > 0) {
+        submit_bio(&bio_new, 0);
+    }
+
+    for (int i = 0; i < n; i++) {
+        struct buffer_head *b = bufs[i];
         b->dirty = 0;
+        mutex_unlock(&b->lock);
+        bcache_put(b);
     }
-    sema_signal(&b->sem_lock);
 
-    acquire(&bcache.lock);
-    atomic_dec_return(&b->refcnt);
-    if (atomic_read(&b->refcnt) == 0) {
-        list_del(&b->lru);
-        list_add(&b->lru, &bcache.head);
+    acquire(&bcache.dirty_lock);
+    bcache.nflushing -= n;
+    bcache.flushed += nblock;
+    bcache.batches += (nvec > 0);
+    cond_broadcast(&bcache.flush_done);
+    release(&bcache.dirty_lock);
+}
+
+// write back all dirty buffers
+void bcache_flush(void) {
+    struct buffer_head *bufs[BWB_BATCH];
+    struct buffer_head *b, *b_tmp;
+
+    for (;;) {
+        int n = 0;
+        acquire(&bcache.dirty_lock);
+        list_for_each_entry_safe(b, b_tmp, &bcache.dirty, dirty_list) {
+            list_del_reinit(&b->dirty_list);
+            bcache.ndirty--;
+            bufs[n++] = b;
+            if (n == BWB_BATCH)
+                break;
+        }
+        bcache.nflushing += n;
+        release(&bcache.dirty_lock);
+
+        if (n == 0)
+            break;
+        bcache_flush_batch(bufs, n);
     }
+}
 
-    release(&bcache.lock);
+// debug, statistics of buffer cache (racy, but it is enough)
+void bcache_stat_print(void) {
+    uint64 lookups = 0, hits = 0, waits = 0, contended = 0, releases = 0;
+    int used = 0, max_chain = 0;
+    for (int i = 0; i < bcache.nbucket; i++) {
+        struct bcache_bucket *bkt = &bcache.buckets[i];
+        struct buffer_head *b;
+        int chain = 0;
+        acquire(&bkt->lock);
+        lookups += bkt->lookups;
+        hits += bkt->hits;
+        waits += bkt->waits;
+        contended += bkt->contended;
+        releases += bkt->releases;
+        list_for_each_entry(b, &bkt->head, hash) {
+            chain++;
+        }
+        release(&bkt->lock);
+        used += chain;
+        max_chain = MAX(max_chain, chain);
+    }
+    printf("bcache : %d buffers, %d buckets, %d in use, max chain %d\n", bcache.nbuf, bcache.nbucket, used, max_chain);
+    printf("bread : %ld lookups, %ld hits (%ld%%), %ld evicts\n", lookups, hits, lookups ? hits * 100 / lookups : 0, bcache.evicts);
+    printf("brelse : %ld releases\n", releases);
+    printf("contention : %ld bucket lock, %ld buffer wait\n", contended, waits);
+    printf("writeback : %d dirty, %ld written, %ld bios\n", bcache.ndirty, bcache.flushed, bcache.batches);
+}
+
+uint64 sys_print_bcache(void) {
+    bcache_stat_print();
+    return 0;
 }
 
 // rw : DISK_READ or DISK_WRITE
@@ -132,30 +451,117 @@ void init_bio(struct bio *bio_p, struct bio_vec *vec_p, struct buffer_head *b, i
     bio_p->bi_bdev = b->dev;
 
     // bio_vec
-    sema_init(&vec_p->sem_disk_done, 0, "bio_disk_done"); // vec_p ！！！
-    INIT_LIST_HEAD(&vec_p->list);
+    bio_vec_init(vec_p, &vec_p->seg_inline, 1);
     vec_p->blockno_start = b->blockno;
     vec_p->block_len = 1;
-    vec_p->data = b->data;
     vec_p->disk = b->disk;
+    bio_vec_add_seg(vec_p, b->data, BSIZE);
 
     // join bio_vec to bio (don't forget it)
     list_add_tail(&vec_p->list, &bio_p->list_entry);
     // bug like this : list_add_tail(&bio_p->list_entr, &vec_p->list);
 }
 
-// read or write
-// free bio_vec, if necessary
-void submit_bio(struct bio *bio, int free) {
+// segs : room for max_seg segments, owned by the caller
+void bio_vec_init(struct bio_vec *vec, struct bio_seg *segs, int max_seg) {
+    INIT_LIST_HEAD(&vec->list);
+    vec->blockno_start = 0;
+    vec->block_len = 0;
+    vec->nseg = 0;
+    vec->max_seg = max_seg;
+    vec->segs = segs;
+    vec->disk = 0;
+    vec->bio = NULL;
+    vec->done_next = NULL;
+}
+
+// bio_vec with room for BIO_MAX_SEGS segments, freed by bio_free_vecs
+struct bio_vec *bio_vec_alloc(void) {
+    struct bio_vec *vec;
+    if ((vec = kmem_cache_zalloc(bio_vec_cachep)) == NULL) {
+        panic("bio_vec_alloc : no free memory\n");
+    }
+    bio_vec_init(vec, (struct bio_seg *)(vec + 1), BIO_MAX_SEGS);
+    return vec;
+}
+
+// append [data, data + len) to the segments of vec
+// it is merged into the last segment if the memory is contiguous
+// return -1 if there is no room for a new segment
+int bio_vec_add_seg(struct bio_vec *vec, void *data, uint len) {
+    uint64 addr = (uint64)data;
+    if (vec->nseg > 0) {
+        struct bio_seg *last = &vec->segs[vec->nseg - 1];
+        if (bio_seg_data(last) + last->len == (uchar *)data) {
+            last->len += len;
+            return 0;
+        }
+    }
+    if (vec->nseg == vec->max_seg) {
+        return -1;
+    }
+    struct bio_seg *seg = &vec->segs[vec->nseg++];
+    seg->page = pa_to_page(PGROUNDDOWN(addr));
+    seg->offset = PGMASK(addr);
+    seg->len = len;
+    return 0;
+}
+
+uchar *bio_seg_data(struct bio_seg *seg) {
+    return (uchar *)(page_to_pa(seg->page) + seg->offset);
+}
+
+// called by disk driver when a bio_vec is done (maybe in interrupt)
+void bio_vec_endio(struct bio_vec *vec) {
+    struct bio *bio = vec->bio;
+    // atomic_dec_return returns the old value
+    if (atomic_dec_return(&bio->bi_remaining) == 1) {
+        bio->bi_end_io(bio);
+    }
+}
+
+// free bio_vec allocated by bio_vec_alloc
+void bio_free_vecs(struct bio *bio) {
     struct bio_vec *vec_cur = NULL;
     struct bio_vec *vec_tmp = NULL;
     list_for_each_entry_safe(vec_cur, vec_tmp, &bio->list_entry, list) {
-        // virtio_disk_rw((void *)vec_cur, bio->bi_rw, BLOCK_SEL);
-        disk_rw((void *)vec_cur, bio->bi_rw, BLOCK_SEL);
-        if (free) {
-            kfree(vec_cur);
-            // printfGreen("submit_bio, mm ++: %d pages\n", get_free_mem() / PGSIZE);
-        }
+        list_del(&vec_cur->list);
+        kmem_cache_free(bio_vec_cachep, vec_cur);
+    }
+}
+
+// read or write, without waiting
+// all bio_vecs are queued to the disk at once, end_io is called when all of them are done.
+// end_io may be called in interrupt, it must not sleep.
+void submit_bio_async(struct bio *bio, bio_end_io_t end_io, void *private) {
+    struct bio_vec *vec_cur = NULL;
+    int n = 0;
+    list_for_each_entry(vec_cur, &bio->list_entry, list) {
+        vec_cur->bio = bio;
+        n++;
+    }
+    bio->bi_end_io = end_io;
+    bio->bi_private = private;
+    atomic_set(&bio->bi_remaining, n);
+    if (n == 0) {
+        end_io(bio);
+        return;
+    }
+    disk_submit_bio(bio);
+}
+
+static void submit_bio_end_io(struct bio *bio) {
+    sema_signal(&bio->bi_done);
+}
+
+// read or write, and wait for it
+// free bio_vec, if necessary
+void submit_bio(struct bio *bio, int free) {
+    sema_init(&bio->bi_done, 0, "bio_done");
+    submit_bio_async(bio, submit_bio_end_io, NULL);
+    sema_wait(&bio->bi_done);
+    if (free) {
+        bio_free_vecs(bio);
     }
 }
 
@@ -165,5 +571,8 @@ void bio_print(struct bio *bio) {
     list_for_each_entry(vec_cur, &bio->list_entry, list) {
         printf("start : %d, end : %d, cnt : %d\n", vec_cur->blockno_start, vec_cur->blockno_start + vec_cur->block_len - 1, vec_cur->block_len);
         printf("address : %x\n", DEBUG_SECTOR(vec_cur->blockno_start));
+        for (int i = 0; i < vec_cur->nseg; i++) {
+            printf("seg %d : %x, len : %d\n", i, bio_seg_data(&vec_cur->segs[i]), vec_cur->segs[i].len);
+        }
     }
 }
\ No newline at end of file
@@ -18,6 +18,8 @@
 #include "memory/filemap.h"
 #include "lib/radix-tree.h"
 #include "memory/writeback.h"
+#include "memory/vmscan.h"
+#include "memory/slab.h"
 #include "lib/list.h"
 #include "atomic/semaphore.h"
 
@@ -38,16 +40,22 @@ struct inode_table_t {
     struct inode inode_entry[NINODE]; // array
 } inode_table;
 
+// name -> inode of a directory, freed by kfree when it leaves the hash table
+static struct kmem_cache *inode_cache_cachep;
+
 // init the global inode table
 void inode_table_init() {
+    if ((inode_cache_cachep = kmem_cache_create("inode_cache", sizeof(struct inode_cache))) == NULL) {
+        panic("inode_table_init : no memory\n");
+    }
     INIT_LIST_HEAD(&inode_table.entry);
     struct inode *entry;
     initlock(&inode_table.lock, "inode_table"); // !!!!
     // sema_init(&inode_table.lock, 1, "inode_table_lock");
     for (entry = inode_table.inode_entry; entry < &inode_table.inode_entry[NINODE]; entry++) {
         memset(entry, 0, sizeof(struct inode));
-        sema_init(&entry->i_sem, 1, "inode_entry_sem");
-        sema_init(&entry->i_read_lock, 1, "read_lock");
+        mutex_init(&entry->i_mutex, "inode_entry_mutex");
+        mutex_init(&entry->i_read_lock, "read_lock");
         // sema_init(&entry->i_writeback_lock, 1, "i_writeback_lock");
         initlock(&entry->i_lock, "inode_entry_lock");
         initlock(&entry->tree_lock, "inode_radix_tree_lock");
@@ -93,8 +101,8 @@ inline static int __get_blocks(int size) {
 struct inode *fat32_root_inode_init(struct _superblock *sb) {
     // root inode initialization
     struct inode *root_ip = (struct inode *)kalloc();
-    sema_init(&root_ip->i_sem, 1, "fat_root_inode");
-    sema_init(&root_ip->i_read_lock, 1, "read_root_inode");
+    mutex_init(&root_ip->i_mutex, "fat_root_inode");
+    mutex_init(&root_ip->i_read_lock, "read_root_inode");
     // sema_init(&root_ip->i_writeback_lock, 1, "writebakc_root_inode");
     root_ip->i_dev = sb->s_dev;
     // root_ip->i_mode = IMODE_NONE;
@@ -514,6 +522,7 @@ ssize_t fat32_inode_write(struct inode *ip, int user_src, uint64 src, uint off,
     if (tot == -1) {
         return -1;
     }
+    ip->i_version++;
 
     // add it into dirty list !!!
     acquire(&ip->i_sb->dirty_lock);
@@ -685,7 +694,7 @@ void fat32_inode_lock(struct inode *ip) {
     }
     // Hint ： 如果发现卡住了，很有可能是两次获取同一把锁
     // printf("lock: %d : try to lock %s sem.value = %d\n",++hit, ip->fat32_i.fname, ip->i_sem.value);
-    sema_wait(&ip->i_sem);
+    mutex_lock(&ip->i_mutex);
     // printf("lock: %s locked !! sem.value = %d\n",ip->fat32_i.fname, ip->i_sem.value);
 
     if (ip->valid == 0) {
@@ -777,7 +786,7 @@ void fat32_inode_unlock(struct inode *ip) {
         printf("ip : %d, ip->ref : %d\n", ip, ip->ref);
         panic("fat32 unlock");
     }
-    sema_signal(&ip->i_sem);
+    mutex_unlock(&ip->i_mutex);
     // printf("unlock: %s release !! sem.value = %d\n",ip->fat32_i.fname, ip->i_sem.value);
 }
 
@@ -945,6 +954,7 @@ void fat32_inode_trunc(struct inode *ip) {
     ip->i_mode = IMODE_NONE;
     ip->i_size = 0;
     ip->i_blocks = 0;
+    ip->i_version++;
     ip->fat32_i.parent_off = -1; // ???
 
     ip->i_hash = NULL; // !!!
@@ -1487,7 +1497,6 @@ void fat32_inode_hash_init(struct inode *dp) {
     if (dp->i_hash == NULL) {
         panic("hash table init : no free space\n");
     }
-    dp->i_hash->lock = INIT_SPINLOCK(inode_hash_table);
     dp->i_hash->type = INODE_MAP;
     dp->i_hash->size = NINODE;
     hash_table_entry_init(dp->i_hash);
@@ -1499,7 +1508,7 @@ int fat32_inode_hash_insert(struct inode *dp, const char *name, struct inode *ip
     if (hash_lookup(dp->i_hash, (void *)name, NULL, 1, 0) != NULL) { // release it, not holding lock
         return -1;                                                   //!!!
     }
-    struct inode_cache *c = (struct inode_cache *)kmalloc(sizeof(struct inode_cache));
+    struct inode_cache *c = (struct inode_cache *)kmem_cache_alloc(inode_cache_cachep);
 
     // printfMAGENTA("fat32_inode_hash_insert, mm --: %d pages\n", get_free_mem() / PGSIZE);
 
@@ -1516,7 +1525,8 @@ int fat32_inode_hash_insert(struct inode *dp, const char *name, struct inode *ip
 
 // using hash table to speed up dirlookup
 struct inode *fat32_inode_hash_lookup(struct inode *dp, const char *name) {
-    struct hash_node *node = hash_lookup(dp->i_hash, (void *)name, NULL, 0, 0);
+    struct hash_entry *entry;
+    struct hash_node *node = hash_lookup(dp->i_hash, (void *)name, &entry, 0, 0);
     // not release it(must holding lock!!!!)
     // not holding lock
 
@@ -1528,7 +1538,7 @@ struct inode *fat32_inode_hash_lookup(struct inode *dp, const char *name) {
         // struct inode *ip = cache->ip;
         int off = cache->off;
 
-        release(&dp->i_hash->lock);
+        release(&entry->lock);
         if (cache != NULL) {
             // printfBlue("hit : name %s, ino, %d, off, %x\n", name ,cache->ino, cache->off);
             ip_search = fat32_inode_get(dp->i_dev, dp, name, off);
@@ -1538,7 +1548,7 @@ struct inode *fat32_inode_hash_lookup(struct inode *dp, const char *name) {
         return ip_search;
     }
 
-    release(&dp->i_hash->lock); // !!!
+    release(&entry->lock); // !!!
 
     return NULL;
 }
@@ -1582,13 +1592,9 @@ int fat32_get_block(struct inode *ip, struct bio *bio_p, uint off, uint n, int a
         int first_sector = FirstSectorofCluster(iter_c_n);
 
         if (vec_cur == NULL || !CLUSTER_ADJACENT(vec_cur, first_sector)) {
-            if ((vec_cur = (struct bio_vec *)kzalloc(sizeof(struct bio_vec))) == NULL) {
-                panic("fat_get_block : no free memory\n");
-            }
+            vec_cur = bio_vec_alloc(); // segments are filled by the caller
             // printfMAGENTA("fat32_get_block: bio_vec alloc, mm-- : %d pages\n", get_free_mem() / 4096);
 
-            sema_init(&vec_cur->sem_disk_done, 0, "bio_disk_done"); // !!! don't forget it
-            INIT_LIST_HEAD(&vec_cur->list);                         // !!! don't forget it
             list_add_tail(&vec_cur->list, &bio_p->list_entry);
             // bug like this :  list_add_tail(&bio_p->list_entry, &vec_cur->list);
         }
@@ -1646,6 +1652,11 @@ int fat32_get_block(struct inode *ip, struct bio *bio_p, uint off, uint n, int a
 // similar to mpage_writepage
 void fat32_i_mapping_destroy(struct inode *ip) {
     struct address_space *mapping = ip->i_mapping;
+#ifdef __DEBUG_PAGE_CACHE__
+    if (mapping != NULL) {
+        readahead_stat_print(mapping);
+    }
+#endif
     acquire(&ip->tree_lock); // !!!
     if (mapping == NULL) {
         release(&ip->tree_lock); // !!!
@@ -1659,6 +1670,7 @@ void fat32_i_mapping_destroy(struct inode *ip) {
         return;
     }
     if (!radix_tree_is_indirect_ptr(node)) {
+        lru_cache_del((struct page *)node);
         kfree((void *)page_to_pa((struct page *)node));
     } else {
         node = radix_tree_indirect_to_ptr(node);
@@ -1687,9 +1699,9 @@ void fat32_i_mapping_init(struct inode *ip) {
     mapping->host = ip; // !!!
     mapping->nrpages = 0;
     INIT_RADIX_TREE(&mapping->page_tree, GFP_FS);
-    mapping->last_index = 0;
-    mapping->read_ahead_cnt = 0;
-    mapping->read_ahead_end = 0;
+    mapping->ra_start = 0;
+    mapping->ra_size = 0;
+    mapping->ra_async_size = 0;
 
 #ifdef __DEBUG_PAGE_CACHE__
     printfCYAN("fat32_i_mapping_init, file : %s\n", ip->fat32_i.fname);
@@ -1942,50 +1954,6 @@ void fat32_find_same_name_cnt_handler(struct trav_control *tc) {
     }
 }
 
-void alloc_fail(void) {
-    printfGreen("mm: %d pages before alloc fail\n", get_free_mem() / 4096);
-
-    acquire(&inode_table.lock);
-    struct inode *ip = NULL;
-
-    for (ip = inode_table.inode_entry; ip < &inode_table.inode_entry[NINODE]; ip++) {
-        if (ip->ref) {
-            // printfBlue("file name : %s recycle, ref : %d\n", ip->fat32_i.fname, ip->ref);
-
-            // release(&inode_table.lock);
-            // sema_wait(&ip->i_writeback_lock);
-            // ==== atomic ====
-            // write back dirty pages of inode
-            // fat32_i_mapping_writeback(ip);
-
-            // destory i_mapping
-            if (list_empty_atomic(&ip->dirty_list, &ip->i_lock)) {
-                fat32_i_mapping_destroy(ip);
-            }
-            // acquire(&inode_table.lock);
-
-            // destory hash table
-            fat32_inode_hash_destroy(ip);
-
-            // // free index table
-            // fat32_free_index_table(ip);
-
-            // sema_signal(&ip->i_writeback_lock);
-            // ==== atomic ====
-        }
-    }
-    if (list_empty_atomic(&fat32_sb.root->dirty_list, &fat32_sb.root->i_lock)) {
-        fat32_i_mapping_destroy(fat32_sb.root);
-    }
-    fat32_inode_hash_destroy(fat32_sb.root);
-    // // free index table
-    // fat32_free_index_table(ip);
-
-    printfGreen("mm: %d pages after alloc fail\n", get_free_mem() / 4096);
-
-    release(&inode_table.lock);
-}
-
 void shutdown_writeback(void) {
     printf("\nmm: %d pages before writeback\n", get_free_mem() / 4096);
 
@@ -2030,8 +1998,14 @@ void shutdown_writeback(void) {
     // fat32_free_index_table(ip);
 
     printf("mm: %d pages after writeback\n", get_free_mem() / 4096);
+#ifdef __DEBUG_STAT__
+    lru_stat_print();
+    slab_stat_print();
+    mempool_stat_print();
+#endif
     release(&inode_table.lock);
     fat32_fat_bitmap_writeback(ROOTDEV, &fat32_sb);
+    bcache_flush();
 }
 
 // get time string
@@ -10,10 +10,20 @@
 #include "fs/mpage.h"
 #include "debug.h"
 #include "proc/pcb_life.h"
+#include "memory/slab.h"
+
+static struct kmem_cache *page_item_cachep;
+
+void mpage_init(void) {
+    if ((page_item_cachep = kmem_cache_create("page_item", sizeof(struct Page_item))) == NULL) {
+        panic("mpage_init : no memory\n");
+    }
+}
 
 // index : page index
 // cnt : page count
-void block_full_pages(struct inode *ip, struct bio *bio_p, uint64 src, uint64 index, uint64 cnt, int alloc) {
+// p_first : page item of index, followed by the page items of index + 1, ...
+void block_full_pages(struct inode *ip, struct bio *bio_p, struct Page_item *p_first, uint64 index, uint64 cnt, int alloc) {
     // fill the bio using fat32_get_block
     uint32 off = index * PGSIZE;
     uint32 n = cnt * PGSIZE;
@@ -24,35 +34,50 @@ void block_full_pages(struct inode *ip, struct bio *bio_p, uint64 src, uint64 in
     if (alloc == 1) // it is ok, if only read
         ASSERT(blocks_n * bsize == n);
 
-    // copy bio_vec into dst
+    // scatter bio_vec into pages, pages needn't be contiguous in memory
+    struct Page_item *p_cur = p_first;
+    uint32 p_off = 0; // offset in page of p_cur
     struct bio_vec *vec_cur = NULL;
     list_for_each_entry(vec_cur, &bio_p->list_entry, list) {
-        vec_cur->data = (uchar *)src;
-        src += vec_cur->block_len * bsize;
+        uint32 done = 0; // blocks
+        while (done < vec_cur->block_len) {
+            if (p_off == PGSIZE) {
+                p_cur = list_next_entry(p_cur, list);
+                p_off = 0;
+            }
+            uint32 blocks = MIN(vec_cur->block_len - done, (PGSIZE - p_off) / bsize);
+            if (bio_vec_add_seg(vec_cur, (void *)(p_cur->pa + p_off), blocks * bsize) < 0) {
+                // no room for more segments, the rest blocks go into a new bio_vec
+                struct bio_vec *vec_new = bio_vec_alloc();
+                vec_new->blockno_start = vec_cur->blockno_start + done;
+                vec_new->block_len = vec_cur->block_len - done;
+                vec_cur->block_len = done;
+                list_add(&vec_new->list, &vec_cur->list);
+                break;
+            }
+            done += blocks;
+            p_off += blocks * bsize;
+        }
     }
 }
 
-// read/write more than one page
-void fat32_rw_pages(struct inode *ip, uint64 src, uint64 index, int rw, uint64 cnt, int alloc) {
-    struct bio bio_cur;
-
-    // init bio
-    INIT_LIST_HEAD(&bio_cur.list_entry);
-    bio_cur.bi_rw = rw;
-    bio_cur.bi_bdev = ip->i_dev;
-
-    // fill bio with bio_vec
-    // block_full_pages(ip, &bio_cur, page_list, index, cnt, alloc);
-    block_full_pages(ip, &bio_cur, src, index, cnt, alloc);
+// append bio_vecs of more than one page to bio
+static void fat32_bio_add_pages(struct inode *ip, struct bio *bio_p, struct Page_item *p_first, uint64 index, uint64 cnt, int alloc) {
+    struct bio bio_tmp;
+    struct bio_vec *vec_cur = NULL;
+    struct bio_vec *vec_tmp = NULL;
 
-    // submit bio
-    if (!list_empty(&bio_cur.list_entry)) {
-        submit_bio(&bio_cur, 1); // free bio_vec of bio
+    // fat32_get_block needs an empty bio
+    INIT_LIST_HEAD(&bio_tmp.list_entry);
+    block_full_pages(ip, &bio_tmp, p_first, index, cnt, alloc);
+    list_for_each_entry_safe(vec_cur, vec_tmp, &bio_tmp.list_entry, list) {
+        list_move_tail(&vec_cur->list, &bio_p->list_entry);
     }
 }
 
-// read/write more than one page using page batch
-void fat32_rw_pages_batch(struct inode *ip, struct Page_entry *p_entry, int rw, int alloc) {
+// fill bio with all pages of page list
+// all batches go into one bio, so the disk works on them at the same time
+static void fat32_pages_to_bio(struct inode *ip, struct bio *bio_p, struct Page_entry *p_entry, int alloc) {
     struct Page_item *p_cur_out = NULL;
     int batch_size = 1;
 
@@ -85,7 +110,24 @@ void fat32_rw_pages_batch(struct inode *ip, struct Page_entry *p_entry, int rw,
         // }
 #endif
         // release(&pa_to_page(p_tmp_head_in->pa)->lock); // !!! maybe the lock protecting page is not needed ??
-        fat32_rw_pages(ip, p_tmp_head_in->pa, p_tmp_head_in->index, rw, batch_size, alloc); // don't write batch_size as batch_size * PGSIZE
+        fat32_bio_add_pages(ip, bio_p, p_tmp_head_in, p_tmp_head_in->index, batch_size, alloc); // don't write batch_size as batch_size * PGSIZE
+    }
+}
+
+// read/write more than one page using page batch
+void fat32_rw_pages_batch(struct inode *ip, struct Page_entry *p_entry, int rw, int alloc) {
+    struct bio bio_cur;
+
+    // init bio
+    INIT_LIST_HEAD(&bio_cur.list_entry);
+    bio_cur.bi_rw = rw;
+    bio_cur.bi_bdev = ip->i_dev;
+
+    fat32_pages_to_bio(ip, &bio_cur, p_entry, alloc);
+
+    // submit bio
+    if (!list_empty(&bio_cur.list_entry)) {
+        submit_bio(&bio_cur, 1); // free bio_vec of bio
     }
 
     // must remember to free page list
@@ -97,7 +139,7 @@ void page_list_free(struct Page_entry *p_entry) {
     struct Page_item *p_cur = NULL;
     struct Page_item *p_tmp = NULL;
     list_for_each_entry_safe(p_cur, p_tmp, &p_entry->entry, list) {
-        kfree(p_cur);
+        kmem_cache_free(page_item_cachep, p_cur);
     }
 }
 
@@ -130,20 +172,20 @@ uint64 mpage_readpages(struct inode *ip, uint64 index, uint64 cnt, int read_from
                 end_idx++;
             }
 
-            // allocpages:
-            if ((pa = (uint64)kzalloc(PGSIZE * (end_idx - start_idx))) == 0) {
-                printfRed("end_idx : %d, start_idx : %d\n", end_idx, start_idx);
-                panic("mpage_readpages, pa, : no enough memory\n");
-            }
-            // printfMAGENTA("mpage_readpages: page alloc, mm-- : %d pages\n", get_free_mem() / 4096);
-
-            if (first_pa == 0) {
-                first_pa = pa; // !!!
-            }
-
             struct Page_item *p_item = NULL;
             for (int z = start_idx; z < end_idx; z++) {
-                uint64 pa_tmp = pa + (z - start_idx) * PGSIZE;
+                // allocpages : one page at a time, the bio scatters into them
+                if ((pa = (uint64)kzalloc(PGSIZE)) == 0) {
+                    printfRed("end_idx : %d, start_idx : %d\n", end_idx, start_idx);
+                    panic("mpage_readpages, pa, : no enough memory\n");
+                }
+                // printfMAGENTA("mpage_readpages: page alloc, mm-- : %d pages\n", get_free_mem() / 4096);
+
+                if (first_pa == 0) {
+                    first_pa = pa; // !!!
+                }
+
+                uint64 pa_tmp = pa;
                 uint64 index_tmp = index + z;
                 struct page *page = pa_to_page(pa_tmp);
                 // if (find_get_page_atomic(mapping, index_tmp, 0)) {
@@ -157,7 +199,7 @@ uint64 mpage_readpages(struct inode *ip, uint64 index, uint64 cnt, int read_from
                 }
 
                 // page list item :
-                if ((p_item = (struct Page_item *)kzalloc(sizeof(struct Page_item))) == NULL) {
+                if ((p_item = (struct Page_item *)kmem_cache_zalloc(page_item_cachep)) == NULL) {
                     panic("mpage_readpages, p_item, : no enough memory\n");
                 }
                 // printfMAGENTA("mpage_readpages: Page_item alloc, mm-- : %d pages\n", get_free_mem() / 4096);
@@ -190,6 +232,75 @@ uint64 mpage_readpages(struct inode *ip, uint64 index, uint64 cnt, int read_from
     return first_pa;
 }
 
+// an asynchronous read ahead, freed by mpage_readahead_end_io
+struct readahead_ctl {
+    struct bio bio;
+    struct Page_entry p_entry;
+};
+
+// maybe in interrupt, don't sleep
+static void mpage_readahead_end_io(struct bio *bio) {
+    struct readahead_ctl *ra = (struct readahead_ctl *)bio->bi_private;
+    struct Page_item *p_cur = NULL;
+
+    bio_free_vecs(bio);
+    end_pages_read(&ra->p_entry);
+    // the mapping may be destroyed during the read, the pages are freed here then
+    list_for_each_entry(p_cur, &ra->p_entry.entry, list) {
+        kfree((void *)p_cur->pa);
+    }
+
+    page_list_free(&ra->p_entry);
+    kfree(ra);
+}
+
+// read pages [index, index + cnt) which are not in page cache, without waiting
+// pages are in page cache with PG_locked until they are read, see wait_on_page_read
+// the read holds a reference of every page, so it doesn't care about the mapping
+// the page of marker gets PG_readahead, the reader starts the next window there
+void mpage_readahead(struct inode *ip, uint64 index, uint64 cnt, uint64 marker) {
+    struct address_space *mapping = ip->i_mapping;
+    struct readahead_ctl *ra = NULL;
+
+    if ((ra = (struct readahead_ctl *)kzalloc(sizeof(struct readahead_ctl))) == NULL) {
+        panic("mpage_readahead : no enough memory\n");
+    }
+    INIT_LIST_HEAD(&ra->p_entry.entry);
+    ra->p_entry.n_pages = 0;
+    INIT_LIST_HEAD(&ra->bio.list_entry);
+    ra->bio.bi_rw = DISK_READ;
+    ra->bio.bi_bdev = ip->i_dev;
+
+    for (uint64 i = index; i < index + cnt; i++) {
+        if (find_get_page_atomic(mapping, i, 0)) {
+            continue;
+        }
+        uint64 pa;
+        if ((pa = (uint64)kzalloc(PGSIZE)) == 0) {
+            panic("mpage_readahead, pa : no enough memory\n");
+        }
+        struct page *page = pa_to_page(pa);
+        set_page_flags(page, PG_locked);
+        if (i == marker) {
+            set_page_flags(page, PG_readahead);
+        }
+        page_cache_get(page); // reference of the read
+        add_to_page_cache_atomic(page, mapping, i);
+        page_list_add(&ra->p_entry, page, i, NULL);
+    }
+
+    if (ra->p_entry.n_pages == 0) {
+        kfree(ra);
+        return;
+    }
+
+    // don't allocate clusters
+    fat32_pages_to_bio(ip, &ra->bio, &ra->p_entry, 0);
+
+    mapping->ra_pages += ra->p_entry.n_pages;
+    submit_bio_async(&ra->bio, mpage_readahead_end_io, ra);
+}
+
 // write pages
 void mpage_writepage(struct inode *ip, int alloc) {
     struct address_space *mapping = ip->i_mapping;
@@ -218,6 +329,12 @@ void mpage_writepage(struct inode *ip, int alloc) {
     }
     release(&ip->tree_lock);
 
+    // clear PG_dirty before the write, so a write during it sets PG_dirty again
+    struct Page_item *p_cur = NULL;
+    list_for_each_entry(p_cur, &p_entry.entry, list) {
+        clear_page_flags(pa_to_page(p_cur->pa), PG_dirty);
+    }
+
     // write pages using page list
     fat32_rw_pages_batch(ip, &p_entry, DISK_WRITE, alloc);
 }
@@ -226,7 +343,7 @@ void mpage_writepage(struct inode *ip, int alloc) {
 void page_list_add(void *entry, void *item, uint64 index, void *node) {
     struct Page_entry *p_entry = (struct Page_entry *)entry;
     struct Page_item *p_item = NULL;
-    if ((p_item = (struct Page_item *)kzalloc(sizeof(struct Page_item))) == NULL) {
+    if ((p_item = (struct Page_item *)kmem_cache_zalloc(page_item_cachep)) == NULL) {
         panic("mpage_readpages, page_list_add, : no enough memory\n");
     }
 
@@ -361,15 +361,6 @@ uint64 sys_pselect6(void) {
     return ret;
 }
 
-#define TICK_GRANULARITY 10L // ms
-#define SEC2TICK(sec) ((sec)*1000 / TICK_GRANULARITY)
-#define MS2TICK(ms) ((ms) / TICK_GRANULARITY)
-#define US2TICK(us) ((us)*TICK_GRANULARITY / 1000)
-#define NS2TICK(ns) ((ns) / 1000 / 1000 / TICK_GRANULARITY)
-static inline uint64 ts2ticks(struct timespec *ts) {
-    return ts ? SEC2TICK(ts->ts_sec) + NS2TICK(ts->ts_nsec) : 0;
-}
-
 uint64 sys_ppoll(void) {
     uint64 pfdaddr;
     int nfds;
@@ -403,8 +394,9 @@ uint64 sys_ppoll(void) {
     if (tsaddr && copyin(p->mm->pagetable, (char *)&ts, tsaddr, sizeof(struct timespec)) < 0)
         return -1;
 
-    // uint64 timeout = TIMESEPC2NS(ts);
-    uint64 timeout = tsaddr ? ts2ticks(&ts) : -1;
+    // the console doesn't wake up pollers, check it every tick until the deadline
+    uint64 deadline = tsaddr ? TIME2NS(rdtime()) + TIMESEPC2NS(ts) : -1;
+    int timeout = 0;
 
     while (1) {
         switch (f->f_type) {
@@ -417,28 +409,22 @@ uint64 sys_ppoll(void) {
             panic("error");
         }
 
-        if (timeout == -1) continue;
-
-        // uint64 time_now = TIME2NS(rdtime());
-        // if ((TIME2NS(rdtime()) > time_now + timeout)) {
-        //     // printf("ready\n");
-        //     // printfGreen("select , pid : %d exit\n", proc_current()->pid);// debug
-        //     break;
-        // }
-
-        if (timeout) {
-            // Log("hit");
-            extern struct cond cond_ticks;
-            acquire(&cond_ticks.waiting_queue.lock);
-            cond_wait(&cond_ticks, &cond_ticks.waiting_queue.lock);
-            release(&cond_ticks.waiting_queue.lock);
-            timeout--;
-        } else {
+        if (deadline == -1) continue;
+
+        uint64 now = TIME2NS(rdtime());
+        if (now >= deadline) {
+            timeout = 1;
             break;
         }
+        // woken up by the next tick, or by the hrtimer if the deadline comes first
+        extern struct cond cond_ticks;
+        acquire(&cond_ticks.waiting_queue.lock);
+        thread_current()->time_out = deadline - now;
+        cond_wait(&cond_ticks, &cond_ticks.waiting_queue.lock);
+        release(&cond_ticks.waiting_queue.lock);
     }
 ret:
-    if (timeout == 0) return 0;
+    if (timeout) return 0;
 
     pfd.revents = pfd.events;
     if (copyout(p->mm->pagetable, pfdaddr, (char *)&pfd, sizeof(pfd)) < 0)
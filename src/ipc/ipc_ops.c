@@ -41,7 +41,6 @@ void ipc_hashtable_init(struct ipc_ids *ids) {
     if (ids->key_ht == NULL) {
         panic("hash table init : no free space\n");
     }
-    ids->key_ht->lock = INIT_SPINLOCK(inode_hash_table);
     ids->key_ht->type = IPC_IDX_MAP;
     ids->key_ht->size = NIPCIDX; // TODO
     hash_table_entry_init(ids->key_ht);
@@ -57,17 +56,18 @@ int ipc_hash_insert(struct ipc_ids *ids, int id, struct kern_ipc_perm *new) {
 }
 
 struct kern_ipc_perm *ipc_hash_lookup(struct ipc_ids *ids, int id) {
-    struct hash_node *node = hash_lookup(ids->key_ht, (void *)&id, NULL, 0, 0); //
+    struct hash_entry *entry;
+    struct hash_node *node = hash_lookup(ids->key_ht, (void *)&id, &entry, 0, 0); //
     // not release it(must holding lock!!!!)
     // not holding it
     if (node != NULL) {
         // find it
         struct kern_ipc_perm *search = NULL;
         search = (struct kern_ipc_perm *)(node->value);
-        release(&ids->key_ht->lock);
+        release(&entry->lock);
         return search;
     }
-    release(&ids->key_ht->lock); // !!!
+    release(&entry->lock); // !!!
     return NULL;
 }
 
@@ -66,38 +66,36 @@ void pipe_close(struct pipe *pi, int writable) {
         release(&pi->lock);
 }
 
+// user memory is copied outside pi->lock through a buffer on the stack,
+// a fault on a lazily mapped page may sleep
 int pipe_write(struct pipe *pi, int user_dst, uint64 addr, int n) {
-    int i = 0;
+    int i = 0, j, m;
+    char buf[PIPESIZE];
     struct proc *pr = proc_current();
 
-    acquire(&pi->lock);
     while (i < n) {
-        if (pi->readopen == 0 || proc_killed(pr)) {
-            release(&pi->lock);
-            return -1;
-        }
-        if (PIPE_FULL(pi)) {
-            sema_signal(&pi->read_sem);
-            release(&pi->lock);
-            sema_wait(&pi->write_sem);
-            acquire(&pi->lock);
-        } else {
-            char ch;
-            if (either_copyin(&ch, user_dst, addr + i, 1) == -1)
-                break;
-            pi->data[pi->nwrite++ % PIPESIZE] = ch;
-            i++;
-            // int write_idx = pi->nwrite % PIPESIZE;
-            // int read_idx = pi->nwrite % PIPESIZE;
-            // int cpy_len = PIPESIZE - (write_idx - read_idx);
-            // if (either_copyin(pi->data + write_idx, user_dst, addr + cpy_len, cpy_len) == -1)
-            //     break;
-            // pi->nwrite += cpy_len;
-            // i+= cpy_len;
+        m = MIN(n - i, PIPESIZE);
+        if (either_copyin(buf, user_dst, addr + i, m) == -1)
+            break;
+        acquire(&pi->lock);
+        for (j = 0; j < m;) {
+            if (pi->readopen == 0 || proc_killed(pr)) {
+                release(&pi->lock);
+                return -1;
+            }
+            if (PIPE_FULL(pi)) {
+                sema_signal(&pi->read_sem);
+                release(&pi->lock);
+                sema_wait(&pi->write_sem);
+                acquire(&pi->lock);
+            } else {
+                pi->data[pi->nwrite++ % PIPESIZE] = buf[j++];
+            }
         }
+        sema_signal(&pi->read_sem);
+        release(&pi->lock);
+        i += m;
     }
-    sema_signal(&pi->read_sem);
-    release(&pi->lock);
 
     return i;
 }
@@ -105,7 +103,7 @@ int pipe_write(struct pipe *pi, int user_dst, uint64 addr, int n) {
 int pipe_read(struct pipe *pi, int user_dst, uint64 addr, int n) {
     int i;
     struct proc *pr = proc_current();
-    char ch;
+    char buf[PIPESIZE];
 
     acquire(&pi->lock);
     while (PIPE_EMPTY(pi) && pi->writeopen) {
@@ -117,16 +115,15 @@ int pipe_read(struct pipe *pi, int user_dst, uint64 addr, int n) {
         sema_wait(&pi->read_sem);
         acquire(&pi->lock);
     }
-    for (i = 0; i < n; i++) {
-        if (PIPE_EMPTY(pi))
-            break;
-        ch = pi->data[pi->nread % PIPESIZE];
-        if (either_copyout(user_dst, addr + i, &ch, 1) == -1)
-            break;
-        ++pi->nread;
+    // at most PIPESIZE bytes are in the pipe
+    for (i = 0; i < n && !PIPE_EMPTY(pi); i++) {
+        buf[i] = pi->data[pi->nread++ % PIPESIZE];
     }
     sema_signal(&pi->write_sem);
     release(&pi->lock);
+
+    if (i > 0 && either_copyout(user_dst, addr, buf, i) == -1)
+        return -1;
     return i;
 }
 
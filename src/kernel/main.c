@@ -22,13 +22,22 @@ void virtio_disk_init(void);
 void binit(void);
 void fileinit(void);
 void vmas_init();
+void zero_page_init(void);
 void mm_init();
+void kmem_cache_init(void);
+void radix_tree_init(void);
+void mpage_init(void);
+void lru_init(void);
+void filemap_init(void);
 void userinit(void);
 void proc_init();
 void inode_table_init(void);
+void ldso_cache_init(void);
 void hash_tables_init(void);
+void futex_hash_init(void);
 void hartinit();
 void pdflush_init();
+void kswapd_init(void);
 void page_writeback_timer_init(void);
 void disk_init(void);
 void null_zero_dev_init();
@@ -72,8 +81,14 @@ void main(uint64 hartid) {
 
         //========== physical memory management ==========
         mm_init();
+        kmem_cache_init();
+        radix_tree_init();
+        lru_init();
+        filemap_init();
+        mpage_init();
         //========== VMA management ==========
         vmas_init();
+        zero_page_init();
 
         //========== kernel virtual memory ==========
         kvminit();     // create kernel page table
@@ -98,12 +113,14 @@ void main(uint64 hartid) {
         binit();
         fileinit();
         inode_table_init();
+        ldso_cache_init();
 
         //========== socket ==========
         init_socket_table();
 
         //========== global map ==========
         hash_tables_init();
+        futex_hash_init();
 
         Info("========= Block device ==========\n");
         //========== block device ============
@@ -123,7 +140,10 @@ void main(uint64 hartid) {
 #endif
 
         // pdflush kernel thread
-        // pdflush_init();
+        pdflush_init();
+        page_writeback_timer_init();
+        // page reclaim kernel thread
+        kswapd_init();
         __sync_synchronize();
 
         hart_start();
@@ -11,8 +11,6 @@
 #include "debug.h"
 #include "kernel/syscall.h"
 
-extern atomic_t pages_cnt;
-
 // #define __STRACE__
 // Fetch the uint64 at addr from the current process.
 #define INSTACK(addr) ((addr) >= USTACK && (addr) + sizeof(uint64) < USTACK + USTACK_PAGE * PGSIZE)
@@ -302,10 +300,13 @@ static struct syscall_info info[] = {
     [SYS_setitimer] { "setitimer", 3, "dpp" },
     [SYS_umask] { "umask", 1, "d" },
     [SYS_sched_getaffinity] { "sched_getaffinity", 3, "ddp" },
-    [SYS_sched_setaffinity] { "shced_setaffinity", 3, "ddp" },
+    [SYS_sched_setaffinity] { "sched_setaffinity", 3, "ddp" },
     [SYS_sched_getscheduler] { "sched_getscheduler", 3, "ddp" },
     [SYS_sched_getparam] { "sched_getparam", 2, "dp" },
     [SYS_sched_setscheduler] { "sched_setscheduler", 3, "ddp" },
+    [SYS_sched_setparam] { "sched_setparam", 2, "dp" },
+    [SYS_setpriority] { "setpriority", 3, "ddd" },
+    [SYS_getpriority] { "getpriority", 2, "dd" },
     [SYS_clock_getres] { "clock_getres", 2, "dp" },
     [SYS_nanosleep] { "nanosleep", 2, "pp" },
     [SYS_futex] { "futex", 6, "pddppd" },
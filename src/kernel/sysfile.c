@@ -27,6 +27,7 @@
 #include "fs/uio.h"
 #include "kernel/syscall.h"
 #include "fs/ioctl.h"
+#include "fs/bio.h"
 
 #define FILE2FD(f, proc) (((char *)(f) - (char *)(proc)->ofile) / sizeof(struct file))
 // Fetch the nth word-sized system call argument as a file descriptor
@@ -156,6 +157,7 @@ int assist_openat(struct inode *ip, int flags, int omode, struct file **fp) {
 
     if (((flags & O_TRUNC) == O_TRUNC) && S_ISREG(ip->i_mode)) {
         ip->i_size = 0;
+        ip->i_version++;
         f->f_pos = 0;
     } else if (((flags & O_APPEND) == O_APPEND) && S_ISREG(ip->i_mode)) {
         f->f_pos = ip->i_size + 1;
@@ -365,7 +367,7 @@ static uint64 do_renameat2(struct inode *ip, int newdirfd, char *newpath, int fl
             return -1;
         } else {
             // 删除, 然后创建
-            ASSERT(newip->parent->i_sem.value > 0);
+            ASSERT(!mutex_is_locked(&newip->parent->i_mutex));
             newip->parent->i_op->ilock(newip->parent);
             // assist_unlink(newip);    // error! do not use this
             __unlink(newip->parent, newip);
@@ -381,7 +383,7 @@ static uint64 do_renameat2(struct inode *ip, int newdirfd, char *newpath, int fl
             return -1;
         } else {
             // 删除，然后创建
-            ASSERT(newip->parent->i_sem.value > 0);
+            ASSERT(!mutex_is_locked(&newip->parent->i_mutex));
             newip->parent->i_op->ilock(newip->parent);
             // assist_unlink(newip);    // error! do not use this
             __unlink(newip->parent, newip);
@@ -410,7 +412,7 @@ create:
     // 2. 删除原目录项entry（不删除文件数据）
     ASSERT(ip->parent->i_op);
     parent = ip->parent;
-    ASSERT(parent->i_sem.value > 0);
+    ASSERT(!mutex_is_locked(&parent->i_mutex));
     parent->i_op->ilock(parent);
     parent->i_op->ientrydelete(parent, ip);
     parent->i_op->iunlock_put(parent);
@@ -1647,12 +1649,21 @@ uint64 sys_pwrite64(void) {
 // synchronize cached writes to persistent storage
 // void sync(void);
 uint64 sys_sync(void) {
+    // write back delayed writes of buffer cache
+    bcache_flush();
     return 0;
 }
 
 // synchronize a file's in-core state with storage device
 // int fsync(int fd);
 uint64 sys_fsync(void) {
+    int fd;
+    struct file *f;
+    if (argfd(0, &fd, &f) < 0) {
+        return -1;
+    }
+    // metadata (FAT, FSInfo) of the file lives in buffer cache
+    bcache_flush();
     return 0;
 }
 
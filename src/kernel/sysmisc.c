@@ -20,7 +20,6 @@
 #include "kernel/syscall.h"
 
 extern atomic_t ticks;
-extern struct cond cond_ticks;
 
 struct tms {
     long tms_utime;
@@ -146,6 +145,10 @@ extern void shutdown_writeback(void);
 uint64 sys_shutdown() {
     // syscall_count_analysis();
     shutdown_writeback();
+#ifdef __DEBUG_STAT__
+    sched_stat_print();
+    timer_stat_print();
+#endif
 
     // printfGreen("mm: %d pages when shutdown\n", get_free_mem()/4096);
     sbi_shutdown();
@@ -397,14 +400,14 @@ uint64 sys_prlimit64(void) {
 
     ret = do_prlimit(p, resource, new_limit_addr ? &new_limit : NULL, old_limit_addr ? &old_limit : NULL);
 
+    release(&p->lock);
+
     if (!ret && old_limit_addr) {
         rlim_to_rlim64(&old_limit, &old64_limit);
         if (copyout(proc_current()->mm->pagetable, old_limit_addr, (char *)&old64_limit, sizeof(old64_limit)) < 0) {
             ret = -EFAULT;
         }
     }
-
-    release(&p->lock);
     return ret;
 }
 
@@ -549,16 +552,7 @@ uint64 sys_clock_nanosleep(void) {
     if (flags == 0) {
         do_sleep_ns(t, request);
     } else if (flags == TIMER_ABSTIME) {
-        uint64 request_ns = TIMESEPC2NS(request);
-        uint64 now_ns = TIME2NS(rdtime());
-        if (now_ns >= request_ns) {
-            return 0;
-        } else {
-            acquire(&cond_ticks.waiting_queue.lock);
-            t->time_out = request_ns - now_ns;
-            cond_wait(&cond_ticks, &cond_ticks.waiting_queue.lock);
-            release(&cond_ticks.waiting_queue.lock);
-        }
+        do_sleep_until(t, TIMESEPC2NS(request));
     }
 
     switch (clockid) {
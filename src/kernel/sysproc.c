@@ -17,6 +17,7 @@
 #include "kernel/syscall.h"
 #include "atomic/ops.h"
 #include "memory/binfmt.h"
+#include "proc/sched.h"
 
 #define ROOT_UID 0
 
@@ -474,7 +475,7 @@ uint64 sys_futex() {
     struct proc *p = proc_current();
     int cmd = futex_op & FUTEX_CMD_MASK;
     // ktime_t t;
-    if (timeout_addr && (cmd == FUTEX_WAIT)) {
+    if (timeout_addr && (cmd == FUTEX_WAIT || cmd == FUTEX_WAIT_BITSET)) {
         if (copyin(p->mm->pagetable, (char *)&timeout, timeout_addr, sizeof(struct timespec)) < 0) {
             return -1;
         }
@@ -482,7 +483,8 @@ uint64 sys_futex() {
     if (cmd == FUTEX_REQUEUE || cmd == FUTEX_CMP_REQUEUE || cmd == FUTEX_CMP_REQUEUE_PI || cmd == FUTEX_WAKE_OP) {
         arguint(3, &val2);
     }
-    return do_futex(uaddr, futex_op, val, timeout_addr ? &timeout : NULL, uaddr2, val2, val3);
+    int timed = timeout_addr && (cmd == FUTEX_WAIT || cmd == FUTEX_WAIT_BITSET);
+    return do_futex(uaddr, futex_op, val, timed ? &timeout : NULL, uaddr2, val2, val3);
 }
 
 // the real group ID of the calling process
@@ -555,21 +557,179 @@ uint64 sys_setsid(void) {
 uint64 sys_gettid(void) {
     return proc_current()->pid;
 }
+
+// the thread of pid for sched_* syscalls, 0 means the calling thread
+static struct tcb *sched_find_thread(int pid) {
+    if (pid == 0) {
+        return thread_current();
+    }
+    struct proc *p = find_get_pid(pid);
+    return p != NULL ? p->tg->group_leader : NULL;
+}
+
+// int sched_setscheduler(pid_t pid, int policy, const struct sched_param *param);
 uint64 sys_sched_setscheduler(void) {
-    return 0;
+    int pid, policy;
+    uint64 param_addr;
+    struct sched_param param;
+    argint(0, &pid);
+    argint(1, &policy);
+    argaddr(2, &param_addr);
+
+    if (pid < 0 || param_addr == 0) {
+        return -EINVAL;
+    }
+    struct tcb *t = sched_find_thread(pid);
+    if (t == NULL) {
+        return -ESRCH;
+    }
+    if (copyin(proc_current()->mm->pagetable, (char *)&param, param_addr, sizeof(param)) < 0) {
+        return -EFAULT;
+    }
+    return sched_setattr(t, policy, param.sched_priority, t->nice);
+}
+
+// int sched_setparam(pid_t pid, const struct sched_param *param);
+uint64 sys_sched_setparam(void) {
+    int pid;
+    uint64 param_addr;
+    struct sched_param param;
+    argint(0, &pid);
+    argaddr(1, &param_addr);
+
+    if (pid < 0 || param_addr == 0) {
+        return -EINVAL;
+    }
+    struct tcb *t = sched_find_thread(pid);
+    if (t == NULL) {
+        return -ESRCH;
+    }
+    if (copyin(proc_current()->mm->pagetable, (char *)&param, param_addr, sizeof(param)) < 0) {
+        return -EFAULT;
+    }
+    int policy = t->policy | (t->sched_reset_on_fork ? SCHED_RESET_ON_FORK : 0);
+    return sched_setattr(t, policy, param.sched_priority, t->nice);
 }
+
+// int sched_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t *mask);
+// return the size of the mask copied like linux, libc clears the rest
 uint64 sys_sched_getaffinity(void) {
-    return 0;
+    int pid;
+    uint64 len, mask_addr;
+    argint(0, &pid);
+    argaddr(1, &len);
+    argaddr(2, &mask_addr);
+
+    if (pid < 0 || len < sizeof(uint64)) {
+        return -EINVAL;
+    }
+    struct tcb *t = sched_find_thread(pid);
+    if (t == NULL) {
+        return -ESRCH;
+    }
+    uint64 mask = t->cpus_allowed;
+    if (copyout(proc_current()->mm->pagetable, mask_addr, (char *)&mask, sizeof(mask)) < 0) {
+        return -EFAULT;
+    }
+    return sizeof(mask);
 }
+
+// int sched_setaffinity(pid_t pid, size_t cpusetsize, const cpu_set_t *mask);
 uint64 sys_sched_setaffinity(void) {
-    return 0;
+    int pid;
+    uint64 len, mask_addr;
+    uint64 mask = 0;
+    argint(0, &pid);
+    argaddr(1, &len);
+    argaddr(2, &mask_addr);
+
+    if (pid < 0 || len == 0) {
+        return -EINVAL;
+    }
+    struct tcb *t = sched_find_thread(pid);
+    if (t == NULL) {
+        return -ESRCH;
+    }
+    if (copyin(proc_current()->mm->pagetable, (char *)&mask, mask_addr, MIN(len, sizeof(mask))) < 0) {
+        return -EFAULT;
+    }
+    return sched_setaffinity(t, mask);
 }
+
+// int sched_getscheduler(pid_t pid);
 uint64 sys_sched_getscheduler(void) {
-    return 0;
+    int pid;
+    argint(0, &pid);
+
+    if (pid < 0) {
+        return -EINVAL;
+    }
+    struct tcb *t = sched_find_thread(pid);
+    if (t == NULL) {
+        return -ESRCH;
+    }
+    return t->policy | (t->sched_reset_on_fork ? SCHED_RESET_ON_FORK : 0);
 }
+
+// int sched_getparam(pid_t pid, struct sched_param *param);
 uint64 sys_sched_getparam(void) {
+    int pid;
+    uint64 param_addr;
+    struct sched_param param;
+    argint(0, &pid);
+    argaddr(1, &param_addr);
+
+    if (pid < 0 || param_addr == 0) {
+        return -EINVAL;
+    }
+    struct tcb *t = sched_find_thread(pid);
+    if (t == NULL) {
+        return -ESRCH;
+    }
+    param.sched_priority = t->rt_priority;
+    if (copyout(proc_current()->mm->pagetable, param_addr, (char *)&param, sizeof(param)) < 0) {
+        return -EFAULT;
+    }
     return 0;
 }
+
+#define PRIO_PROCESS 0
+
+// int setpriority(int which, id_t who, int prio);
+// only PRIO_PROCESS is supported, it changes the nice of the main thread
+uint64 sys_setpriority(void) {
+    int which, who, prio;
+    argint(0, &which);
+    argint(1, &who);
+    argint(2, &prio);
+
+    if (which != PRIO_PROCESS) {
+        return -EINVAL;
+    }
+    struct tcb *t = sched_find_thread(who);
+    if (t == NULL) {
+        return -ESRCH;
+    }
+    int policy = t->policy | (t->sched_reset_on_fork ? SCHED_RESET_ON_FORK : 0);
+    return sched_setattr(t, policy, t->rt_priority, prio);
+}
+
+// int getpriority(int which, id_t who);
+// return 20 - nice like linux, libc converts it back
+uint64 sys_getpriority(void) {
+    int which, who;
+    argint(0, &which);
+    argint(1, &who);
+
+    if (which != PRIO_PROCESS) {
+        return -EINVAL;
+    }
+    struct tcb *t = sched_find_thread(who);
+    if (t == NULL) {
+        return -ESRCH;
+    }
+    return 20 - t->nice;
+}
 uint64 sys_membarrier(void) {
     return 0;
 }
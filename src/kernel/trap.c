@@ -44,7 +44,7 @@ void trapinithart(void) {
     w_sie(r_sie() | SIE_SEIE | SIE_STIE | SIE_SSIE);
     // uint64 time = rdtime();
     // printf("time = %d\n",time);
-    SET_TIMER();
+    timer_init_hart();
     Info("cpu %d, timer is enable\n", cpuid());
 }
 
@@ -210,8 +210,8 @@ void thread_usertrap(void) {
     // if (thread_killed(t))
     //     do_exit(-1);
 
-    // give up the CPU if this is a timer interrupt.
-    if (which_dev == 2)
+    // give up the CPU if its slice is used up or a queued thread should preempt it.
+    if ((which_dev == 2 && sched_tick()) || need_resched())
         thread_yield();
 
     // handle the signal
@@ -289,8 +289,8 @@ void kerneltrap() {
         panic("kerneltrap");
     }
 
-    // give up the CPU if this is a timer interrupt.
-    if (which_dev == 2 && thread_current() != 0 && thread_current()->state == TCB_RUNNING)
+    // give up the CPU if its slice is used up.
+    if (which_dev == 2 && thread_current() != 0 && thread_current()->state == TCB_RUNNING && sched_tick())
         thread_yield();
 
     // the yield() may have caused some traps to occur,
@@ -342,18 +342,13 @@ int devintr() {
         return 1;
 
     } else if (scause == 0x8000000000000005L) {
-#if defined(SIFIVE_U) || defined(SIFIVE_B)
-        if (cpuid() == 1) { // bugs: can't be 0 when based on sifive_u
-            clockintr();
-        }
-#else
-        if (cpuid() == 0) { // QEMU : cpuid is 0
-            clockintr();
-        }
-#endif
-        SET_TIMER();
-
-        return 2;
+        // a periodic tick, or only an hrtimer of this cpu
+        return timer_interrupt() ? 2 : 1;
+    } else if (scause == 0x8000000000000001L) {
+        // supervisor software interrupt, another cpu queued a thread for this cpu
+        // the scheduler or need_resched() in usertrap finds it, nothing to do here
+        w_sip(r_sip() & ~SIP_SSIP);
+        return 1;
     } else {
         return 0;
     }
@@ -1,25 +1,26 @@
 #include "memory/allocator.h"
+#include "memory/slab.h"
 #include "atomic/spinlock.h"
-#include "atomic/futex.h"
 #include "lib/hash.h"
 #include "debug.h"
 
 // global hash table
-struct hash_table pid_map = {.lock = INIT_SPINLOCK(pid_hash_table),
-                             .type = PID_MAP,
+struct hash_table pid_map = {.type = PID_MAP,
                              .size = NPROC};
-struct hash_table tid_map = {.lock = INIT_SPINLOCK(tid_hash_table),
-                             .type = TID_MAP,
+struct hash_table tid_map = {.type = TID_MAP,
                              .size = NTCB};
-struct hash_table futex_map = {.lock = INIT_SPINLOCK(futex_hash_table),
-                               .type = FUTEX_MAP,
-                               .size = FUTEX_NUM};
-struct futex;
 
-// find the table entry given the table，type and key
-struct hash_entry *hash_get_entry(struct hash_table *table, void *key, int holding) {
+static struct kmem_cache *hash_node_cachep;
+
+static char *hash_bucket_name[] = {
+    [PID_MAP] = "pid_hash_bucket",
+    [TID_MAP] = "tid_hash_bucket",
+    [IPC_IDX_MAP] = "ipc_hash_bucket",
+    [INODE_MAP] = "inode_hash_bucket",
+};
+
+static struct hash_entry *hash_bucket(struct hash_table *table, void *key) {
     uint64 hash_val = 0;
-    struct hash_entry *entry = NULL;
 
     switch (table->type) {
     case PID_MAP:
@@ -29,23 +30,26 @@ struct hash_entry *hash_get_entry(struct hash_table *table, void *key, int holdi
         break;
         // hash_val = *(int *)key % table->size;
         // break;
-    case FUTEX_MAP:
-        hash_val = (uint64)key % table->size;
-        break;
     case INODE_MAP:
         hash_val = hash_str((char *)key) % table->size;
         break;
     default:
         panic("hash_get_entry : this type is invalid\n");
     }
-    entry = table->hash_head + hash_val;
+    return table->hash_head + hash_val;
+}
+
+// find the table entry given the table，type and key, and lock it
+struct hash_entry *hash_get_entry(struct hash_table *table, void *key, int holding) {
+    struct hash_entry *entry = hash_bucket(table, key);
     if (!holding)
-        acquire(&table->lock);
+        acquire(&entry->lock);
     return entry;
 }
 
 // lookup the hash table
-// release : release its lock?
+// release : release the lock of its entry?
+// if not, the caller releases (*entry)->lock
 struct hash_node *hash_lookup(struct hash_table *table, void *key, struct hash_entry **entry, int release, int holding) {
     struct hash_entry *_entry = hash_get_entry(table, key, holding);
 
@@ -56,15 +60,37 @@ struct hash_node *hash_lookup(struct hash_table *table, void *key, struct hash_e
     list_for_each_entry_safe(node_cur, node_tmp, &_entry->list, list) {
         if (hash_bool(node_cur, key, table->type)) {
             if (release)
-                release(&table->lock);
+                release(&_entry->lock);
             return node_cur;
         }
     }
     if (release)
-        release(&table->lock);
+        release(&_entry->lock);
     return NULL;
 }
 
+// lookup without any lock, return the value or NULL
+// a node deleted meanwhile is still readable until the grace period ends
+void *hash_find(struct hash_table *table, void *key) {
+    struct hash_entry *entry = hash_bucket(table, key);
+    struct hash_node *node;
+    void *value = NULL;
+
+    rcu_read_lock();
+    list_for_each_entry_rcu(node, &entry->list, list) {
+        if (hash_bool(node, key, table->type)) {
+            value = READ_ONCE(node->value);
+            break;
+        }
+    }
+    rcu_read_unlock();
+    return value;
+}
+
+static void hash_node_free_rcu(struct rcu_head *head) {
+    kmem_cache_free(hash_node_cachep, container_of(head, struct hash_node, rcu));
+}
+
 // insert the hash node into the table
 void hash_insert(struct hash_table *table, void *key, void *value, int holding) {
     struct hash_entry *entry = NULL;
@@ -72,59 +98,56 @@ void hash_insert(struct hash_table *table, void *key, void *value, int holding)
 
     struct hash_node *node_new;
     if (node == NULL) {
-        node_new = (struct hash_node *)kmalloc(sizeof(struct hash_node));
+        node_new = (struct hash_node *)kmem_cache_alloc(hash_node_cachep);
         hash_assign(node_new, key, table->type);
         node_new->value = value;
-        INIT_LIST_HEAD(&node_new->list);
-        list_add_tail(&node_new->list, &(entry->list));
+        list_add_tail_rcu(&node_new->list, &(entry->list));
     } else {
-        if (table->type == INODE_MAP || table->type == FUTEX_MAP) {
+        if (table->type == INODE_MAP) {
             kfree(node->value); // !!!
         }
-        node->value = value;
+        WRITE_ONCE(node->value, value);
     }
-    release(&table->lock);
+    release(&entry->lock);
 }
 
 // delete the inode given the key
 void hash_delete(struct hash_table *table, void *key, int holding, int release) {
-    struct hash_node *node = hash_lookup(table, key, NULL, 0, holding); // not release it
+    struct hash_entry *entry = NULL;
+    struct hash_node *node = hash_lookup(table, key, &entry, 0, holding); // not release it
 
     if (node != NULL) {
-        list_del_reinit(&node->list);
+        list_del_rcu(&node->list);
 
-        if (table->type == INODE_MAP || table->type == FUTEX_MAP) {
-            // if(table->type == FUTEX_MAP) {
-            //     struct futex* fp = (struct futex*)(node->value);
-            //     release(&fp->lock);
-            // }
+        if (table->type == INODE_MAP) {
             kfree(node->value); // !!!
             // printfGreen("hash_delete : node->value, mm ++: %d pages\n", get_free_mem() / 4096);
         }
-        kfree(node);
+        call_rcu(&node->rcu, hash_node_free_rcu);
         // printfGreen("hash_delete : node, mm ++: %d pages\n", get_free_mem() / 4096);
     } else {
         // printfRed("hash delete : this key doesn't existed\n");
     }
     if (release)
-        release(&table->lock);
+        release(&entry->lock);
 }
 
 // destroy hash table
+// nobody else uses the table now
 // free : free this table global ?
 void hash_destroy(struct hash_table *table, int free) {
     // printfGreen("inode destory(after) : free RAM: %d\n", get_free_mem());
-    acquire(&table->lock);
     struct hash_node *node_cur = NULL;
     struct hash_node *node_tmp = NULL;
     for (int i = 0; i < table->size; i++) {
+        acquire(&table->hash_head[i].lock);
         list_for_each_entry_safe(node_cur, node_tmp, &table->hash_head[i].list, list) {
-            if (table->type == INODE_MAP || table->type == FUTEX_MAP)
+            if (table->type == INODE_MAP)
                 kfree(node_cur->value); // !!!
-            kfree(node_cur);
+            kmem_cache_free(hash_node_cachep, node_cur);
         }
+        release(&table->hash_head[i].lock);
     }
-    release(&table->lock);
 
     if (free) {
         kfree(table);
@@ -152,8 +175,6 @@ uint64 hash_val(struct hash_node *node, enum hash_type type) {
     case IPC_IDX_MAP:
         hash_val = node->key_id;
         break;
-    case FUTEX_MAP:
-        hash_val = (uint64)node->key_p;
     case INODE_MAP:
         hash_val = hash_str(node->key_name);
         break;
@@ -172,9 +193,6 @@ uint64 hash_bool(struct hash_node *node, void *key, enum hash_type type) {
     case IPC_IDX_MAP:
         ret = (node->key_id == *(int *)key);
         break;
-    case FUTEX_MAP:
-        ret = ((uint64)node->key_p == (uint64)key);
-        break;
     case INODE_MAP:
         ret = (hash_str(node->key_name) == hash_str((char *)key));
         break;
@@ -192,9 +210,6 @@ void hash_assign(struct hash_node *node, void *key, enum hash_type type) {
     case IPC_IDX_MAP:
         node->key_id = *(int *)key;
         break;
-    case FUTEX_MAP:
-        node->key_p = key;
-        break;
     case INODE_MAP:
         safestrcpy(node->key_name, (char *)key, strlen((char *)key));
         break;
@@ -210,6 +225,7 @@ void hash_table_entry_init(struct hash_table *table) {
     // printfMAGENTA("hash_table_entry_init, mm-- : %d pages\n", get_free_mem() / 4096);
     // printfBlue("inode init(after) : free RAM: %d\n", get_free_mem());
     for (int i = 0; i < table->size; i++) {
+        initlock(&table->hash_head[i].lock, hash_bucket_name[table->type]);
         INIT_LIST_HEAD(&table->hash_head[i].list);
     }
 }
@@ -217,13 +233,14 @@ void hash_table_entry_init(struct hash_table *table) {
 #define MAP_SIZE(map) (sizeof(map) + sizeof(map.hash_head))
 // init all global hash tables
 void hash_tables_init() {
+    if ((hash_node_cachep = kmem_cache_create("hash_node", sizeof(struct hash_node))) == NULL) {
+        panic("hash_tables_init : no memory\n");
+    }
     hash_table_entry_init(&pid_map);
     hash_table_entry_init(&tid_map);
-    hash_table_entry_init(&futex_map);
     Info("========= Information of global hash table ==========\n");
     Info("pid_map size : %d B\n", MAP_SIZE(pid_map));
     Info("tid_map size : %d B\n", MAP_SIZE(tid_map));
-    Info("futex_map size : %d B\n", MAP_SIZE(futex_map));
     Info("hash table, size = %d\n", sizeof(struct hash_table));
     Info("hash node, size = %d\n", sizeof(struct hash_node));
     Info("global hash table init [ok]\n");
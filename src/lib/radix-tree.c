@@ -1,6 +1,8 @@
 #include "lib/radix-tree.h"
 #include "memory/allocator.h"
 #include "memory/buddy.h"
+#include "memory/vmscan.h"
+#include "memory/slab.h"
 #include "atomic/ops.h"
 #include "debug.h"
 
@@ -192,9 +194,17 @@ int radix_tree_tag_get(struct radix_tree_root *root, uint64 index, uint32 tag) {
 }
 
 // ===================allocate====================
+static struct kmem_cache *radix_tree_node_cachep;
+
+void radix_tree_init(void) {
+    if ((radix_tree_node_cachep = kmem_cache_create("radix_tree_node", sizeof(struct radix_tree_node))) == NULL) {
+        panic("radix_tree_init : no memory\n");
+    }
+}
+
 struct radix_tree_node *radix_tree_node_alloc(struct radix_tree_root *root) {
     struct radix_tree_node *ret = NULL;
-    ret = (struct radix_tree_node *)kzalloc(sizeof(struct radix_tree_node)); // kzalloc : with zero function
+    ret = (struct radix_tree_node *)kmem_cache_zalloc(radix_tree_node_cachep);
     // printfGreen("radix_tree_node_alloc, mm: %d pages\n", get_free_mem()/4096);
     if (ret == NULL) {
         panic("radix_tree_node_init : no memory\n");
@@ -486,7 +496,7 @@ void radix_tree_node_free(struct radix_tree_node *node) {
     tag_clear(node, 1, 0);
     node->slots[0] = NULL;
     node->count = 0;
-    kfree(node);
+    kmem_cache_free(radix_tree_node_cachep, node);
 }
 
 // lookup a batch of items
@@ -618,6 +628,7 @@ void radix_tree_free_whole_tree(struct radix_tree_node *node, uint32 max_height,
                 struct page *page = (struct page *)(node->slots[i]);
                 if (page->allocated == 1) { // don't forget it
                     uint64 pa = page_to_pa(page);
+                    lru_cache_del(page); // a page left page cache never goes back to LRU
                     kfree((void *)pa); // must use page_to_pa
                                        // printfBlue("memory : %d PAGES\n", get_free_mem()/4096);
 #ifdef __DEBUG_PAGE_CACHE__
@@ -637,6 +648,6 @@ void radix_tree_free_whole_tree(struct radix_tree_node *node, uint32 max_height,
         }
     }
     // !!!
-    kfree(node);
+    kmem_cache_free(radix_tree_node_cachep, node);
     // printfBlue("memory : %d PAGES\n", get_free_mem()/4096);
 }
@@ -0,0 +1,252 @@
+#include "lib/rbtree.h"
+
+// a NULL child is a black leaf
+
+static inline int rb_is_black(struct rb_node *node) {
+    return node == NULL || node->rb_color == RB_BLACK;
+}
+
+// make new take the place of old under parent
+static inline void rb_change_child(struct rb_node *old, struct rb_node *new, struct rb_node *parent,
+                                   struct rb_root *root) {
+    if (parent == NULL) {
+        root->rb_node = new;
+    } else if (parent->rb_left == old) {
+        parent->rb_left = new;
+    } else {
+        parent->rb_right = new;
+    }
+}
+
+static void rb_rotate_left(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *right = node->rb_right;
+    struct rb_node *parent = node->rb_parent;
+
+    if ((node->rb_right = right->rb_left) != NULL) {
+        right->rb_left->rb_parent = node;
+    }
+    right->rb_left = node;
+    right->rb_parent = parent;
+    rb_change_child(node, right, parent, root);
+    node->rb_parent = right;
+}
+
+static void rb_rotate_right(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *left = node->rb_left;
+    struct rb_node *parent = node->rb_parent;
+
+    if ((node->rb_left = left->rb_right) != NULL) {
+        left->rb_right->rb_parent = node;
+    }
+    left->rb_right = node;
+    left->rb_parent = parent;
+    rb_change_child(node, left, parent, root);
+    node->rb_parent = left;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *parent, *gparent, *uncle;
+
+    while ((parent = node->rb_parent) != NULL && parent->rb_color == RB_RED) {
+        // a red node is never the root, so gparent exists
+        gparent = parent->rb_parent;
+        if (parent == gparent->rb_left) {
+            uncle = gparent->rb_right;
+            if (!rb_is_black(uncle)) {
+                uncle->rb_color = RB_BLACK;
+                parent->rb_color = RB_BLACK;
+                gparent->rb_color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->rb_right) {
+                rb_rotate_left(parent, root);
+                node = parent;
+                parent = node->rb_parent;
+            }
+            parent->rb_color = RB_BLACK;
+            gparent->rb_color = RB_RED;
+            rb_rotate_right(gparent, root);
+        } else {
+            uncle = gparent->rb_left;
+            if (!rb_is_black(uncle)) {
+                uncle->rb_color = RB_BLACK;
+                parent->rb_color = RB_BLACK;
+                gparent->rb_color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->rb_left) {
+                rb_rotate_right(parent, root);
+                node = parent;
+                parent = node->rb_parent;
+            }
+            parent->rb_color = RB_BLACK;
+            gparent->rb_color = RB_RED;
+            rb_rotate_left(gparent, root);
+        }
+    }
+    root->rb_node->rb_color = RB_BLACK;
+}
+
+// a black node was removed above node (maybe NULL), whose parent is parent
+static void rb_erase_color(struct rb_node *node, struct rb_node *parent, struct rb_root *root) {
+    struct rb_node *sibling;
+
+    while (rb_is_black(node) && node != root->rb_node) {
+        if (parent->rb_left == node) {
+            sibling = parent->rb_right;
+            if (sibling->rb_color == RB_RED) {
+                sibling->rb_color = RB_BLACK;
+                parent->rb_color = RB_RED;
+                rb_rotate_left(parent, root);
+                sibling = parent->rb_right;
+            }
+            if (rb_is_black(sibling->rb_left) && rb_is_black(sibling->rb_right)) {
+                sibling->rb_color = RB_RED;
+                node = parent;
+                parent = node->rb_parent;
+                continue;
+            }
+            if (rb_is_black(sibling->rb_right)) {
+                sibling->rb_left->rb_color = RB_BLACK;
+                sibling->rb_color = RB_RED;
+                rb_rotate_right(sibling, root);
+                sibling = parent->rb_right;
+            }
+            sibling->rb_color = parent->rb_color;
+            parent->rb_color = RB_BLACK;
+            sibling->rb_right->rb_color = RB_BLACK;
+            rb_rotate_left(parent, root);
+        } else {
+            sibling = parent->rb_left;
+            if (sibling->rb_color == RB_RED) {
+                sibling->rb_color = RB_BLACK;
+                parent->rb_color = RB_RED;
+                rb_rotate_right(parent, root);
+                sibling = parent->rb_left;
+            }
+            if (rb_is_black(sibling->rb_left) && rb_is_black(sibling->rb_right)) {
+                sibling->rb_color = RB_RED;
+                node = parent;
+                parent = node->rb_parent;
+                continue;
+            }
+            if (rb_is_black(sibling->rb_left)) {
+                sibling->rb_right->rb_color = RB_BLACK;
+                sibling->rb_color = RB_RED;
+                rb_rotate_left(sibling, root);
+                sibling = parent->rb_left;
+            }
+            sibling->rb_color = parent->rb_color;
+            parent->rb_color = RB_BLACK;
+            sibling->rb_left->rb_color = RB_BLACK;
+            rb_rotate_right(parent, root);
+        }
+        node = root->rb_node;
+        break;
+    }
+    if (node != NULL) {
+        node->rb_color = RB_BLACK;
+    }
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *child, *parent, *succ;
+    int color;
+
+    if (node->rb_left != NULL && node->rb_right != NULL) {
+        // the successor has no left child, it takes the place of node
+        succ = node->rb_right;
+        while (succ->rb_left != NULL) {
+            succ = succ->rb_left;
+        }
+        child = succ->rb_right;
+        parent = succ->rb_parent;
+        color = succ->rb_color;
+
+        if (parent == node) {
+            parent = succ;
+        } else {
+            if (child != NULL) {
+                child->rb_parent = parent;
+            }
+            parent->rb_left = child;
+            succ->rb_right = node->rb_right;
+            node->rb_right->rb_parent = succ;
+        }
+        succ->rb_parent = node->rb_parent;
+        succ->rb_color = node->rb_color;
+        succ->rb_left = node->rb_left;
+        node->rb_left->rb_parent = succ;
+        rb_change_child(node, succ, node->rb_parent, root);
+    } else {
+        child = node->rb_left != NULL ? node->rb_left : node->rb_right;
+        parent = node->rb_parent;
+        color = node->rb_color;
+
+        if (child != NULL) {
+            child->rb_parent = parent;
+        }
+        rb_change_child(node, child, parent, root);
+    }
+
+    if (color == RB_BLACK) {
+        rb_erase_color(child, parent, root);
+    }
+}
+
+struct rb_node *rb_first(const struct rb_root *root) {
+    struct rb_node *node = root->rb_node;
+    if (node == NULL) {
+        return NULL;
+    }
+    while (node->rb_left != NULL) {
+        node = node->rb_left;
+    }
+    return node;
+}
+
+struct rb_node *rb_last(const struct rb_root *root) {
+    struct rb_node *node = root->rb_node;
+    if (node == NULL) {
+        return NULL;
+    }
+    while (node->rb_right != NULL) {
+        node = node->rb_right;
+    }
+    return node;
+}
+
+struct rb_node *rb_next(const struct rb_node *node) {
+    struct rb_node *parent;
+
+    if (node->rb_right != NULL) {
+        node = node->rb_right;
+        while (node->rb_left != NULL) {
+            node = node->rb_left;
+        }
+        return (struct rb_node *)node;
+    }
+    // go up until we come from a left child
+    while ((parent = node->rb_parent) != NULL && node == parent->rb_right) {
+        node = parent;
+    }
+    return parent;
+}
+
+struct rb_node *rb_prev(const struct rb_node *node) {
+    struct rb_node *parent;
+
+    if (node->rb_left != NULL) {
+        node = node->rb_left;
+        while (node->rb_right != NULL) {
+            node = node->rb_right;
+        }
+        return (struct rb_node *)node;
+    }
+    while ((parent = node->rb_parent) != NULL && node == parent->rb_left) {
+        node = parent;
+    }
+    return parent;
+}
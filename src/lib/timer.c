@@ -4,23 +4,164 @@
 #include "memory/memlayout.h"
 #include "atomic/cond.h"
 #include "atomic/ops.h"
+#include "atomic/rcu.h"
+#include "kernel/cpu.h"
+#include "lib/queue.h"
+#include "param.h"
 #include "debug.h"
 
-struct timer_entry timer_head;
-struct spinlock tickslock;
+// timers live in a per-cpu hierarchical timing wheel (like linux), add and delete are O(1).
+// a timer is never cascaded, it is put into the level whose granularity fits its timeout
+// and fires at the end of that slot, at most 1/8 of its timeout late.
+// an idle cpu stops the periodic clock interrupt and programs the next timer instead.
+// hrtimers are kept in a sorted list, the timer of the cpu is programmed for the first one.
+
+struct timer_base timer_bases[NCPU];
 struct cond cond_ticks;
 atomic_t ticks;
 
+#define LVL_SHIFT(lvl) ((lvl)*LVL_CLK_SHIFT)
+#define LVL_GRAN(lvl) (1UL << LVL_SHIFT(lvl))
+#define LVL_OFFS(lvl) ((lvl)*LVL_SIZE)
+#define LVL_MASK (LVL_SIZE - 1)
+// timeouts of level lvl are below LVL_START(lvl + 1), i.e. LVL_SIZE - 1 of its slots,
+// so the slot rounded up never wraps around the level
+#define LVL_START(lvl) ((uint64)(LVL_SIZE - 1) << (((lvl)-1) * LVL_CLK_SHIFT))
+#define WHEEL_TIMEOUT_MAX (LVL_START(LVL_DEPTH) - 1)
+
+#define NO_EXPIRY UINT64_MAX
+
+static void wheel_index_check(void);
+
+// rounded up, an interrupt never comes before ns
+static inline uint64 ns_to_time(uint64 ns) {
+    return (ns + 999) / 1000 * FREQUENCY / 1000000 + 1;
+}
+
 void timer_init() {
     atomic_set(&ticks, 0);
     cond_init(&cond_ticks, "cond_ticks");
-    timer_entry_init(&timer_head, "timer_entry");
+    for (int i = 0; i < NCPU; i++) {
+        struct timer_base *base = &timer_bases[i];
+        initlock(&base->lock, "timer_base");
+        base->clk = TIME2NS(rdtime()) / TIMER_GRAN_NS;
+        for (int j = 0; j < WHEEL_SIZE; j++) {
+            INIT_LIST_HEAD(&base->vectors[j]);
+        }
+        for (int j = 0; j < LVL_DEPTH; j++) {
+            base->pending[j] = 0;
+        }
+        base->running_timer = NULL;
+        INIT_LIST_HEAD(&base->hrtimers);
+        base->running_hrtimer = NULL;
+        base->next_tick = 0;
+        base->tick_stopped = 0;
+        base->nr_expired = 0;
+        base->nr_hrtimer_expired = 0;
+    }
+    wheel_index_check();
     Info("timer init [ok]\n");
 }
 
-void timer_entry_init(struct timer_entry *t_entry, char *name) {
-    initlock(&t_entry->lock, name);
-    INIT_LIST_HEAD(&t_entry->entry);
+// the slot of a timer expiring at jiffy expires, holding base->lock
+static int calc_wheel_index(struct timer_base *base, uint64 expires) {
+    uint64 delta;
+    int lvl;
+
+    if (expires < base->clk) {
+        expires = base->clk;
+    }
+    delta = expires - base->clk;
+    if (delta < LVL_SIZE) {
+        return expires & LVL_MASK;
+    }
+    if (delta > WHEEL_TIMEOUT_MAX) {
+        // fires early, then it is queued again, see run_local_timers
+        delta = WHEEL_TIMEOUT_MAX;
+        expires = base->clk + delta;
+    }
+    for (lvl = 1; lvl < LVL_DEPTH - 1; lvl++) {
+        if (delta < LVL_START(lvl + 1)) {
+            break;
+        }
+    }
+    // round up, a timer never fires before its time
+    expires = (expires + LVL_GRAN(lvl) - 1) >> LVL_SHIFT(lvl);
+    return LVL_OFFS(lvl) + (expires & LVL_MASK);
+}
+
+// the jiffy at which slot idx is processed, the first one at or after clk (see run_local_timers)
+static uint64 wheel_slot_expiry(uint64 clk, int idx) {
+    int lvl = idx / LVL_SIZE;
+    uint64 lvl_clk = (clk + LVL_GRAN(lvl) - 1) >> LVL_SHIFT(lvl);
+    return (lvl_clk + ((idx - lvl_clk) & LVL_MASK)) << LVL_SHIFT(lvl);
+}
+
+// a timer at each level boundary must fire at its time rounded up to the granularity of its level
+static void wheel_index_check(void) {
+    struct timer_base base;
+    uint64 clks[] = {0, 1, 12345, (1UL << 40) - 1};
+
+    for (int i = 0; i < NELEM(clks); i++) {
+        base.clk = clks[i];
+        for (int lvl = 1; lvl <= LVL_DEPTH; lvl++) {
+            uint64 deltas[] = {LVL_START(lvl) - 1, LVL_START(lvl), LVL_START(lvl) + 1};
+            for (int j = 0; j < NELEM(deltas); j++) {
+                uint64 expires = base.clk + MIN(deltas[j], WHEEL_TIMEOUT_MAX);
+                int idx = calc_wheel_index(&base, expires);
+                uint64 gran = LVL_GRAN(idx / LVL_SIZE);
+                if (wheel_slot_expiry(base.clk, idx) != (expires + gran - 1) / gran * gran) {
+                    printf("clk %p, delta %p, slot %d\n", base.clk, deltas[j], idx);
+                    panic("timer wheel: wrong slot");
+                }
+            }
+        }
+    }
+}
+
+// holding base->lock
+static void enqueue_timer(struct timer_base *base, struct timer_list *timer) {
+    int idx = calc_wheel_index(base, timer->expires_end / TIMER_GRAN_NS);
+    list_add_tail(&timer->list, &base->vectors[idx]);
+    base->pending[idx / LVL_SIZE] |= 1UL << (idx & LVL_MASK);
+    timer->idx = idx;
+    timer->base = base;
+}
+
+// holding base->lock
+static void detach_timer(struct timer_base *base, struct timer_list *timer) {
+    int idx = timer->idx;
+    list_del_reinit(&timer->list);
+    if (list_empty(&base->vectors[idx])) {
+        base->pending[idx / LVL_SIZE] &= ~(1UL << (idx & LVL_MASK));
+    }
+}
+
+// distance from pos to the next set bit (cyclic), -1 if none
+static int next_pending_bucket(uint64 pending, int pos) {
+    if (pending == 0) {
+        return -1;
+    }
+    for (int d = 0; d < LVL_SIZE; d++) {
+        if (pending & (1UL << ((pos + d) & LVL_MASK))) {
+            return d;
+        }
+    }
+    return -1;
+}
+
+// the first jiffy at or after base->clk which has a slot to process, holding base->lock
+static uint64 next_expiry(struct timer_base *base) {
+    uint64 next = NO_EXPIRY;
+    for (int lvl = 0; lvl < LVL_DEPTH; lvl++) {
+        // slot p of the level is processed at jiffy p << LVL_SHIFT(lvl)
+        uint64 lvl_clk = (base->clk + LVL_GRAN(lvl) - 1) >> LVL_SHIFT(lvl);
+        int d = next_pending_bucket(base->pending[lvl], lvl_clk & LVL_MASK);
+        if (d >= 0) {
+            next = MIN(next, (lvl_clk + d) << LVL_SHIFT(lvl));
+        }
+    }
+    return next;
 }
 
 // expires : ns!!!
@@ -34,57 +175,293 @@ void add_timer_atomic(struct timer_list *timer, uint64 expires, timer_expire fun
         return;
     }
 
-    acquire(&timer_head.lock);
-    list_add_tail(&timer->list, &timer_head.entry);
-    release(&timer_head.lock);
+    push_off();
+    struct timer_base *base = &timer_bases[cpuid()];
+    acquire(&base->lock);
+    enqueue_timer(base, timer);
+    release(&base->lock);
+    pop_off();
 }
 
+// a periodic timer may be running on another cpu, wait for it like del_timer_sync
 void delete_timer_atomic(struct timer_list *timer) {
-    acquire(&timer_head.lock);
-    list_del_reinit(&timer->list);
-    release(&timer_head.lock);
-}
-
-void timer_list_decrease_atomic(struct timer_entry *head) {
-    struct timer_list *timer_cur;
-    struct timer_list *timer_tmp;
-
-    acquire(&head->lock);
-    list_for_each_entry_safe(timer_cur, timer_tmp, &head->entry, list) {
-        // special for pselect6
-        // if (timer_cur->cycle == -1) {
-        //     // wakeup every clock interrupt, don't care expire
-        //     timer_cur->over = TIME_OUT(timer_cur);
-        //     timer_cur->function(timer_cur->data);
-        //     list_del_reinit(&timer_cur->list);
-        //     continue;
-        // }
-        // uint64 time_now_ns = TIME2NS(rdtime());
-        // if (time_now_ns > timer_cur->expires_end) {
-        if (TIME_OUT(timer_cur)) {
-            timer_cur->function(timer_cur->data);
-            if (timer_cur->count == -1) {
-                // if(timer_cur->interval)
-                if (timer_cur->interval == -1)
-                    // special for pdflush
-                    timer_cur->expires_end = timer_cur->expires + TIME2NS(rdtime());
-                else
-                    // special for setitimer
-                    timer_cur->expires_end = timer_cur->interval + TIME2NS(rdtime());
-            } else {
-                list_del_reinit(&timer_cur->list);
-                timer_cur->expires_end = 0;
-                timer_cur->expires = 0;
+    struct timer_base *base;
+
+    for (;;) {
+        if ((base = timer->base) == NULL) {
+            return;
+        }
+        acquire(&base->lock);
+        if (timer->base == base && base->running_timer != timer) {
+            break;
+        }
+        release(&base->lock);
+    }
+    if (!list_empty(&timer->list)) {
+        detach_timer(base, timer);
+    }
+    release(&base->lock);
+}
+
+// run the timers in expired, holding base->lock (released while running a function)
+static void expire_timers(struct timer_base *base, struct list_head *expired, uint64 now) {
+    while (!list_empty(expired)) {
+        struct timer_list *timer = list_first_entry(expired, struct timer_list, list);
+        list_del_reinit(&timer->list);
+        if (now < timer->expires_end) {
+            // rounded down by the last level, not yet
+            enqueue_timer(base, timer);
+            continue;
+        }
+
+        timer_expire function = timer->function;
+        void *data = timer->data;
+        base->nr_expired++;
+        if (timer->count != -1) {
+            // one-shot, the timer may be gone as soon as the function returns (see thread_sched)
+            timer->expires_end = 0;
+            timer->expires = 0;
+            timer->base = NULL;
+            release(&base->lock);
+            function(data);
+            acquire(&base->lock);
+            continue;
+        }
+
+        base->running_timer = timer;
+        release(&base->lock);
+        function(data);
+        acquire(&base->lock);
+        base->running_timer = NULL;
+        if (timer->interval == -1)
+            // special for pdflush
+            timer->expires_end = timer->expires + now;
+        else
+            // special for setitimer
+            timer->expires_end = timer->interval + now;
+        if (list_empty(&timer->list)) {
+            enqueue_timer(base, timer);
+        }
+    }
+}
+
+// process the wheel of this cpu up to now, interrupt must be off
+void run_local_timers(void) {
+    struct timer_base *base = &timer_bases[cpuid()];
+    struct list_head expired;
+    uint64 now = TIME2NS(rdtime());
+    uint64 now_j = now / TIMER_GRAN_NS;
+
+    INIT_LIST_HEAD(&expired);
+    acquire(&base->lock);
+    while (base->clk <= now_j) {
+        uint64 next = next_expiry(base);
+        if (next > now_j) {
+            // nothing in between, skip the empty slots
+            base->clk = now_j + 1;
+            break;
+        }
+        base->clk = MAX(base->clk, next);
+        for (int lvl = 0; lvl < LVL_DEPTH; lvl++) {
+            if (base->clk & (LVL_GRAN(lvl) - 1)) {
+                break;
+            }
+            int idx = LVL_OFFS(lvl) + ((base->clk >> LVL_SHIFT(lvl)) & LVL_MASK);
+            if (base->pending[lvl] & (1UL << (idx & LVL_MASK))) {
+                list_splice(&base->vectors[idx], &expired);
+                INIT_LIST_HEAD(&base->vectors[idx]);
+                base->pending[lvl] &= ~(1UL << (idx & LVL_MASK));
             }
         }
+        base->clk++;
+        expire_timers(base, &expired, now);
+    }
+    release(&base->lock);
+}
+
+void hrtimer_init(struct hrtimer *timer, timer_expire function, void *data) {
+    INIT_LIST_HEAD(&timer->list);
+    timer->expires = 0;
+    timer->function = function;
+    timer->data = data;
+    timer->base = NULL;
+}
+
+// program the timer of this cpu for its next event, interrupt must be off
+static void clockevent_program(struct timer_base *base) {
+    uint64 next = base->next_tick;
+
+    acquire(&base->lock);
+    if (base->tick_stopped) {
+        uint64 next_j = next_expiry(base);
+        next = (next_j == NO_EXPIRY) ? NO_EXPIRY : ns_to_time(next_j * TIMER_GRAN_NS);
+    }
+    if (!list_empty(&base->hrtimers)) {
+        struct hrtimer *first = list_first_entry(&base->hrtimers, struct hrtimer, list);
+        next = MIN(next, ns_to_time(first->expires));
+    }
+    release(&base->lock);
+    sbi_legacy_set_timer(next);
+}
+
+// expires : ns, absolute
+void hrtimer_start(struct hrtimer *timer, uint64 expires) {
+    struct hrtimer *pos;
+
+    hrtimer_cancel(timer);
+    push_off();
+    struct timer_base *base = &timer_bases[cpuid()];
+    acquire(&base->lock);
+    timer->expires = expires;
+    timer->base = base;
+    list_for_each_entry(pos, &base->hrtimers, list) {
+        if (pos->expires > expires) {
+            break;
+        }
+    }
+    list_add_tail(&timer->list, &pos->list);
+    int first = (base->hrtimers.next == &timer->list);
+    release(&base->lock);
+    if (first) {
+        clockevent_program(base);
+    }
+    pop_off();
+}
+
+// an expired timer is on no base, look for its function on every cpu
+static void hrtimer_wait_running(struct hrtimer *timer) {
+    for (int i = 0; i < NCPU; i++) {
+        struct timer_base *base = &timer_bases[i];
+        acquire(&base->lock);
+        while (base->running_hrtimer == timer) {
+            release(&base->lock);
+            acquire(&base->lock);
+        }
+        release(&base->lock);
+    }
+}
+
+// return 1 if it was pending, 0 if it has expired.
+// wait for its function if it is running, the caller must not hold a lock the function takes
+int hrtimer_cancel(struct hrtimer *timer) {
+    struct timer_base *base;
+
+    for (;;) {
+        if ((base = timer->base) == NULL) {
+            hrtimer_wait_running(timer);
+            return 0;
+        }
+        acquire(&base->lock);
+        if (timer->base == base) {
+            break;
+        }
+        release(&base->lock);
     }
-    release(&head->lock);
+    list_del_reinit(&timer->list);
+    timer->base = NULL;
+    release(&base->lock);
+    return 1;
+}
+
+// interrupt must be off
+static void hrtimer_run_queues(struct timer_base *base) {
+    uint64 now = TIME2NS(rdtime());
+
+    acquire(&base->lock);
+    while (!list_empty(&base->hrtimers)) {
+        struct hrtimer *timer = list_first_entry(&base->hrtimers, struct hrtimer, list);
+        if (timer->expires > now) {
+            break;
+        }
+        // the timer may be gone as soon as the function returns
+        timer_expire function = timer->function;
+        void *data = timer->data;
+        list_del_reinit(&timer->list);
+        timer->base = NULL;
+        base->running_hrtimer = timer; // only compared, see hrtimer_cancel
+        base->nr_hrtimer_expired++;
+        release(&base->lock);
+        function(data);
+        acquire(&base->lock);
+        base->running_hrtimer = NULL;
+    }
+    release(&base->lock);
+}
+
+// start the periodic clock interrupt of this cpu
+void timer_init_hart(void) {
+    push_off();
+    struct timer_base *base = &timer_bases[cpuid()];
+    base->next_tick = rdtime() + CLINT_INTERVAL;
+    clockevent_program(base);
+    pop_off();
+}
+
+// clock interrupt of this cpu, return 1 if it is a periodic tick
+int timer_interrupt(void) {
+    int cpu = cpuid();
+    struct timer_base *base = &timer_bases[cpu];
+    uint64 now = rdtime();
+    int tick = 0;
+
+    if (!base->tick_stopped && now >= base->next_tick) {
+        tick = 1;
+        if (cpu == TICK_CPU) {
+            clockintr();
+        }
+        // every cpu runs the timers it added
+        run_local_timers();
+        rcu_check_callbacks();
+        base->next_tick = now + CLINT_INTERVAL;
+    }
+    hrtimer_run_queues(base);
+    clockevent_program(base);
+    return tick;
+}
+
+// the tick cpu keeps ticking for threads waiting on cond_ticks
+static int tick_needed(int cpu) {
+    return cpu == TICK_CPU && !Queue_isempty_atomic(&cond_ticks.waiting_queue);
+}
+
+// called by an idle cpu with interrupt off before wfi
+void tick_nohz_idle_enter(void) {
+    int cpu = cpuid();
+    struct timer_base *base = &timer_bases[cpu];
+
+    if (tick_needed(cpu)) {
+        return;
+    }
+    base->tick_stopped = 1;
+    clockevent_program(base);
+}
+
+// called by an idle cpu with interrupt off after wfi
+void tick_nohz_idle_exit(void) {
+    struct timer_base *base = &timer_bases[cpuid()];
+    if (!base->tick_stopped) {
+        return;
+    }
+    base->tick_stopped = 0;
+    // programming the timer clears a pending timer interrupt, run the timers it was for
+    run_local_timers();
+    hrtimer_run_queues(base);
+    base->next_tick = rdtime() + CLINT_INTERVAL;
+    clockevent_program(base);
 }
 
 void clockintr() {
     // static int ctr = 0;
     // printf("hit, clockintr %d, %d\n",++ctr, CLINT_INTERVAL);
-    atomic_inc_return(&ticks); // 或许可以不用原子操作
-    timer_list_decrease_atomic(&timer_head);
+    // the tick cpu may skip clock interrupts when it is idle, count ticks by time
+    atomic_set(&ticks, rdtime() / CLINT_INTERVAL);
     cond_signal(&cond_ticks);
-}
\ No newline at end of file
+}
+
+// debug, statistics of timer wheels (racy, but it is enough)
+void timer_stat_print(void) {
+    for (int i = 0; i < NCPU; i++) {
+        printf("cpu %d : %ld timers expired, %ld hrtimers expired, tick %s\n", i, timer_bases[i].nr_expired,
+               timer_bases[i].nr_hrtimer_expired, timer_bases[i].tick_stopped ? "stopped" : "running");
+    }
+}
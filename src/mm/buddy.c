@@ -6,14 +6,12 @@
 #include "debug.h"
 #include "atomic/ops.h"
 
-extern atomic_t pages_cnt;
-extern atomic_t recycling;
-
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 uint64 npages;
 
 struct phys_mem_pool mempools[NCPU];
+struct per_cpu_pages pcplists[NCPU];
 static struct page *merge_page(struct phys_mem_pool *pool, struct page *page);
 static struct page *split_page(struct phys_mem_pool *pool, uint64 order, struct page *page);
 void init_buddy(struct phys_mem_pool *pool, struct page *start_page, uint64 start_addr, uint64 page_num);
@@ -48,14 +46,16 @@ void mm_init() {
     Info("=========Information of RAM==========\n");
     Info("pagemeta_start: %x\n", pagemeta_start);
     Info("NPAGES: %d\n", NPAGES);
-    atomic_set(&pages_cnt, NPAGES);
-    atomic_set(&recycling, 0);
     Info("PAGES PER CPU: %d\n", PAGES_PER_CPU);
     for (int i = 0; i < NCPU; i++) {
         init_buddy(&mempools[i],
                    (struct page *)PGROUNDUP((uint64)end) + i * PAGES_PER_CPU,
                    (uint64)START_MEM + i * PAGES_PER_CPU * PGSIZE,
                    PAGES_PER_CPU);
+        for (int order = 0; order <= PCP_MAX_ORDER; order++) {
+            INIT_LIST_HEAD(&pcplists[i].lists[order]);
+            pcplists[i].count[order] = 0;
+        }
         //PAGES_PER_CPU = (PHYSTOP-START_MEM) / PGSIZE / NCPU
         //PAGES_PER_CPU = (0x80000000L + 1024 * 1024 * 128 - 0x82800000) / 4096 / 2
         //              = (0x88000000-0x82800000) / 4096 / 2
@@ -88,6 +88,9 @@ void init_buddy(struct phys_mem_pool *pool, struct page *start_page, uint64 star
         INIT_LIST_HEAD(&pool->freelists[order].lists);
         pool->freelists[order].num = 0;
     }
+    pool->nr_free = 0;
+    atomic_set(&pool->steal_cnt, 0);
+    atomic_set(&pool->steal_pages, 0);
 
     /* Clear the page_metadata area. */
     memset(pool->page_metadata, 0, page_num * sizeof(struct page));
@@ -117,15 +120,11 @@ void init_buddy(struct phys_mem_pool *pool, struct page *start_page, uint64 star
     return;
 }
 
-struct page *buddy_get_pages(struct phys_mem_pool *pool, uint64 order) {
-    // kalloc() will call push_off, so use pop_off here to prevent long time interrupt off
-    pop_off();
-    // printf("memory %d PAGES, %d Bytes\n", get_free_mem()/4096, get_free_mem());
-    ASSERT(order <= BUDDY_MAX_ORDER);
+// must hold pool->lock
+static struct page *__buddy_get_pages(struct phys_mem_pool *pool, uint64 order) {
     struct page *page = NULL;
     struct list_head *lists;
 
-    acquire(&pool->lock);
     for (int i = order; i <= BUDDY_MAX_ORDER; i++) {
         lists = &pool->freelists[i].lists;
         if (!list_empty(lists)) {
@@ -138,7 +137,6 @@ struct page *buddy_get_pages(struct phys_mem_pool *pool, uint64 order) {
 
     if (page == NULL) {
         // Log("there is no 2^%d mem!", order);
-        release(&pool->lock);
         return NULL;
     }
 
@@ -147,10 +145,38 @@ struct page *buddy_get_pages(struct phys_mem_pool *pool, uint64 order) {
     }
     page->allocated = 1;
     ASSERT(page->order == order);
+    pool->nr_free -= 1UL << order;
+    return page;
+}
+
+struct page *buddy_get_pages(struct phys_mem_pool *pool, uint64 order) {
+    // printf("memory %d PAGES, %d Bytes\n", get_free_mem()/4096, get_free_mem());
+    ASSERT(order <= BUDDY_MAX_ORDER);
+
+    acquire(&pool->lock);
+    struct page *page = __buddy_get_pages(pool, order);
     release(&pool->lock);
     return page;
 }
 
+// get at most n blocks of 2^order pages with one acquire of pool->lock, add them to list
+// return the number of blocks we get
+int buddy_get_pages_bulk(struct phys_mem_pool *pool, uint64 order, int n, struct list_head *list) {
+    ASSERT(order <= BUDDY_MAX_ORDER);
+    int cnt = 0;
+
+    acquire(&pool->lock);
+    for (; cnt < n; cnt++) {
+        struct page *page = __buddy_get_pages(pool, order);
+        if (page == NULL) {
+            break;
+        }
+        list_add_tail(&page->list, list);
+    }
+    release(&pool->lock);
+    return cnt;
+}
+
 static struct page *split_page(struct phys_mem_pool *pool, uint64 order, struct page *page) {
     ASSERT(page->order > order);
 
@@ -166,9 +192,10 @@ static struct page *split_page(struct phys_mem_pool *pool, uint64 order, struct
     return page;
 }
 
-void buddy_free_pages(struct phys_mem_pool *pool, struct page *page) {
-    acquire(&pool->lock);
+// must hold pool->lock
+static void __buddy_free_pages(struct phys_mem_pool *pool, struct page *page) {
     page->allocated = 0;
+    pool->nr_free += 1UL << page->order;
 
     if (page->order < BUDDY_MAX_ORDER) {
         page = merge_page(pool, page);
@@ -177,9 +204,48 @@ void buddy_free_pages(struct phys_mem_pool *pool, struct page *page) {
     struct list_head *list = &pool->freelists[page->order].lists;
     list_add(&page->list, list);
     pool->freelists[page->order].num++;
+}
+
+void buddy_free_pages(struct phys_mem_pool *pool, struct page *page) {
+    acquire(&pool->lock);
+    __buddy_free_pages(pool, page);
     release(&pool->lock);
 }
 
+// free all pages on list (they all belong to pool) with one acquire of pool->lock
+void buddy_free_pages_bulk(struct phys_mem_pool *pool, struct list_head *list) {
+    struct page *page, *tmp;
+
+    acquire(&pool->lock);
+    list_for_each_entry_safe(page, tmp, list, list) {
+        list_del(&page->list);
+        __buddy_free_pages(pool, page);
+    }
+    release(&pool->lock);
+}
+
+// split an allocated block of 2^order pages into 2^order allocated pages
+// every page gets the refcnt of the block, and can be freed by itself then
+void split_pages(struct page *page) {
+    int nr = 1 << page->order;
+    int refcnt = atomic_read(&page->refcnt);
+    for (int i = 0; i < nr; i++) {
+        page[i].order = 0;
+        page[i].allocated = 1;
+        page[i].flags = 0;
+        atomic_set(&page[i].refcnt, refcnt);
+    }
+}
+
+// number of free blocks of 2^order pages or larger in pool (racy)
+int buddy_free_blocks(struct phys_mem_pool *pool, uint64 order) {
+    int cnt = 0;
+    for (int i = order; i <= BUDDY_MAX_ORDER; i++) {
+        cnt += pool->freelists[i].num;
+    }
+    return cnt;
+}
+
 static struct page *merge_page(struct phys_mem_pool *pool, struct page *page) {
     if (page->order == BUDDY_MAX_ORDER) {
         return page;
@@ -212,16 +278,34 @@ static struct page *merge_page(struct phys_mem_pool *pool, struct page *page) {
     }
 }
 
+// free pages of a pool, including those cached in the pcplist of its cpu
+// summed without lock, so it is racy, but it is enough for watermarks
+static uint64 pool_free_pages(int cpu) {
+    uint64 nr = mempools[cpu].nr_free;
+    for (int i = 0; i <= PCP_MAX_ORDER; i++) {
+        nr += (uint64)pcplists[cpu].count[i] << i;
+    }
+    return nr;
+}
+
+uint64 nr_free_pages(void) {
+    uint64 nr = 0;
+    for (int cpu = 0; cpu < NCPU; cpu++) {
+        nr += pool_free_pages(cpu);
+    }
+    return nr;
+}
+
 uint64 get_free_mem() {
-    uint64 memsize = 0;
+    return nr_free_pages() * PGSIZE;
+}
+
+// debug, statistics of every pool (racy, but it is enough)
+void mempool_stat_print(void) {
     for (int cpu = 0; cpu < NCPU; cpu++) {
         struct phys_mem_pool *pool = &mempools[cpu];
-        acquire(&pool->lock);
-        for (int i = 0; i <= BUDDY_MAX_ORDER; i++) {
-            // Log("%d order chunks num: %d", i, pool->freelists[i].num);
-            memsize += pool->freelists[i].num * PGSIZE * (1 << i);
-        }
-        release(&pool->lock);
+        int cached = pool_free_pages(cpu) - pool->nr_free;
+        printf("mempool %d : %ld free pages (%d in pcplist), stolen %d times, %d pages\n",
+               cpu, pool_free_pages(cpu), cached, atomic_read(&pool->steal_cnt), atomic_read(&pool->steal_pages));
     }
-    return memsize;
 }
\ No newline at end of file
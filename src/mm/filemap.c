@@ -7,6 +7,18 @@
 #include "atomic/ops.h"
 #include "debug.h"
 #include "kernel/trap.h"
+#include "memory/vmscan.h"
+
+// readers wait here for pages under read (PG_locked)
+static struct {
+    struct spinlock lock;
+    struct cond wait;
+} page_read_wait;
+
+void filemap_init(void) {
+    initlock(&page_read_wait.lock, "page_read_wait");
+    cond_init(&page_read_wait.wait, "page_read_wait");
+}
 
 // add
 int add_to_page_cache_atomic(struct page *page, struct address_space *mapping, uint64 index) {
@@ -19,6 +31,7 @@ int add_to_page_cache_atomic(struct page *page, struct address_space *mapping, u
         // if(mapping->host->fat32_i.fname[0]=='b')
         // printfRed("index : %x\n", index);
         mapping->nrpages++;
+        lru_cache_add(page);
     } else {
         panic("add_to_page_cache : error\n");
     }
@@ -60,6 +73,128 @@ uint64 max_sane_readahead(uint64 nr, uint64 read_ahead, uint64 tot_nr) {
     // don't forget /PGSIZE
 }
 
+// wait until the read of page is done
+void wait_on_page_read(struct address_space *mapping, struct page *page) {
+    if (!test_page_flags(page, PG_locked)) {
+        return;
+    }
+    mapping->ra_waits++;
+    acquire(&page_read_wait.lock);
+    while (test_page_flags(page, PG_locked)) {
+        cond_wait(&page_read_wait.wait, &page_read_wait.lock);
+    }
+    release(&page_read_wait.lock);
+}
+
+// the read of pages is done, maybe in interrupt
+void end_pages_read(struct Page_entry *p_entry) {
+    struct Page_item *p_cur = NULL;
+    acquire(&page_read_wait.lock);
+    list_for_each_entry(p_cur, &p_entry->entry, list) {
+        clear_page_flags(pa_to_page(p_cur->pa), PG_locked);
+    }
+    cond_broadcast(&page_read_wait.wait);
+    release(&page_read_wait.lock);
+}
+
+static inline uint64 ra_next_size(uint64 size) {
+    return MIN(MAX(size * 2, READ_AHEAD_PAGE_INIT_CNT), READ_AHEAD_PAGE_MAX_CNT);
+}
+
+// page of index is not in page cache
+// req : bytes the reader wants from the start of page index
+static void page_cache_sync_readahead(struct address_space *mapping, uint64 index, uint64 req) {
+    struct inode *ip = mapping->host;
+    uint64 rest = ip->i_size - (index << PGSHIFT);
+    uint64 ahead;
+
+    if (mapping->ra_size > 0 && index == mapping->ra_start + mapping->ra_size) {
+        // sequential, but the reader is faster than the async read ahead
+        ahead = ra_next_size(mapping->ra_size);
+    } else {
+        // random read, start over
+        ahead = READ_AHEAD_PAGE_INIT_CNT;
+    }
+    uint64 size = MAX(max_sane_readahead(req, ahead, rest), 1);
+    uint64 req_size = MIN(PGROUNDUP(req) / PGSIZE, size);
+
+    mapping->ra_start = index;
+    mapping->ra_size = size;
+    mapping->ra_async_size = size - req_size;
+    mapping->ra_sync_cnt++;
+
+    // the marker is the first page beyond the request
+    uint64 marker = mapping->ra_async_size > 0 ? index + req_size : (uint64)-1;
+    mpage_readahead(ip, index, size, marker);
+}
+
+// the reader gets the marker page of index
+static void page_cache_async_readahead(struct address_space *mapping, struct page *page, uint64 index) {
+    struct inode *ip = mapping->host;
+    uint64 start = mapping->ra_start + mapping->ra_size;
+    uint64 ahead = ra_next_size(mapping->ra_size);
+
+    clear_page_flags(page, PG_readahead);
+    if (index < mapping->ra_start || index >= start) {
+        // the marker of an old window
+        start = index + 1;
+        ahead = READ_AHEAD_PAGE_INIT_CNT;
+    }
+    if ((start << PGSHIFT) >= ip->i_size) {
+        return;
+    }
+    uint64 size = max_sane_readahead(0, ahead, ip->i_size - (start << PGSHIFT));
+    if (size == 0) {
+        // no enough memory
+        return;
+    }
+
+    // the whole window is ahead, its first page is the next marker
+    mapping->ra_start = start;
+    mapping->ra_size = size;
+    mapping->ra_async_size = size;
+    mapping->ra_async_cnt++;
+    mpage_readahead(ip, start, size, start);
+}
+
+// a user page fault on page index, the page will be mapped into a user pagetable.
+// return the page with a reference of the mapping, or NULL beyond the end of file
+struct page *filemap_fault(struct address_space *mapping, uint64 index) {
+    struct inode *ip = mapping->host;
+    struct page *page;
+
+    if ((index << PGSHIFT) >= ip->i_size) {
+        return NULL;
+    }
+
+    mutex_lock(&ip->i_read_lock);
+    page = find_get_page_atomic(mapping, index, 0);
+    if (page == NULL) {
+        mapping->ra_misses++;
+        page_cache_sync_readahead(mapping, index, PGSIZE);
+        page = find_get_page_atomic(mapping, index, 0);
+        ASSERT(page != NULL);
+    } else {
+        mapping->ra_hits++;
+        mark_page_accessed(page);
+        if (test_page_flags(page, PG_readahead)) {
+            page_cache_async_readahead(mapping, page, index);
+        }
+    }
+    // kswapd evicts a page holding i_read_lock, it sees this reference and keeps the page
+    page_cache_get(page);
+    mutex_unlock(&ip->i_read_lock);
+
+    wait_on_page_read(mapping, page);
+    return page;
+}
+
+// debug, statistics of read ahead
+void readahead_stat_print(struct address_space *mapping) {
+    printf("readahead : %ld hits, %ld misses, %ld waits, %ld pages in %ld sync + %ld async windows\n",
+           mapping->ra_hits, mapping->ra_misses, mapping->ra_waits, mapping->ra_pages, mapping->ra_sync_cnt, mapping->ra_async_cnt);
+}
+
 // read using mapping
 ssize_t do_generic_file_read(struct address_space *mapping, int user_dst, uint64 dst, uint off, uint n) {
     // static int read_cnt = 0;// debug
@@ -72,7 +207,6 @@ ssize_t do_generic_file_read(struct address_space *mapping, int user_dst, uint64
     uint64 offset = PGMASK(off);   // offset in a page
     uint64 end_index = (ip->i_size - 1) >> PGSHIFT;
     uint32 isize = ip->i_size;
-    uint64 read_sane_cnt = 0; // 1, 2, 3, ...
 
     uint64 pa;
     uint64 nr, len;
@@ -88,7 +222,7 @@ ssize_t do_generic_file_read(struct address_space *mapping, int user_dst, uint64
 
     // int first_char = 0;
 
-    sema_wait(&ip->i_read_lock);
+    mutex_lock(&ip->i_read_lock);
     while (1) {
         struct page *page;
 
@@ -110,43 +244,29 @@ ssize_t do_generic_file_read(struct address_space *mapping, int user_dst, uint64
         page = find_get_page_atomic(mapping, index, 0); // not acquire the lock of page
         // read_cnt++;// debug
         if (page == NULL) {
-            read_sane_cnt = max_sane_readahead(n - retval, mapping->read_ahead_cnt, isize - (off + retval));
-            mapping->read_ahead_end = index + read_sane_cnt - 1; // !!!
-            // ASSERT(read_sane_cnt > 0);
-            if (read_sane_cnt <= 0) {
-                goto out;
-                // panic("read_sane_cnt : error\n");
-            }
+            mapping->ra_misses++;
+            page_cache_sync_readahead(mapping, index, offset + (n - retval)); // can't allocate new clusters
 #ifdef __DEBUG_PAGE_CACHE__
-            printfRed("read miss : fname : %s, off : %d, n : %d, index : %d, offset : %d, read_sane_cnt : %d, read_ahead_cnt : %d, read_ahead_end : %d\n",
-                      ip->fat32_i.fname, off, n, index, offset, read_sane_cnt, mapping->read_ahead_cnt, mapping->read_ahead_end);
+            printfRed("read miss : fname : %s, off : %d, n : %d, index : %d, offset : %d, ra_start : %d, ra_size : %d\n",
+                      ip->fat32_i.fname, off, n, index, offset, mapping->ra_start, mapping->ra_size);
 #endif
-            pa = mpage_readpages(ip, index, read_sane_cnt, 1, 0); // must read from disk, can't allocate new clusters
-
-            // change the read_ahead_cnt dynamically
-            if (index > (mapping->last_index)) {
-                int ahead_tmp = mapping->read_ahead_end + mapping->read_ahead_cnt;
-                if (ahead_tmp <= end_index) {
-                    if (mapping->read_ahead_cnt < READ_AHEAD_PAGE_MAX_CNT) {
-                        CHANGE_READ_AHEAD(mapping); // exponential growth with base 2
-                    } else {
-                        mapping->read_ahead_cnt += 1; // linear growth with 1
-                    }
-                }
-            } else {
-                // not increase, set cnt to zero
-                mapping->read_ahead_cnt = 0;
-            }
-            mapping->last_index = index;
+            page = find_get_page_atomic(mapping, index, 0);
+            ASSERT(page != NULL);
         } else {
 #ifdef __DEBUG_PAGE_CACHE__
-            printfGreen("read hit : fname : %s, off : %d, n : %d, index : %d, offset : %d, read_ahead_cnt : %d, read_ahead_end : %d\n",
-                        ip->fat32_i.fname, off, n, index, offset, mapping->read_ahead_cnt, mapping->read_ahead_end);
+            printfGreen("read hit : fname : %s, off : %d, n : %d, index : %d, offset : %d, ra_start : %d, ra_size : %d\n",
+                        ip->fat32_i.fname, off, n, index, offset, mapping->ra_start, mapping->ra_size);
 #endif
-            pa = page_to_pa(page);
+            mapping->ra_hits++;
+            mark_page_accessed(page);
+            if (test_page_flags(page, PG_readahead)) {
+                page_cache_async_readahead(mapping, page, index);
+            }
             // read_hit_cnt ++;// debug
             // printf("read hit : %d/%d\n",read_hit_cnt, read_cnt);// debug
         }
+        wait_on_page_read(mapping, page);
+        pa = page_to_pa(page);
 
         // similar to fat32_inode_read
         // it is illegal to read beyond isize!!! (maybe it is reasonable to fill zero)
@@ -195,7 +315,7 @@ out:
     // printfRed("read content: %s\n", buf_debug_init);
     // kfree(buf_debug_init);
     // printf("\n");
-    sema_signal(&ip->i_read_lock);
+    mutex_unlock(&ip->i_read_lock);
     return retval;
 }
 
@@ -226,7 +346,7 @@ ssize_t do_generic_file_write(struct address_space *mapping, int user_src, uint6
     ssize_t retval = 0;
 
     // printf("write begin : \n");
-    sema_wait(&ip->i_read_lock);
+    mutex_lock(&ip->i_read_lock);
     while (1) {
         struct page *page;
 
@@ -261,6 +381,9 @@ ssize_t do_generic_file_write(struct address_space *mapping, int user_src, uint6
             printfBlue("write hit : fname : %s, off : %d, n : %d, index : %d, offset : %d\n",
                        ip->fat32_i.fname, off, n, index, offset);
 #endif
+            // don't let the read of page overwrite us
+            wait_on_page_read(mapping, page);
+            mark_page_accessed(page);
             pa = page_to_pa(page);
             // write_hit_cnt++;
             // printf("write hit : %d/%d\n", write_hit_cnt, write_cnt);// debug
@@ -289,8 +412,8 @@ ssize_t do_generic_file_write(struct address_space *mapping, int user_src, uint6
         // memmove((void*)buf_debug, (void*)(pa+offset), len);
         // buf_debug+=len;
 
-        // set page dirty
-        // set_page_flags(page, PG_dirty);// NOTE!!!
+        // set page dirty, kswapd can't reclaim it until it is written back
+        set_page_flags(page, PG_dirty);
 
         acquire(&mapping->host->tree_lock);
         radix_tree_tag_set(&mapping->page_tree, index, PAGECACHE_TAG_DIRTY); // NOTE!!!
@@ -323,6 +446,6 @@ out:
     // printfGreen("write content: %s\n", buf_debug_init);
     // kfree(buf_debug_init);
     // printf("\n");
-    sema_signal(&ip->i_read_lock);
+    mutex_unlock(&ip->i_read_lock);
     return retval;
 }
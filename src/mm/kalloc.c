@@ -12,31 +12,169 @@
 #include "debug.h"
 #include "kernel/cpu.h"
 #include "atomic/ops.h"
+#include "memory/vmscan.h"
+#include "memory/slab.h"
 
 extern char end[];
-extern void alloc_fail();
-
-atomic_t pages_cnt;
-atomic_t recycling;
 
 static inline int get_pages_cpu(struct page *page) {
     return (page - pagemeta_start) / PAGES_PER_CPU;
 }
 
+// steal at most n blocks of 2^order pages from other pools, add them to list
+// the pool with the most free pages is tried first, so the pools drain evenly
+// return the number of blocks we get
+static int steal_pages(int cur_id, uint64 order, int n, struct list_head *list) {
+    uint64 tried = 1UL << cur_id;
+    int cnt = 0;
+
+    while (cnt < n) {
+        int victim = -1;
+        uint64 most = 0;
+        for (int i = 0; i < NCPU; i++) {
+            // nr_free is read without lock, it is only a hint
+            uint64 nr_free = mempools[i].nr_free;
+            if (!(tried & (1UL << i)) && nr_free >= (1UL << order) && nr_free > most) {
+                victim = i;
+                most = nr_free;
+            }
+        }
+        if (victim < 0) {
+            break;
+        }
+        tried |= 1UL << victim;
+
+        int got = buddy_get_pages_bulk(&mempools[victim], order, n - cnt, list);
+        if (got > 0) {
+            atomic_add_return(&mempools[victim].steal_cnt, 1);
+            atomic_add_return(&mempools[victim].steal_pages, got << order);
+            cnt += got;
+        }
+    }
+    return cnt;
+}
+
 struct page *steal_mem(int cur_id, uint64 order) {
-    struct page *page = NULL;
+    struct list_head list;
+    INIT_LIST_HEAD(&list);
+    if (steal_pages(cur_id, order, 1, &list) == 0) {
+        return NULL;
+    }
+    struct page *page = list_first_entry(&list, struct page, list);
+    list_del(&page->list);
+    return page;
+}
+
+static inline int pcp_high(uint64 order) {
+    return PCP_HIGH >> order;
+}
+
+static inline int pcp_batch(uint64 order) {
+    return MAX(PCP_BATCH >> order, 1);
+}
+
+// give back at most cnt blocks from the tail (cold end) of pcplist to buddy system
+// interrupt must be off
+static void pcp_drain(struct per_cpu_pages *pcp, uint64 order, int cnt) {
+    struct list_head lists[NCPU];
     for (int i = 0; i < NCPU; i++) {
-        if (i == cur_id) {
-            continue;
+        INIT_LIST_HEAD(&lists[i]);
+    }
+
+    for (; cnt > 0 && !list_empty(&pcp->lists[order]); cnt--) {
+        struct page *page = list_last_entry(&pcp->lists[order], struct page, list);
+        list_del(&page->list);
+        pcp->count[order]--;
+        // a block may come from the pool of another cpu
+        list_add(&page->list, &lists[get_pages_cpu(page)]);
+    }
+
+    for (int i = 0; i < NCPU; i++) {
+        if (!list_empty(&lists[i])) {
+            buddy_free_pages_bulk(&mempools[i], &lists[i]);
+        }
+    }
+}
+
+static void pcp_drain_all(struct per_cpu_pages *pcp) {
+    for (int order = 0; order <= PCP_MAX_ORDER; order++) {
+        pcp_drain(pcp, order, pcp->count[order]);
+    }
+}
+
+// give back the pcplist of this cpu to buddy system, so that the pages can be merged
+void drain_local_pages(void) {
+    push_off();
+    pcp_drain_all(&pcplists[cpuid()]);
+    pop_off();
+}
+
+// interrupt must be off
+static struct page *pcp_alloc(struct per_cpu_pages *pcp, int id, uint64 order) {
+    struct list_head *list = &pcp->lists[order];
+
+    if (list_empty(list)) {
+        // refill from the pool of this cpu, then steal a larger batch from others,
+        // so that we don't go to the remote pools again soon
+        pcp->count[order] += buddy_get_pages_bulk(&mempools[id], order, pcp_batch(order), list);
+        if (list_empty(list)) {
+            pcp->count[order] += steal_pages(id, order, pcp_high(order) / 2, list);
+        }
+        if (list_empty(list)) {
+            return NULL;
+        }
+    }
+
+    // the head is the most recently freed, cache hot
+    struct page *page = list_first_entry(list, struct page, list);
+    list_del(&page->list);
+    pcp->count[order]--;
+    return page;
+}
+
+// interrupt must be off
+static void pcp_free(struct per_cpu_pages *pcp, struct page *page) {
+    uint64 order = page->order;
+    list_add(&page->list, &pcp->lists[order]);
+    pcp->count[order]++;
+    if (pcp->count[order] > pcp_high(order)) {
+        pcp_drain(pcp, order, pcp_batch(order));
+    }
+}
+
+static struct page *alloc_pages(uint64 order) {
+    struct page *page = NULL;
+
+    push_off();
+    int id = cpuid();
+    ASSERT(id >= 0 && id < NCPU);
+    if (order <= PCP_MAX_ORDER) {
+        page = pcp_alloc(&pcplists[id], id, order);
+    }
+    pop_off();
+    if (page != NULL) {
+        return page;
+    }
+    if (order > PCP_MAX_ORDER) {
+        // the pool of this cpu is preferred, but we may migrate to other cpus, it is fine
+        page = buddy_get_pages(&mempools[id], order);
+        if (page == NULL) {
+            page = steal_mem(id, order);
         }
-        // TODO
-        push_off();
-        page = buddy_get_pages(&mempools[i], order);
         if (page != NULL) {
             return page;
         }
     }
-    ASSERT(page == NULL);
+
+    // blocks cached in pcplist can't be merged by buddy system, give them back and retry
+    push_off();
+    id = cpuid();
+    pcp_drain_all(&pcplists[id]);
+    pop_off();
+    page = buddy_get_pages(&mempools[id], order);
+    if (page == NULL) {
+        page = steal_mem(id, order);
+    }
     return page;
 }
 
@@ -69,25 +207,16 @@ void *kmalloc(size_t size) {
         order = size_to_page_order(size);
     }
 
-    push_off();
-    int id = cpuid();
-    ASSERT(id >= 0 && id < NCPU);
-    struct page *page = buddy_get_pages(&mempools[id], order);
-
+    struct page *page = alloc_pages(order);
     if (page == NULL) {
-        page = steal_mem(id, order);
-        if (page == NULL) {
-            return 0;
-        }
+        return 0;
     }
     ASSERT(atomic_read(&page->refcnt) == 0);
     atomic_set(&page->refcnt, 1);
     void *page_ret = (void *)page_to_pa(page);
-    atomic_sub_return(&pages_cnt, 1 << page->order);
-    if (!atomic_read(&recycling) && atomic_read(&pages_cnt) < PAGES_THRESHOLD) {
-        atomic_inc_return(&recycling);
-        alloc_fail();
-        atomic_dec_return(&recycling);
+    if (nr_free_pages() < PAGES_WMARK_LOW) {
+        // reclaim page cache in background
+        wakeup_kswapd();
     }
     return page_ret;
 }
@@ -107,56 +236,56 @@ void *kzalloc(size_t size) {
 
 /* compatible with the old kalloc call, use kmalloc instead */
 void *kalloc(void) {
-    int order = 0;
-
-    push_off();
-    int id = cpuid();
-    // printf("%d\n", NCPU);
-    ASSERT(id >= 0 && id < NCPU);
-    struct page *page = buddy_get_pages(&mempools[id], order);
-
+    struct page *page = alloc_pages(0);
     if (page == NULL) {
-        page = steal_mem(id, order);
-        if (page == NULL) {
-            return 0;
-        }
+        return 0;
     }
 
     // acquire(&page->lock);
     ASSERT(atomic_read(&page->refcnt) == 0);
     atomic_set(&page->refcnt, 1);
     void *page_ret = (void *)page_to_pa(page);
-    atomic_sub_return(&pages_cnt, 1 << page->order);
-
-    if (!atomic_read(&recycling) && atomic_read(&pages_cnt) < PAGES_THRESHOLD) {
-        atomic_inc_return(&recycling);
-        alloc_fail();
-        atomic_dec_return(&recycling);
+    if (nr_free_pages() < PAGES_WMARK_LOW) {
+        // reclaim page cache in background
+        wakeup_kswapd();
     }
     return page_ret;
 }
 
 void kfree(void *pa) {
+    if ((uint64)pa % PGSIZE != 0) {
+        // an object of slab allocator
+        kmem_cache_free(NULL, pa);
+        return;
+    }
+
     struct page *page = pa_to_page((uint64)pa);
-    acquire(&page->lock);
-    if (atomic_read(&page->refcnt) < 1) {
+    // atomic_dec_return returns the old value, only the last one frees the page
+    int refcnt = atomic_dec_return(&page->refcnt);
+    if (refcnt < 1) {
         panic("kfree : page ref error\n");
     }
-
-    atomic_dec_return(&page->refcnt);
-    if (atomic_read(&page->refcnt) >= 1) {
-        release(&page->lock);
+    if (refcnt > 1) {
         return;
     }
-    ASSERT(atomic_read(&page->refcnt) == 0);
-    release(&page->lock);
+
+    if (test_page_flags(page, PG_lru)) {
+        // a page of page cache
+        lru_cache_del(page);
+    }
+    page->flags = 0;
 
     ASSERT(page->allocated == 1);
     int id = get_pages_cpu(page);
     ASSERT(id >= 0 && id < NCPU);
 
-    atomic_add_return(&pages_cnt, 1 << page->order);
-
+    if (page->order <= PCP_MAX_ORDER) {
+        // no lock of buddy system here, unless the pcplist is full
+        push_off();
+        pcp_free(&pcplists[cpuid()], page);
+        pop_off();
+        return;
+    }
     buddy_free_pages(&mempools[id], page);
 }
 
@@ -16,6 +16,8 @@ struct mm_struct *alloc_mm() {
     }
 
     INIT_LIST_HEAD(&mm->head_vma);
+    mm->vma_rb = RB_ROOT;
+    vmacache_invalidate(mm);
 
     // semaphore
     sema_init(&mm->mmap_sem, 1, "mm_semaphore");
@@ -94,7 +94,7 @@ void *do_mmap(vaddr_t addr, size_t length, int prot, int flags, struct file *fp,
                 }
             }
             if (vma != NULL) {
-                del_vma_from_vmspace(&mm->head_vma, vma);
+                del_vma_from_vmspace(mm, vma);
             }
             mapva = addr;
         }
@@ -3,12 +3,17 @@
 #include "proc/pdflush.h"
 #include "lib/timer.h"
 #include "memory/allocator.h"
+#include "fs/bio.h"
 
 struct timer_list wb_timer;
 
 static void background_writeout(uint64 _min_pages) {
-    // only valid if the number of rest of pages is less than threshold
-    if (get_free_mem() > PAGES_THRESHOLD * PGSIZE) {
+    // delayed writes of buffer cache are written back every cycle
+    bcache_flush();
+
+    // only valid if the number of rest of pages is less than low watermark,
+    // then kswapd can reclaim the pages written back
+    if (get_free_mem() > PAGES_WMARK_LOW * PGSIZE) {
         return;
     }
     uint64 nr_to_write = MAX_WRITEBACK_PAGES;
@@ -9,6 +9,19 @@
 #include "debug.h"
 #include "memory/mm.h"
 #include "memory/pagefault.h"
+#include "memory/vmscan.h"
+#include "memory/filemap.h"
+#include "fs/fat/fat32_mem.h"
+#include "param.h"
+
+// a page of zeros shared by all the anonymous pages which have been read but not written yet
+paddr_t zero_page;
+
+void zero_page_init(void) {
+    if ((zero_page = (paddr_t)kzalloc(PGSIZE)) == 0) {
+        panic("zero_page_init : no memory\n");
+    }
+}
 
 static uint32 perm_vma2pte(uint32 vma_perm) {
     uint32 pte_perm = 0;
@@ -39,6 +52,103 @@ int is_a_cow_page(int flags) {
     return 1;
 }
 
+// a page of an elf segment with file data, read through the page cache of vma->vm_inode.
+// a page full of file data maps the page cache page itself, it is shared by all the processes
+// running the file and copied on the first write (cow). the page holding the end of file data
+// is private, the rest of it is bss
+static int do_file_page(uint64 cause, pagetable_t pagetable, struct vma *vma, vaddr_t stval) {
+    struct inode *ip = vma->vm_inode;
+    vaddr_t va = PGROUNDDOWN(stval);
+    uint64 offset = vma->offset + (va - vma->startva);
+    int perm = PTE_R | PTE_U | perm_vma2pte(vma->perm);
+    struct page *page;
+    paddr_t pa;
+    void *mem;
+
+    ip->i_op->ilock(ip);
+    if (ip->i_mapping == NULL) {
+        fat32_i_mapping_init(ip);
+    }
+    page = filemap_fault(ip->i_mapping, offset >> PGSHIFT);
+    ip->i_op->iunlock(ip);
+    if (page == NULL) {
+        PAGEFAULT("elf segment beyond the end of file");
+        return -1;
+    }
+    pa = page_to_pa(page);
+
+    if (va + PGSIZE <= vma->file_end && cause != STORE_PAGEFAULT) {
+        if (mappages(pagetable, va, PGSIZE, pa, (perm & ~PTE_W) | PTE_SHARE, COMMONPAGE) != 0) {
+            kfree((void *)pa);
+            return -1;
+        }
+        return 0;
+    }
+
+    if ((mem = kmalloc(PGSIZE)) == 0) {
+        kfree((void *)pa);
+        return -1;
+    }
+    uint64 n = MIN(PGSIZE, vma->file_end - va);
+    memmove(mem, (void *)pa, n);
+    memset(mem + n, 0, PGSIZE - n);
+    kfree((void *)pa); // reference of filemap_fault
+    if (mappages(pagetable, va, PGSIZE, (uint64)mem, perm, COMMONPAGE) != 0) {
+        kfree(mem);
+        return -1;
+    }
+    return 0;
+}
+
+// a read of an anonymous page maps the zero page, the first write copies it (cow)
+static int do_zero_page(pagetable_t pagetable, struct vma *vma, vaddr_t stval) {
+    int perm = PTE_R | PTE_U | perm_vma2pte(vma->perm);
+
+    if (mappages(pagetable, PGROUNDDOWN(stval), PGSIZE, zero_page, (perm & ~PTE_W) | PTE_SHARE, COMMONPAGE) != 0) {
+        return -1;
+    }
+    share_page(zero_page);
+    return 0;
+}
+
+#ifdef THP_ENABLE
+// transparent huge page: map the whole 2MB around stval with a superpage, if the
+// 2MB is in an anonymous vma and nothing of it is mapped yet.
+// return -1 to fall back to a common page
+static int do_huge_anonymous_page(pagetable_t pagetable, struct vma *vma, vaddr_t stval) {
+    vaddr_t haddr = SUPERPG_DOWN(stval);
+    pte_t *pte;
+    void *mem;
+
+    if (vma->type != VMA_ANON && vma->type != VMA_HEAP) {
+        return -1;
+    }
+    if (haddr < vma->startva || haddr + SUPERPGSIZE > vma->startva + vma->size) {
+        return -1;
+    }
+    // don't take the memory kswapd is trying to get back
+    if (nr_free_pages() < PAGES_WMARK_HIGH + (1 << SUPERPAGE_ORDER)) {
+        return -1;
+    }
+    walk(pagetable, haddr, 0, SUPERPAGE, &pte);
+    if (pte != NULL && *pte != 0) {
+        // some common pages are mapped
+        return -1;
+    }
+
+    if ((mem = kzalloc(SUPERPGSIZE)) == 0) {
+        if (!compact_pages(SUPERPAGE_ORDER) || (mem = kzalloc(SUPERPGSIZE)) == 0) {
+            return -1;
+        }
+    }
+    if (mappages(pagetable, haddr, SUPERPGSIZE, (uint64)mem, PTE_R | PTE_U | perm_vma2pte(vma->perm), SUPERPAGE) != 0) {
+        kfree(mem);
+        return -1;
+    }
+    return 0;
+}
+#endif
+
 int pagefault(uint64 cause, pagetable_t pagetable, vaddr_t stval) {
     /* the va exceed the MAXVA is illegal */
     if (PGROUNDDOWN(stval) >= MAXVA) {
@@ -63,6 +173,17 @@ int pagefault(uint64 cause, pagetable_t pagetable, vaddr_t stval) {
         int level;
         level = walk(pagetable, stval, 0, 0, &pte);
         if (pte == NULL || (*pte == 0)) {
+            if (vma->vm_inode != NULL && PGROUNDDOWN(stval) < vma->file_end) {
+                return do_file_page(cause, pagetable, vma, stval);
+            }
+            if (vma->type != VMA_FILE && cause != STORE_PAGEFAULT) {
+                return do_zero_page(pagetable, vma, stval);
+            }
+#ifdef THP_ENABLE
+            if (do_huge_anonymous_page(pagetable, vma, stval) == 0) {
+                return 0;
+            }
+#endif
             uvmalloc(pagetable, PGROUNDDOWN(stval), PGROUNDUP(stval + 1), perm_vma2pte(vma->perm));
             if (vma->type == VMA_FILE) {
                 paddr_t pa = walkaddr(pagetable, stval);
@@ -105,7 +226,11 @@ int cow(pte_t *pte, int level, paddr_t pa, int flags) {
         if ((mem = kmalloc(PGSIZE)) == 0) {
             return -1;
         }
-        memmove(mem, (void *)pa, PGSIZE);
+        if (pa == zero_page) {
+            memset(mem, 0, PGSIZE);
+        } else {
+            memmove(mem, (void *)pa, PGSIZE);
+        }
     } else {
         PAGEFAULT("the level of leaf pte is wrong");
         return -1;
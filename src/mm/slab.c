@@ -0,0 +1,212 @@
+#include "common.h"
+#include "param.h"
+#include "atomic/spinlock.h"
+#include "lib/list.h"
+#include "lib/riscv.h"
+#include "memory/allocator.h"
+#include "memory/buddy.h"
+#include "memory/slab.h"
+#include "kernel/cpu.h"
+#include "debug.h"
+
+// slab allocator for small kernel objects
+// each kmem_cache carves pages into objects of one size, every cpu keeps a magazine of
+// free objects, so alloc and free go to cache->lock only when the magazine is empty or full.
+// kfree() also frees a slab object, it finds the cache from the header of its page.
+
+#define SLAB_HDR_SIZE ROUND_UP(sizeof(struct slab), sizeof(void *))
+
+// cache of struct kmem_cache
+static struct kmem_cache cache_cache;
+
+static struct {
+    struct spinlock lock;
+    struct list_head head;
+} cache_chain;
+
+static inline struct slab *obj_to_slab(void *obj) {
+    return (struct slab *)PGROUNDDOWN((uint64)obj);
+}
+
+static void cache_setup(struct kmem_cache *cachep, const char *name, uint size) {
+    cachep->name = name;
+    cachep->obj_size = ROUND_UP(MAX(size, sizeof(void *)), sizeof(void *));
+    cachep->objs_per_slab = (PGSIZE - SLAB_HDR_SIZE) / cachep->obj_size;
+    ASSERT(cachep->objs_per_slab >= 2);
+
+    initlock(&cachep->lock, "kmem_cache_lock");
+    INIT_LIST_HEAD(&cachep->partial);
+    INIT_LIST_HEAD(&cachep->full);
+    INIT_LIST_HEAD(&cachep->empty);
+    cachep->nr_slabs = 0;
+    cachep->nr_empty = 0;
+    cachep->nr_objs = 0;
+    for (int i = 0; i < NCPU; i++) {
+        cachep->mag[i].count = 0;
+    }
+
+    acquire(&cache_chain.lock);
+    list_add_tail(&cachep->chain, &cache_chain.head);
+    release(&cache_chain.lock);
+}
+
+void kmem_cache_init(void) {
+    initlock(&cache_chain.lock, "cache_chain_lock");
+    INIT_LIST_HEAD(&cache_chain.head);
+    cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache));
+    Info("slab init [ok]\n");
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, uint size) {
+    struct kmem_cache *cachep = kmem_cache_alloc(&cache_cache);
+    if (cachep == NULL) {
+        return NULL;
+    }
+    cache_setup(cachep, name, size);
+    return cachep;
+}
+
+// must hold cachep->lock
+static struct slab *cache_grow(struct kmem_cache *cachep) {
+    struct slab *slab = (struct slab *)kalloc();
+    if (slab == NULL) {
+        return NULL;
+    }
+    set_page_flags(pa_to_page((uint64)slab), PG_slab);
+
+    slab->cache = cachep;
+    slab->inuse = 0;
+    slab->freelist = NULL;
+    // link objects from the end, so the freelist starts at the lowest address
+    char *base = (char *)slab + SLAB_HDR_SIZE;
+    for (int i = cachep->objs_per_slab - 1; i >= 0; i--) {
+        void *obj = base + i * cachep->obj_size;
+        *(void **)obj = slab->freelist;
+        slab->freelist = obj;
+    }
+    list_add(&slab->list, &cachep->partial);
+    cachep->nr_slabs++;
+    return slab;
+}
+
+// take at most SLAB_MAG_SIZE/2 objects from slabs into the magazine
+// interrupt must be off
+static void cache_refill(struct kmem_cache *cachep, struct kmem_magazine *mag) {
+    acquire(&cachep->lock);
+    while (mag->count < SLAB_MAG_SIZE / 2) {
+        struct slab *slab;
+        if (!list_empty(&cachep->partial)) {
+            slab = list_first_entry(&cachep->partial, struct slab, list);
+        } else if (!list_empty(&cachep->empty)) {
+            slab = list_first_entry(&cachep->empty, struct slab, list);
+            list_move(&slab->list, &cachep->partial);
+            cachep->nr_empty--;
+        } else if ((slab = cache_grow(cachep)) == NULL) {
+            break;
+        }
+
+        void *obj = slab->freelist;
+        slab->freelist = *(void **)obj;
+        slab->inuse++;
+        if (slab->inuse == cachep->objs_per_slab) {
+            list_move(&slab->list, &cachep->full);
+        }
+        mag->objs[mag->count++] = obj;
+        cachep->nr_objs++;
+    }
+    release(&cachep->lock);
+}
+
+// give back the oldest SLAB_MAG_SIZE/2 objects of the magazine to their slabs
+// interrupt must be off
+static void cache_flush(struct kmem_cache *cachep, struct kmem_magazine *mag) {
+    struct list_head to_free;
+    struct slab *slab, *tmp;
+    int n = SLAB_MAG_SIZE / 2;
+
+    INIT_LIST_HEAD(&to_free);
+    acquire(&cachep->lock);
+    for (int i = 0; i < n; i++) {
+        void *obj = mag->objs[i];
+        slab = obj_to_slab(obj);
+        ASSERT(slab->cache == cachep);
+        *(void **)obj = slab->freelist;
+        slab->freelist = obj;
+        if (slab->inuse == cachep->objs_per_slab) {
+            list_move(&slab->list, &cachep->partial);
+        }
+        slab->inuse--;
+        if (slab->inuse == 0) {
+            if (cachep->nr_empty == 0) {
+                list_move(&slab->list, &cachep->empty);
+                cachep->nr_empty++;
+            } else {
+                list_move(&slab->list, &to_free);
+                cachep->nr_slabs--;
+            }
+        }
+        cachep->nr_objs--;
+    }
+    release(&cachep->lock);
+
+    mag->count -= n;
+    memmove(mag->objs, mag->objs + n, mag->count * sizeof(void *));
+
+    list_for_each_entry_safe(slab, tmp, &to_free, list) {
+        list_del(&slab->list);
+        kfree((void *)slab);
+    }
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cachep) {
+    void *obj = NULL;
+
+    push_off();
+    struct kmem_magazine *mag = &cachep->mag[cpuid()];
+    if (mag->count == 0) {
+        cache_refill(cachep, mag);
+    }
+    if (mag->count > 0) {
+        obj = mag->objs[--mag->count];
+    }
+    pop_off();
+    return obj;
+}
+
+void *kmem_cache_zalloc(struct kmem_cache *cachep) {
+    void *obj = kmem_cache_alloc(cachep);
+    if (obj != NULL) {
+        memset(obj, 0, cachep->obj_size);
+    }
+    return obj;
+}
+
+// cachep can be NULL, then it is found from the slab (used by kfree)
+void kmem_cache_free(struct kmem_cache *cachep, void *obj) {
+    struct slab *slab = obj_to_slab(obj);
+    ASSERT(test_page_flags(pa_to_page((uint64)slab), PG_slab));
+    if (cachep == NULL) {
+        cachep = slab->cache;
+    }
+    ASSERT(slab->cache == cachep);
+
+    push_off();
+    struct kmem_magazine *mag = &cachep->mag[cpuid()];
+    if (mag->count == SLAB_MAG_SIZE) {
+        cache_flush(cachep, mag);
+    }
+    mag->objs[mag->count++] = obj;
+    pop_off();
+}
+
+// debug, statistics of slab caches (racy, but it is enough)
+void slab_stat_print(void) {
+    struct kmem_cache *cachep;
+
+    acquire(&cache_chain.lock);
+    list_for_each_entry(cachep, &cache_chain.head, chain) {
+        printf("slab %s : %d objs in use, %d slabs, %d objs per slab of %d bytes\n",
+               cachep->name, cachep->nr_objs, cachep->nr_slabs, cachep->objs_per_slab, cachep->obj_size);
+    }
+    release(&cache_chain.lock);
+}
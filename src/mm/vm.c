@@ -148,10 +148,17 @@ paddr_t getphyaddr(pagetable_t pagetable, vaddr_t va) {
     vaddr_t aligned_va;
     paddr_t aligned_pa;
     aligned_va = PGROUNDDOWN(va);
-    aligned_pa = walkaddr(pagetable, va);
+    aligned_pa = walkaddr_fault(pagetable, va);
     if (aligned_pa == 0) {
         return 0;
     }
+    if (aligned_pa == zero_page && proc_current()->mm->pagetable == pagetable) {
+        // the caller may write through the pa, give it a private page
+        struct vma *vma = find_vma_for_va(proc_current()->mm, va);
+        if (vma != NULL && (vma->perm & PERM_WRITE) && pagefault(STORE_PAGEFAULT, pagetable, va) == 0) {
+            aligned_pa = walkaddr(pagetable, va);
+        }
+    }
     return aligned_pa + (va - aligned_va);
 }
 
@@ -183,6 +190,33 @@ uint64 walkaddr(pagetable_t pagetable, uint64 va) {
     }
 }
 
+// like walkaddr, but a page in the vmas of current process which is not faulted in yet
+// (demand paged elf segments, mmap) is faulted in here. the fault may sleep, so with
+// spinlocks held it is only walkaddr
+uint64 walkaddr_fault(pagetable_t pagetable, uint64 va) {
+    struct proc *p = proc_current();
+    uint64 pa;
+    pte_t *pte;
+
+    if ((pa = walkaddr(pagetable, va)) != 0 || va >= MAXVA) {
+        return pa;
+    }
+    push_off();
+    int nolock = (t_mycpu()->noff == 1);
+    pop_off();
+    if (!nolock || p == NULL || p->mm == NULL || p->mm->pagetable != pagetable) {
+        return 0;
+    }
+    walk(pagetable, va, 0, 0, &pte);
+    if ((pte != NULL && *pte != 0) || find_vma_for_va(p->mm, va) == NULL) {
+        return 0;
+    }
+    if (pagefault(LOAD_PAGEFAULT, pagetable, va) < 0) {
+        return 0;
+    }
+    return walkaddr(pagetable, va);
+}
+
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
@@ -242,6 +276,49 @@ int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm,
     return 0;
 }
 
+// Replace the 2MB superpage mapping covering va with 512 4KB mappings.
+// If only this mapping holds the superpage, its pages are split and mapped in place,
+// otherwise (shared by fork) the pages are copied, and the superpage loses a reference.
+// Returns 0 on success, -1 if out of memory.
+int split_superpage(pagetable_t pagetable, vaddr_t va) {
+    pte_t *pte;
+    int level = walk(pagetable, va, 0, 1, &pte);
+    ASSERT(level == SUPERPAGE && pte != NULL && (*pte & PTE_V));
+
+    paddr_t pa = PTE2PA(*pte);
+    uint64 flags = PTE_FLAGS(*pte);
+    struct page *page = pa_to_page(pa);
+    pagetable_t pt;
+    if ((pt = (pagetable_t)kzalloc(PGSIZE)) == 0) {
+        return -1;
+    }
+
+    if (atomic_read(&page->refcnt) == 1) {
+        split_pages(page);
+        for (int i = 0; i < PGSIZE / PTESIZE; i++) {
+            pt[i] = PA2PTE(pa + i * PGSIZE) | flags;
+        }
+    } else {
+        for (int i = 0; i < PGSIZE / PTESIZE; i++) {
+            void *mem;
+            if ((mem = kmalloc(PGSIZE)) == 0) {
+                for (int j = 0; j < i; j++) {
+                    kfree((void *)PTE2PA(pt[j]));
+                }
+                kfree(pt);
+                return -1;
+            }
+            memmove(mem, (void *)(pa + i * PGSIZE), PGSIZE);
+            pt[i] = PA2PTE(mem) | flags;
+        }
+        kfree((void *)pa);
+    }
+
+    *pte = PA2PTE(pt) | PTE_V;
+    sfence_vma();
+    return 0;
+}
+
 // Remove npages of mappings starting from va. va must be
 // page-aligned. The mappings must exist.
 // Optionally free the physical memory.
@@ -277,18 +354,22 @@ void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free, int
 
         ASSERT(level <= 1);
 
+        if (level == SUPERPAGE && (a != SUPERPG_DOWN(a) || a + SUPERPGSIZE > endva)) {
+            // unmap part of a superpage, keep the rest of it
+            if (split_superpage(pagetable, a) != 0) {
+                panic("uvmunmap: no memory to split superpage");
+            }
+            level = walk(pagetable, a, 0, 0, &pte);
+            ASSERT(level == COMMONPAGE);
+        }
+
         if (do_free) {
             uint64 pa = PTE2PA(*pte);
             kfree((void *)pa);
         }
-        uint64 pte_flags = PTE_FLAGS(*pte);
         *pte = 0;
 
         if (level == SUPERPAGE) {
-            if (a != SUPERPG_DOWN(a) && a == va) {
-                uvmalloc(pagetable, SUPERPG_DOWN(a), a, pte_flags);
-                // vmprint(pagetable, 1, 0, 0, 0);
-            }
             a += (SUPERPGSIZE - PGSIZE);
         }
     }
@@ -378,7 +459,7 @@ uint64 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz) {
 
     if (PGROUNDUP(newsz) < PGROUNDUP(oldsz)) {
         int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
-        uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1, 0);
+        uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1, 1);
     }
 
     return newsz;
@@ -420,100 +501,85 @@ void uvmfree(struct mm_struct *mm) {
     freewalk(mm->pagetable, 0);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
-// returns 0 on success, -1 on failure.
-// frees any allocated pages on failure.
-int uvmcopy(struct mm_struct *srcmm, struct mm_struct *dstmm) {
-    struct vma *pos;
-    list_for_each_entry(pos, &srcmm->head_vma, node) {
-        vaddr_t startva, endva;
-        paddr_t pa;
-        pte_t *pte;
-        uint flags;
-        int level;
-
-        /* for STACK VMA, copy both the pagetable and the physical memory */
-        if (pos->type == VMA_STACK) {
-            // ASSERT(pos->size == USTACK_PAGE * PGSIZE);
-            // Log("stack size is %d", pos->size / PGSIZE);
-            for (uint64 offset = 0; offset < pos->size; offset += PGSIZE) {
-                level = walk(srcmm->pagetable, pos->startva + offset, 0, 0, &pte);
-                // ASSERT(level <= 1 && level >= 0);
-                if (!(level <= 1 && level >= 0)) {
-                    panic("uvmcopy : level error\n");
-                }
-                pa = PTE2PA(*pte);
+// write-protect a private page shared by fork, the first write copies it (cow)
+static inline void cow_pte(pte_t *pte) {
+    /* a page not writable before is readonly after the copy too */
+    if ((*pte & PTE_W) == 0 && (*pte & PTE_SHARE) == 0) {
+        *pte = *pte | PTE_READONLY;
+    }
+    *pte = *pte | PTE_SHARE;
+    *pte = *pte & ~PTE_W;
+}
 
-                paddr_t new = (paddr_t)kzalloc(PGSIZE);
-                if (new == 0) {
-                    Warn("uvmcopy: no free mem");
-                    return -1;
-                }
-                memmove((void *)new, (void *)pa, PGSIZE);
-                if (mappages(dstmm->pagetable, pos->startva + offset, PGSIZE, new, PTE_W | PTE_R | PTE_U, COMMONPAGE) != 0) {
-                    panic("uvmcopy: map failed");
-                    return -1;
-                }
-                // Log("stack %p", pos->startva + offset);
+// share the pages of [startva, endva) with dstpt, copy-on-write if cow.
+// it walks from the root once for a 2MB region, then copies the ptes of the leaf page table
+static int uvmcopy_range(pagetable_t srcpt, pagetable_t dstpt, vaddr_t startva, vaddr_t endva, int cow) {
+    vaddr_t va, next;
+    pte_t *spmd, *dpmd;
+    pagetable_t spt, dpt;
+
+    for (va = startva; va < endva; va = next) {
+        next = MIN(SUPERPG_DOWN(va) + SUPERPGSIZE, endva);
+
+        walk(srcpt, va, 0, SUPERPAGE, &spmd);
+        if (spmd == NULL || (*spmd & PTE_V) == 0) {
+            continue;
+        }
+        if ((*spmd & PTE_R) || (*spmd & PTE_X)) {
+            /* map superpage */
+            ASSERT(va == SUPERPG_DOWN(va) && next == va + SUPERPGSIZE);
+            if (cow) {
+                cow_pte(spmd);
+            }
+            if (mappages(dstpt, va, SUPERPGSIZE, PTE2PA(*spmd), PTE_FLAGS(*spmd), SUPERPAGE) != 0) {
+                return -1;
             }
+            share_page(PTE2PA(*spmd));
             continue;
         }
 
-        /* for other vmas, copy pagetable only */
-        startva = pos->startva;
-        endva = startva + pos->size;
-        ASSERT(startva % PGSIZE == 0 && endva % PGSIZE == 0);
-        for (vaddr_t i = startva; i < endva; i += PGSIZE) {
-            level = walk(srcmm->pagetable, i, 0, 0, &pte);
-            if (pte == NULL || *pte == 0) {
+        walk(dstpt, va, 1, SUPERPAGE, &dpmd);
+        if (dpmd == NULL) {
+            return -1;
+        }
+        if ((*dpmd & PTE_V) == 0) {
+            if ((dpt = (pagetable_t)kzalloc(PGSIZE)) == 0) {
+                return -1;
+            }
+            *dpmd = PA2PTE(dpt) | PTE_V;
+        }
+        spt = (pagetable_t)PTE2PA(*spmd);
+        dpt = (pagetable_t)PTE2PA(*dpmd);
+        for (int i = PN(COMMONPAGE, va); i <= PN(COMMONPAGE, next - 1); i++) {
+            if ((spt[i] & PTE_V) == 0) {
                 continue;
             }
-            if (!(level <= 1 && level >= 0)) {
-                panic("uvmcopy : level error\n");
+            if (dpt[i] & PTE_V) {
+                panic("uvmcopy: remap");
             }
-
-            if (pos->type != VMA_FILE || !(pos->perm & PERM_SHARED)) {
-                // if (pos->type != VMA_FILE) {
-                if ((*pte & PTE_W) == 0 && (*pte & PTE_SHARE) == 0) {
-                    *pte = *pte | PTE_READONLY;
-                }
-                /* shared page */
-                if ((*pte & PTE_W) == 0 && (*pte & PTE_READONLY) != 0) {
-                    *pte = *pte | PTE_READONLY;
-                }
-                *pte = *pte | PTE_SHARE;
-                *pte = *pte & ~PTE_W;
+            if (cow) {
+                cow_pte(&spt[i]);
             }
+            dpt[i] = spt[i];
+            share_page(PTE2PA(spt[i]));
+        }
+    }
+    return 0;
+}
 
-            pa = PTE2PA(*pte);
-            flags = PTE_FLAGS(*pte);
+// fork, the child shares all the pages of parent, copy-on-write except MAP_SHARED files
+int uvmcopy(struct mm_struct *srcmm, struct mm_struct *dstmm) {
+    struct vma *pos;
+    list_for_each_entry(pos, &srcmm->head_vma, node) {
+        int cow = (pos->type != VMA_FILE || !(pos->perm & PERM_SHARED));
 
-            if (level == SUPERPAGE) {
-                /* level == 1 ~ map superpage */
-                ASSERT(i == SUPERPG_DOWN(i));
-                if (mappages(dstmm->pagetable, i, SUPERPGSIZE, pa, flags, SUPERPAGE) != 0) {
-                    goto err;
-                }
-                i += (SUPERPGSIZE - PGSIZE);
-            } else if (level == COMMONPAGE) {
-                /* level == 0 ~ map common page */
-                if (mappages(dstmm->pagetable, i, PGSIZE, pa, flags, COMMONPAGE) != 0) {
-                    goto err;
-                }
-            }
-            /* call share_page after mappages success! */
-            share_page(pa);
+        ASSERT(pos->startva % PGSIZE == 0 && pos->size % PGSIZE == 0);
+        if (uvmcopy_range(srcmm->pagetable, dstmm->pagetable, pos->startva, pos->startva + pos->size, cow) < 0) {
+            Warn("uvmcopy: no free mem");
+            return -1;
         }
     }
     return 0;
-
-err:
-    panic("TODO: error handler");
-    // uvmunmap(new, 0, i / PGSIZE, 0, 0);
-    return -1;
 }
 
 // mark a PTE invalid for user access.
@@ -549,6 +615,8 @@ int copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len) {
             if (pagefault(STORE_PAGEFAULT, pagetable, dstva) < 0) {
                 return -1;
             }
+            /* the page table may be allocated by the fault */
+            walk(pagetable, va0, 0, 0, &pte);
         }
         flags = PTE_FLAGS(*pte);
         if ((flags & PTE_W) == 0 && is_a_cow_page(flags)) {
@@ -583,7 +651,7 @@ int copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len) {
         // if (va0 == 0x32407000) {
         //     vmprint(pagetable, 1, 0, 0x32406000, 0);
         // }
-        pa0 = walkaddr(pagetable, va0);
+        pa0 = walkaddr_fault(pagetable, va0);
         if (pa0 == 0)
             return -1;
         n = PGSIZE - (srcva - va0);
@@ -608,7 +676,7 @@ int copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max) {
 
     while (got_null == 0 && max > 0) {
         va0 = PGROUNDDOWN(srcva);
-        pa0 = walkaddr(pagetable, va0);
+        pa0 = walkaddr_fault(pagetable, va0);
         if (pa0 == 0)
             return -1;
         n = PGSIZE - (srcva - va0);
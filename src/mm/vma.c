@@ -2,6 +2,7 @@
 #include "memory/vma.h"
 #include "atomic/spinlock.h"
 #include "memory/allocator.h"
+#include "memory/slab.h"
 #include "proc/pcb_life.h"
 #include "proc/tcb_life.h"
 #include "lib/riscv.h"
@@ -13,87 +14,100 @@
 #include "fs/vfs/fs.h"
 #include "fs/vfs/ops.h"
 
-struct vma vmas[NVMA];
-struct spinlock vmas_lock;
+static struct kmem_cache *vma_cachep;
 
 static struct vma *vma_map_range(struct mm_struct *mm, uint64 va, size_t len, uint64 perm, uint64 type);
 void vmas_init() {
-    initlock(&vmas_lock, "vmas_lock");
-    memset(vmas, 0, sizeof(vmas));
+    if ((vma_cachep = kmem_cache_create("vma", sizeof(struct vma))) == NULL) {
+        panic("vmas_init : no memory\n");
+    }
     Info("vma init [ok]\n");
 }
 
 static struct vma *alloc_vma(void) {
-    // 1. slab allocator
-    // 2. fine grained lock
-    acquire(&vmas_lock);
-    for (int i = 0; i < NVMA; i++) {
-        if (vmas[i].used == 0) {
-            vmas[i].used = 1;
-            release(&vmas_lock);
-            return &vmas[i];
-        }
-    }
-    release(&vmas_lock);
-    return 0;
+    return kmem_cache_zalloc(vma_cachep);
 }
 
 void free_vma(struct vma *vma) {
-    acquire(&vmas_lock);
-    vma->used = 0;
-    release(&vmas_lock);
+    if (vma->vm_inode) {
+        vma->vm_inode->i_op->iput(vma->vm_inode);
+    }
+    kmem_cache_free(vma_cachep, vma);
+}
+
+// vmacache_seq of every mm comes from this counter, so a thread never
+// mistakes a vma cached for one mm for a vma of another
+static uint64 vmacache_gen;
+
+// drop the vma cached by threads, called when a vma of mm is freed
+void vmacache_invalidate(struct mm_struct *mm) {
+    mm->vmacache_seq = __sync_add_and_fetch(&vmacache_gen, 1);
+}
+
+static struct vma *vma_lookup(struct mm_struct *mm, vaddr_t addr) {
+    struct rb_node *node = mm->vma_rb.rb_node;
+    struct vma *vma;
+
+    while (node) {
+        vma = rb_entry(node, struct vma, rb);
+        if (addr < vma->startva) {
+            node = node->rb_left;
+        } else if (addr >= vma->startva + vma->size) {
+            node = node->rb_right;
+        } else {
+            return vma;
+        }
+    }
+    return NULL;
 }
 
 /*
  * Returns 0 when no intersection detected.
  */
-static int check_vma_intersect(struct list_head *vma_head, struct vma *checked_vma) {
-    vaddr_t checked_start, start;
-    vaddr_t checked_end, end;
-    struct vma *pos;
+static int check_vma_intersect(struct mm_struct *mm, struct vma *checked_vma) {
+    vaddr_t checked_start = checked_vma->startva;
+    vaddr_t checked_end = checked_start + checked_vma->size - 1;
 
-    checked_start = checked_vma->startva;
-    checked_end = checked_start + checked_vma->size - 1;
-
-    list_for_each_entry(pos, vma_head, node) {
-        start = pos->startva;
-        end = pos->startva + pos->size;
-        if ((checked_start >= start && checked_start < end) || (checked_end >= start && checked_end < end)) {
-            return 1;
-        }
+    if (vma_lookup(mm, checked_start) != NULL || vma_lookup(mm, checked_end) != NULL) {
+        return 1;
     }
     return 0;
 }
 
-static int add_vma_to_vmspace(struct list_head *head, struct vma *vma) {
-    if (check_vma_intersect(head, vma) != 0) {
+static int add_vma_to_vmspace(struct mm_struct *mm, struct vma *vma) {
+    struct rb_node **link = &mm->vma_rb.rb_node;
+    struct rb_node *parent = NULL, *prev;
+
+    if (check_vma_intersect(mm, vma) != 0) {
         Log("add_vma_to_vmspace: vma overlap\n");
         ASSERT(0);
         return -1;
     }
 
-    list_add(&vma->node, head);
-    return 0;
-}
-
-static int is_vma_in_vmspace(struct list_head *vma_head, struct vma *vma) {
-    struct vma *pos;
-
-    list_for_each_entry(pos, vma_head, node) {
-        if (pos == vma) {
-            return 1;
+    while (*link) {
+        parent = *link;
+        if (vma->startva < rb_entry(parent, struct vma, rb)->startva) {
+            link = &parent->rb_left;
+        } else {
+            link = &parent->rb_right;
         }
     }
+    rb_link_node(&vma->rb, parent, link);
+    rb_insert_color(&vma->rb, &mm->vma_rb);
 
+    // keep head_vma in address order too
+    if ((prev = rb_prev(&vma->rb)) != NULL) {
+        list_add(&vma->node, &rb_entry(prev, struct vma, rb)->node);
+    } else {
+        list_add(&vma->node, &mm->head_vma);
+    }
     return 0;
 }
 
-void del_vma_from_vmspace(struct list_head *vma_head, struct vma *vma) {
-    if (is_vma_in_vmspace(vma_head, vma)) {
-        list_del(&(vma->node));
-    } else {
-        ASSERT(0);
-    }
+void del_vma_from_vmspace(struct mm_struct *mm, struct vma *vma) {
+    rb_erase(&vma->rb, &mm->vma_rb);
+    list_del(&vma->node);
+    vmacache_invalidate(mm);
     free_vma(vma);
 }
 
@@ -114,6 +128,18 @@ int vma_map_file(struct mm_struct *mm, uint64 va, size_t len, uint64 perm, uint6
     return 0;
 }
 
+// map an elf segment, its pages are faulted in from the page cache of ip
+int vma_map_elf(struct mm_struct *mm, uint64 va, size_t len, uint64 perm, off_t offset, struct inode *ip, vaddr_t file_end) {
+    struct vma *vma;
+    if ((vma = vma_map_range(mm, va, len, perm, VMA_TEXT)) == NULL) {
+        return -1;
+    }
+    vma->offset = offset;
+    vma->vm_inode = ip->i_op->idup(ip);
+    vma->file_end = file_end;
+    return 0;
+}
+
 int vma_map(struct mm_struct *mm, uint64 va, size_t len, uint64 perm, uint64 type) {
     // Log("%p %p %#x", va, va + len, perm);
     struct vma *vma;
@@ -145,7 +171,7 @@ static struct vma *vma_map_range(struct mm_struct *mm, uint64 va, size_t len, ui
     vma->perm = perm;
     vma->type = type;
 
-    if (add_vma_to_vmspace(&mm->head_vma, vma) < 0) {
+    if (add_vma_to_vmspace(mm, vma) < 0) {
         goto free;
     }
     return vma;
@@ -202,14 +228,14 @@ int vmspace_unmap(struct mm_struct *mm, vaddr_t va, size_t len) {
     }
 
     if (size > len) {
-        /* unmap part of the vma */
+        /* unmap part of the vma, uvmunmap splits a superpage across the new start */
         vma->startva += len;
         vma->size -= len;
-        uvmunmap(mm->pagetable, start, PGROUNDUP(size) / PGSIZE, 1, 1);
+        uvmunmap(mm->pagetable, start, len / PGSIZE, 1, 1);
         return 0;
     }
 
-    del_vma_from_vmspace(&mm->head_vma, vma);
+    del_vma_from_vmspace(mm, vma);
 
     // Note: non-leaf pte still not recycle
     uvmunmap(mm->pagetable, start, PGROUNDUP(size) / PGSIZE, 1, 1);
@@ -222,32 +248,50 @@ int vmspace_unmap(struct mm_struct *mm, vaddr_t va, size_t len) {
 }
 
 struct vma *find_vma_for_va(struct mm_struct *mm, vaddr_t addr) {
-    struct vma *pos;
-    vaddr_t start, end;
-    list_for_each_entry(pos, &mm->head_vma, node) {
-        start = pos->startva;
-        end = pos->startva + pos->size;
-        if (addr >= start && addr < end) {
-            return pos;
+    struct tcb *t = thread_current();
+    struct vma *vma;
+
+    // faults of a thread mostly hit the vma of its last one
+    if (t != NULL && t->vmacache != NULL && t->vmacache_seq == mm->vmacache_seq) {
+        vma = t->vmacache;
+        if (addr >= vma->startva && addr < vma->startva + vma->size) {
+            return vma;
         }
     }
-    return NULL;
+
+    vma = vma_lookup(mm, addr);
+    if (t != NULL && vma != NULL) {
+        t->vmacache = vma;
+        t->vmacache_seq = mm->vmacache_seq;
+    }
+    return vma;
 }
 
 #define MMAP_START 0x30000000
+// first fit, the lowest gap above MMAP_START which holds size bytes
 vaddr_t find_mapping_space(struct mm_struct *mm, vaddr_t start, size_t size) {
-    struct vma *pos;
+    struct rb_node *node = mm->vma_rb.rb_node, *first = NULL;
+    struct vma *vma;
     vaddr_t max = MMAP_START;
-    list_for_each_entry(pos, &mm->head_vma, node) {
-        if (pos->type == VMA_INTERP) {
-            continue;
+
+    size = size < PGSIZE ? PGSIZE : PGROUNDUP(size);
+    // the first vma which ends above MMAP_START
+    while (node) {
+        vma = rb_entry(node, struct vma, rb);
+        if (vma->startva + vma->size > max) {
+            first = node;
+            node = node->rb_left;
+        } else {
+            node = node->rb_right;
         }
-        if (pos->type == VMA_STACK) {
-            continue;
+    }
+    for (node = first; node != NULL; node = rb_next(node)) {
+        vma = rb_entry(node, struct vma, rb);
+        if (max + size <= vma->startva) {
+            break;
         }
-        vaddr_t endva = pos->startva + pos->size;
-        if (max < endva) {
-            max = endva;
+        if (max < vma->startva + vma->size) {
+            max = vma->startva + vma->size;
         }
     }
     ASSERT(max % PGSIZE == 0);
@@ -318,6 +362,12 @@ int vmacopy(struct mm_struct *srcmm, struct mm_struct *dstmm) {
                 < 0) {
                 return -1;
             }
+        } else if (pos->vm_inode) {
+            if (vma_map_elf(dstmm, pos->startva, pos->size, pos->perm, pos->offset,
+                            pos->vm_inode, pos->file_end)
+                < 0) {
+                return -1;
+            }
         } else {
             if (vma_map(dstmm, pos->startva, pos->size, pos->perm, pos->type) < 0) {
                 return -1;
@@ -335,7 +385,7 @@ void free_all_vmas(struct mm_struct *mm) {
     // print_vma(&mm->head_vma);
     list_for_each_entry_safe(pos_cur, pos_tmp, &mm->head_vma, node) {
         if (pos_cur->type == VMA_HEAP && pos_cur->size == 0) {
-            del_vma_from_vmspace(&mm->head_vma, pos_cur);
+            del_vma_from_vmspace(mm, pos_cur);
             continue;
         }
         if (vmspace_unmap(mm, pos_cur->startva, pos_cur->size) < 0) {
@@ -344,6 +394,19 @@ void free_all_vmas(struct mm_struct *mm) {
     }
 }
 
+// fork copies a superpage only as a whole, so a vma boundary must not fall inside one
+static int split_superpage_at(struct mm_struct *mm, vaddr_t addr) {
+    pte_t *pte;
+
+    if (addr == SUPERPG_DOWN(addr)) {
+        return 0;
+    }
+    if (walk(mm->pagetable, addr, 0, 0, &pte) != SUPERPAGE) {
+        return 0;
+    }
+    return split_superpage(mm->pagetable, addr);
+}
+
 /*
  * Split a vma into two pieces at address 'addr', a new vma is allocated
  * either for the first part or the tail.
@@ -351,6 +414,10 @@ void free_all_vmas(struct mm_struct *mm) {
 int split_vma(struct mm_struct *mm, struct vma *vma, unsigned long addr, int new_below) {
     struct vma *new;
 
+    if (split_superpage_at(mm, addr) < 0) {
+        return -1;
+    }
+
     new = alloc_vma();
     if (!new) {
         // TODO, SLOB!!!!!
@@ -377,8 +444,10 @@ int split_vma(struct mm_struct *mm, struct vma *vma, unsigned long addr, int new
 
     if (new->vm_file)
         fat32_filedup(new->vm_file);
+    if (new->vm_inode)
+        new->vm_inode->i_op->idup(new->vm_inode);
 
-    if (add_vma_to_vmspace(&mm->head_vma, new) < 0) {
+    if (add_vma_to_vmspace(mm, new) < 0) {
         free_vma(new);
         Warn("split_vma: add_vma_to_vmspace failed");
         return -1;
@@ -0,0 +1,472 @@
+#include "common.h"
+#include "param.h"
+#include "atomic/spinlock.h"
+#include "atomic/cond.h"
+#include "atomic/semaphore.h"
+#include "lib/list.h"
+#include "lib/radix-tree.h"
+#include "lib/timer.h"
+#include "memory/allocator.h"
+#include "memory/buddy.h"
+#include "memory/vmscan.h"
+#include "memory/writeback.h"
+#include "fs/vfs/fs.h"
+#include "kernel/cpu.h"
+#include "proc/tcb_life.h"
+#include "debug.h"
+
+extern struct proc *initproc;
+
+// LRU of page cache, shared by all address_spaces
+// a new page goes into inactive list, it goes into active list when it is referenced twice.
+// kswapd keeps free pages between the watermarks, it evicts clean pages from the tail of
+// inactive list, and refills inactive list from the tail of active list.
+struct {
+    struct spinlock lock;
+    struct list_head active;
+    struct list_head inactive;
+    uint64 nr_active;
+    uint64 nr_inactive;
+
+    // statistics, protected by lock
+    uint64 scanned;     // pages isolated from inactive list
+    uint64 reclaimed;   // pages evicted
+    uint64 activated;   // inactive -> active
+    uint64 deactivated; // active -> inactive
+    uint64 busy;        // page under read, or its file is being read/written
+    uint64 dirty;       // dirty pages found, left to pdflush
+} lru;
+
+struct {
+    struct spinlock lock;
+    struct cond wait;
+    int started;
+    volatile int pending;   // somebody asks kswapd to run
+    uint64 runs;            // protected by lock
+    struct timer_list tick; // wake up kswapd for allocators holding spinlocks
+} kswapd_control;
+
+// statistics of compaction, protected by lru.lock
+struct {
+    uint64 runs;    // calls of compact_pages
+    uint64 success; // a free block was available after compaction
+    uint64 blocks;  // blocks chosen to be freed
+    uint64 evicted; // page cache pages evicted from the chosen blocks
+} compact_stat;
+
+// a page isolated from LRU, kswapd holds a reference of it
+struct reclaim_item {
+    struct page *page;
+    struct inode *ip;
+    struct address_space *mapping;
+    uint64 index;
+};
+
+void lru_init(void) {
+    initlock(&lru.lock, "lru_lock");
+    INIT_LIST_HEAD(&lru.active);
+    INIT_LIST_HEAD(&lru.inactive);
+    lru.nr_active = 0;
+    lru.nr_inactive = 0;
+}
+
+// page is new in page cache
+void lru_cache_add(struct page *page) {
+    acquire(&lru.lock);
+    ASSERT(!test_page_flags(page, PG_lru));
+    set_page_flags(page, PG_lru);
+    list_add(&page->lru, &lru.inactive);
+    lru.nr_inactive++;
+    release(&lru.lock);
+}
+
+// must hold lru.lock
+static void __lru_cache_del(struct page *page) {
+    list_del_reinit(&page->lru);
+    if (test_page_flags(page, PG_active)) {
+        clear_page_flags(page, PG_active);
+        lru.nr_active--;
+    } else {
+        lru.nr_inactive--;
+    }
+    clear_page_flags(page, PG_lru);
+}
+
+// page leaves page cache, or it is freed
+void lru_cache_del(struct page *page) {
+    acquire(&lru.lock);
+    if (test_page_flags(page, PG_lru)) {
+        __lru_cache_del(page);
+    }
+    release(&lru.lock);
+}
+
+// inactive, unreferenced -> inactive, referenced
+// inactive, referenced -> active, unreferenced
+void mark_page_accessed(struct page *page) {
+    if (!test_page_flags(page, PG_referenced)) {
+        set_page_flags(page, PG_referenced);
+        return;
+    }
+    if (test_page_flags(page, PG_active)) {
+        return;
+    }
+    acquire(&lru.lock);
+    if (test_page_flags(page, PG_lru) && !test_page_flags(page, PG_active)) {
+        list_move(&page->lru, &lru.active);
+        set_page_flags(page, PG_active);
+        clear_page_flags(page, PG_referenced);
+        lru.nr_inactive--;
+        lru.nr_active++;
+        lru.activated++;
+    }
+    release(&lru.lock);
+}
+
+// move pages from the tail of active list to inactive list
+// referenced pages get a second chance
+static void shrink_active_list(int nr) {
+    acquire(&lru.lock);
+    for (int i = 0; i < nr && !list_empty(&lru.active); i++) {
+        struct page *page = list_last_entry(&lru.active, struct page, lru);
+        if (test_page_flags(page, PG_referenced)) {
+            clear_page_flags(page, PG_referenced);
+            list_move(&page->lru, &lru.active);
+            continue;
+        }
+        list_move(&page->lru, &lru.inactive);
+        clear_page_flags(page, PG_active);
+        lru.nr_active--;
+        lru.nr_inactive++;
+        lru.deactivated++;
+    }
+    release(&lru.lock);
+}
+
+// must hold lru.lock, the page is on LRU and only page cache holds it
+// from now on, only page cache and the reclaimer hold it
+// kfree drops the last reference without lru.lock and takes the page off LRU after it,
+// so the reference is taken only if the page is still alive, return 0 if it is not
+static int isolate_lru_page(struct page *page, struct reclaim_item *item) {
+    if (!page_cache_get_unless_zero(page)) {
+        return 0;
+    }
+    __lru_cache_del(page);
+    // the mapping is alive as long as the page is in LRU
+    item->page = page;
+    item->mapping = page->mapping;
+    item->ip = page->mapping->host;
+    item->index = page->index;
+    return 1;
+}
+
+// put an isolated page back to the head of inactive list
+// if the page has left page cache, only kswapd holds it, so don't put it back
+static void putback_lru_page(struct page *page) {
+    acquire(&lru.lock);
+    if (atomic_read(&page->refcnt) > 1) {
+        set_page_flags(page, PG_lru);
+        list_add(&page->lru, &lru.inactive);
+        lru.nr_inactive++;
+    }
+    release(&lru.lock);
+}
+
+// try to remove a clean page from its page cache
+// readers of page cache hold i_read_lock, so we can't wait for it
+static int reclaim_page(struct reclaim_item *item) {
+    struct page *page = item->page;
+    struct inode *ip = item->ip;
+    int evict = 0;
+
+    if (!mutex_trylock(&ip->i_read_lock)) {
+        return 0;
+    }
+    acquire(&ip->tree_lock);
+    // the mapping may have been destroyed after the page was isolated,
+    // and a page mapped by filemap_fault has more references than page cache and kswapd
+    if (ip->i_mapping == item->mapping
+        && radix_tree_lookup_node(&item->mapping->page_tree, item->index) == page
+        && !test_page_flags(page, PG_dirty)
+        && atomic_read(&page->refcnt) == 2) {
+        radix_tree_delete(&item->mapping->page_tree, item->index);
+        item->mapping->nrpages--;
+        evict = 1;
+    }
+    release(&ip->tree_lock);
+    mutex_unlock(&ip->i_read_lock);
+
+    if (evict) {
+        kfree((void *)page_to_pa(page)); // reference of page cache
+    }
+    return evict;
+}
+
+// isolate at most nr pages from the tail of inactive list, and evict the clean ones
+// return the number of evicted pages
+static int shrink_inactive_list(int nr, int *nr_dirty) {
+    struct reclaim_item items[SWAP_CLUSTER_MAX];
+    int n = 0;
+    int reclaimed = 0;
+    int busy = 0;
+    int dirty = 0;
+
+    nr = MIN(nr, SWAP_CLUSTER_MAX);
+    acquire(&lru.lock);
+    for (int i = 0; n < nr && i < nr * 2 && !list_empty(&lru.inactive); i++) {
+        struct page *page = list_last_entry(&lru.inactive, struct page, lru);
+        if (atomic_read(&page->refcnt) != 1 || test_page_flags(page, PG_locked)) {
+            // held by a read
+            list_move(&page->lru, &lru.inactive);
+            busy++;
+            continue;
+        }
+        if (!isolate_lru_page(page, &items[n])) {
+            // being freed, kfree takes it off LRU
+            list_move(&page->lru, &lru.inactive);
+            busy++;
+            continue;
+        }
+        n++;
+    }
+    lru.scanned += n;
+    release(&lru.lock);
+
+    for (int i = 0; i < n; i++) {
+        struct page *page = items[i].page;
+        int evict = 0;
+        if (test_page_flags(page, PG_referenced)) {
+            // referenced once since it was added, rotate it
+            clear_page_flags(page, PG_referenced);
+        } else if (test_page_flags(page, PG_dirty)) {
+            dirty++;
+        } else if ((evict = reclaim_page(&items[i])) == 0) {
+            busy++;
+        }
+
+        if (evict) {
+            reclaimed++;
+        } else {
+            putback_lru_page(page);
+        }
+        kfree((void *)page_to_pa(page)); // reference of kswapd
+    }
+
+    acquire(&lru.lock);
+    lru.reclaimed += reclaimed;
+    lru.busy += busy;
+    lru.dirty += dirty;
+    release(&lru.lock);
+    *nr_dirty += dirty;
+    return reclaimed;
+}
+
+// reclaim until free pages reach the high watermark, or all pages have been scanned twice
+static void balance_pages(void) {
+    uint64 max_scan = 2 * (lru.nr_active + lru.nr_inactive);
+    uint64 scanned = 0;
+    int nr_dirty = 0;
+
+    while (nr_free_pages() < PAGES_WMARK_HIGH && scanned < max_scan) {
+        if (lru.nr_inactive < lru.nr_active) {
+            shrink_active_list(SWAP_CLUSTER_MAX);
+        }
+        if (lru.nr_inactive == 0) {
+            break;
+        }
+        shrink_inactive_list(SWAP_CLUSTER_MAX, &nr_dirty);
+        scanned += SWAP_CLUSTER_MAX;
+    }
+
+    if (nr_dirty > 0) {
+        // dirty pages can be reclaimed after they are written back
+        wakeup_bdflush(NULL);
+    }
+}
+
+// evict the clean page cache pages in [start, start + nr)
+// return the number of evicted pages
+static int evict_block(struct page *start, int nr) {
+    struct reclaim_item items[SWAP_CLUSTER_MAX];
+    int evicted = 0;
+
+    for (int i = 0; i < nr;) {
+        int n = 0;
+        acquire(&lru.lock);
+        for (; i < nr && n < SWAP_CLUSTER_MAX; i++) {
+            struct page *page = start + i;
+            if (test_page_flags(page, PG_lru) && atomic_read(&page->refcnt) == 1
+                && !test_page_flags(page, PG_locked) && !test_page_flags(page, PG_dirty)) {
+                if (isolate_lru_page(page, &items[n])) {
+                    n++;
+                }
+            }
+        }
+        release(&lru.lock);
+
+        for (int j = 0; j < n; j++) {
+            if (reclaim_page(&items[j])) {
+                evicted++;
+            } else {
+                putback_lru_page(items[j].page);
+            }
+            kfree((void *)page_to_pa(items[j].page)); // reference of reclaimer
+        }
+    }
+    return evicted;
+}
+
+// the block with the fewest page cache pages and no other used pages
+// (pages with refcnt 0 are free, or in a block whose first page is in use)
+static struct page *compact_find_block(uint64 order) {
+    int nr = 1 << order;
+    struct page *best = NULL;
+    int best_cnt = nr + 1;
+
+    for (int cpu = 0; cpu < NCPU; cpu++) {
+        struct phys_mem_pool *pool = &mempools[cpu];
+        int nr_pages = pool->mem_size / PGSIZE;
+        for (int off = 0; off + nr <= nr_pages; off += nr) {
+            struct page *start = pool->page_metadata + off;
+            int cnt = 0;
+            int i;
+            for (i = 0; i < nr; i++) {
+                struct page *page = start + i;
+                if (test_page_flags(page, PG_lru) && atomic_read(&page->refcnt) == 1
+                    && !test_page_flags(page, PG_dirty)) {
+                    cnt++;
+                } else if (atomic_read(&page->refcnt) != 0) {
+                    break;
+                }
+            }
+            if (i == nr && cnt > 0 && cnt < best_cnt) {
+                best = start;
+                best_cnt = cnt;
+            }
+        }
+    }
+    return best;
+}
+
+static int free_block_available(uint64 order) {
+    for (int cpu = 0; cpu < NCPU; cpu++) {
+        if (buddy_free_blocks(&mempools[cpu], order) > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// lumpy reclaim for large allocations (superpages)
+// page cache pages can't be migrated (we have no reverse mapping), but clean ones can be
+// evicted, so free the block of 2^order pages which needs the fewest evictions,
+// then buddy system merges it.
+// return 1 if there is a free block of 2^order pages now
+int compact_pages(uint64 order) {
+    int success = 0;
+    int blocks = 0;
+    int evicted = 0;
+
+    for (int try = 0; try < COMPACT_MAX_TRY; try++) {
+        // freed pages go to pcplist, they can't be merged there
+        drain_local_pages();
+        if ((success = free_block_available(order)) != 0) {
+            break;
+        }
+        struct page *start = compact_find_block(order);
+        if (start == NULL) {
+            break;
+        }
+        blocks++;
+        evicted += evict_block(start, 1 << order);
+    }
+
+    acquire(&lru.lock);
+    compact_stat.runs++;
+    compact_stat.success += success;
+    compact_stat.blocks += blocks;
+    compact_stat.evicted += evicted;
+    release(&lru.lock);
+    return success;
+}
+
+static void kswapd(void) {
+    // similar to thread_forkret
+    release(&thread_current()->lock);
+
+    acquire(&kswapd_control.lock);
+    for (;;) {
+        while (!kswapd_control.pending) {
+            cond_wait(&kswapd_control.wait, &kswapd_control.lock);
+        }
+        kswapd_control.pending = 0;
+        kswapd_control.runs++;
+        release(&kswapd_control.lock);
+
+        balance_pages();
+
+        acquire(&kswapd_control.lock);
+    }
+}
+
+static void __wakeup_kswapd(void) {
+    acquire(&kswapd_control.lock);
+    if (kswapd_control.pending) {
+        cond_signal(&kswapd_control.wait);
+    }
+    release(&kswapd_control.lock);
+}
+
+// in clock interrupt
+static void kswapd_tick(void *arg) {
+    if (kswapd_control.pending) {
+        __wakeup_kswapd();
+    }
+}
+
+// called by allocator when free pages are below the low watermark
+// the allocator may hold spinlocks (even the lock of a thread), then
+// it is not safe to wake up kswapd here, leave it to a timer of the next clock interrupt
+void wakeup_kswapd(void) {
+    if (!kswapd_control.started) {
+        return;
+    }
+    // claim it, only one cpu arms the tick timer
+    if (__sync_lock_test_and_set(&kswapd_control.pending, 1)) {
+        return;
+    }
+
+    push_off();
+    int nolock = (t_mycpu()->noff == 1);
+    pop_off();
+    if (nolock) {
+        __wakeup_kswapd();
+    } else {
+        add_timer_atomic(&kswapd_control.tick, 0, kswapd_tick, 0);
+    }
+}
+
+void kswapd_init(void) {
+    initlock(&kswapd_control.lock, "kswapd_lock");
+    cond_init(&kswapd_control.wait, "kswapd_wait");
+    kswapd_control.pending = 0;
+    kswapd_control.runs = 0;
+
+    create_thread(initproc, NULL, NULL, kswapd);
+
+    // armed by wakeup_kswapd, once
+    kswapd_control.tick.count = 0;
+    kswapd_control.tick.base = NULL;
+    INIT_LIST_HEAD(&kswapd_control.tick.list);
+
+    __sync_synchronize();
+    kswapd_control.started = 1;
+}
+
+// debug, statistics of page reclaim (racy, but it is enough)
+void lru_stat_print(void) {
+    printf("lru : %ld active, %ld inactive, %ld free pages\n", lru.nr_active, lru.nr_inactive, nr_free_pages());
+    printf("reclaim : %ld scanned, %ld reclaimed, %ld busy, %ld dirty\n", lru.scanned, lru.reclaimed, lru.busy, lru.dirty);
+    printf("lru move : %ld activated, %ld deactivated, kswapd runs %ld times\n", lru.activated, lru.deactivated, kswapd_control.runs);
+    printf("compact : %ld runs, %ld success, %ld blocks, %ld evicted\n", compact_stat.runs, compact_stat.success, compact_stat.blocks, compact_stat.evicted);
+}
@@ -876,25 +876,36 @@ void sdcard_disk_rw(struct bio_vec *bio_vec, int write) {
     uint nr_sec;
 
     sec = bio_vec->blockno_start * (BSIZE / 512);
-    nr_sec = bio_vec->block_len;
 
+    push_off();
+    // segments are transferred one by one, each of them is contiguous in memory
+    for (int i = 0; i < bio_vec->nseg; i++) {
+        struct bio_seg *seg = &bio_vec->segs[i];
+        uint sec_cur = sec;
+        nr_sec = seg->len / 512;
 #ifdef SIFIVE_U
-    sec *= BSIZE;
+        sec_cur *= BSIZE;
 #endif
-
-    push_off();
-    if (write) {
-        sdcard_disk_write(bio_vec->data, sec, nr_sec);
-    } else {
-        sdcard_disk_read(bio_vec->data, sec, nr_sec);
+        if (write) {
+            sdcard_disk_write(bio_seg_data(seg), sec_cur, nr_sec);
+        } else {
+            sdcard_disk_read(bio_seg_data(seg), sec_cur, nr_sec);
+        }
+        sec += nr_sec;
     }
     pop_off();
 
     return;
 }
 
-inline void disk_rw(void *bio_vec, int write, int type) {
-    sdcard_disk_rw((struct bio_vec *)bio_vec, write);
+// sdcard is synchronous, bio_vecs are done one by one
+void disk_submit_bio(struct bio *bio) {
+    struct bio_vec *vec_cur = NULL;
+    struct bio_vec *vec_tmp = NULL;
+    list_for_each_entry_safe(vec_cur, vec_tmp, &bio->list_entry, list) {
+        sdcard_disk_rw(vec_cur, bio->bi_rw);
+        bio_vec_endio(vec_cur);
+    }
 }
 
 void disk_init() {
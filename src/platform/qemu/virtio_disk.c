@@ -17,6 +17,7 @@
 #include "memory/allocator.h"
 #include "proc/pcb_life.h"
 #include "atomic/cond.h"
+#include "debug.h"
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
@@ -62,7 +63,6 @@ static struct disk {
     // for use when completion interrupt arrives.
     // indexed by first descriptor index of chain.
     struct {
-        struct buffer_head *b_old;
         struct bio_vec *b_new;
         char status;
     } info[NUM];
@@ -73,7 +73,9 @@ static struct disk {
 
     struct spinlock vdisk_lock;
 
+    // submitters waiting for free descriptors
     struct semaphore sem_disk;
+    int desc_waiters;
 
 } __attribute__((aligned(PGSIZE))) disk;
 
@@ -83,6 +85,7 @@ void virtio_disk_init(void) {
     initlock(&disk.vdisk_lock, "virtio_disk");
 
     sema_init(&disk.sem_disk, 0, "sem_disk");
+    disk.desc_waiters = 0;
 
     if (*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 || *R(VIRTIO_MMIO_VERSION) != 1 || *R(VIRTIO_MMIO_DEVICE_ID) != 2 || *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551) {
         panic("could not find virtio disk");
@@ -165,8 +168,6 @@ free_desc(int i) {
     disk.desc[i].flags = 0;
     disk.desc[i].next = 0;
     disk.free[i] = 1;
-    // wakeup(&disk.free[0]);
-    sema_signal(&disk.sem_disk);
 }
 
 // free a chain of descriptors.
@@ -183,11 +184,11 @@ free_chain(int i) {
     }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
+// a disk transfer uses one descriptor per segment, plus two.
 static int
-alloc3_desc(int *idx) {
-    for (int i = 0; i < 3; i++) {
+alloc_n_desc(int *idx, int n) {
+    for (int i = 0; i < n; i++) {
         idx[i] = alloc_desc();
         if (idx[i] < 0) {
             for (int j = 0; j < i; j++)
@@ -198,40 +199,15 @@ alloc3_desc(int *idx) {
     return 0;
 }
 
-// b is a pointer to struct bio_vec
-void virtio_disk_rw(void *b, int write, int type) {
-    uint64 sector;
-    struct buffer_head *b_old = NULL;
-    struct bio_vec *b_new = NULL;
-    if (type == BLOCK_OLD) {
-        // we don't use this
-        b_old = (struct buffer_head *)b;
-        sector = b_old->blockno * (BSIZE / 512);
-    } else if (type == BLOCK_NEW) {
-        b_new = (struct bio_vec *)b;
-        sector = b_new->blockno_start * (BSIZE / 512);
-    } else {
-        panic("error\n");
-    }
-
-    acquire(&disk.vdisk_lock);
+// format the descriptors of vec and put its chain into the avail ring.
+// the device is not notified here.
+// must hold vdisk_lock
+static void virtio_disk_queue(int *idx, struct bio_vec *b_new, int write) {
     // the spec's Section 5.2 says that legacy block operations use
-    // three descriptors: one for type/reserved/sector, one for the
-    // data, one for a 1-byte status result.
-
-    // allocate the three descriptors.
-    int idx[3];
-    while (1) {
-        if (alloc3_desc(idx) == 0) {
-            break;
-        }
-        release(&disk.vdisk_lock);
-        sema_wait(&disk.sem_disk);
-        acquire(&disk.vdisk_lock);
-    }
-
-    // format the three descriptors.
+    // descriptors: one for type/reserved/sector, one for each
+    // piece of data, one for a 1-byte status result.
     // qemu's virtio-blk.c reads them.
+    int nseg = b_new->nseg;
 
     struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
 
@@ -240,49 +216,34 @@ void virtio_disk_rw(void *b, int write, int type) {
     else
         buf0->type = VIRTIO_BLK_T_IN; // read the disk
     buf0->reserved = 0;
-    buf0->sector = sector;
+    buf0->sector = b_new->blockno_start * (BSIZE / 512);
 
     disk.desc[idx[0]].addr = (uint64)buf0;
     disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
     disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
     disk.desc[idx[0]].next = idx[1];
 
-    if (type == BLOCK_OLD) {
-        // we don't use this
-        disk.desc[idx[1]].addr = (uint64)b_old->data;
-        disk.desc[idx[1]].len = BSIZE;
-    } else if (type == BLOCK_NEW) {
-        disk.desc[idx[1]].addr = (uint64)b_new->data;
-        disk.desc[idx[1]].len = BSIZE * (b_new->block_len);
-    } else {
-        panic("error\n");
+    for (int i = 1; i <= nseg; i++) {
+        struct bio_seg *seg = &b_new->segs[i - 1];
+        disk.desc[idx[i]].addr = (uint64)bio_seg_data(seg);
+        disk.desc[idx[i]].len = seg->len;
+        if (write)
+            disk.desc[idx[i]].flags = 0; // device reads the segment
+        else
+            disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes the segment
+        disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+        disk.desc[idx[i]].next = idx[i + 1];
     }
 
-    if (write)
-        disk.desc[idx[1]].flags = 0; // device reads b->data
-    else
-        disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-    disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-    disk.desc[idx[1]].next = idx[2];
-
     disk.info[idx[0]].status = 0xff; // device writes 0 on success
-    disk.desc[idx[2]].addr = (uint64)&disk.info[idx[0]].status;
-    disk.desc[idx[2]].len = 1;
-    disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-    disk.desc[idx[2]].next = 0;
-
-    // record struct buffer_head for virtio_disk_intr().
-
-    if (type == BLOCK_OLD) {
-        // we don't use this
-        b_old->disk = 1;
-        disk.info[idx[0]].b_old = b_old;
-    } else if (type == BLOCK_NEW) {
-        b_new->disk = 1;
-        disk.info[idx[0]].b_new = b_new;
-    } else {
-        panic("error\n");
-    }
+    disk.desc[idx[nseg + 1]].addr = (uint64)&disk.info[idx[0]].status;
+    disk.desc[idx[nseg + 1]].len = 1;
+    disk.desc[idx[nseg + 1]].flags = VRING_DESC_F_WRITE; // device writes the status
+    disk.desc[idx[nseg + 1]].next = 0;
+
+    // record struct bio_vec for virtio_disk_intr().
+    b_new->disk = 1;
+    disk.info[idx[0]].b_new = b_new;
 
     // tell the device the first index in our chain of descriptors.
     disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -291,38 +252,48 @@ void virtio_disk_rw(void *b, int write, int type) {
 
     // tell the device another avail ring entry is available.
     disk.avail->idx += 1; // not % NUM ...
+}
 
+static inline void virtio_disk_notify(void) {
     __sync_synchronize();
-
     *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
-    // Wait for virtio_disk_intr() to say request has finished.
+// put all bio_vecs of bio into the avail ring, and notify the device once.
+// it doesn't wait, virtio_disk_intr() calls bio_vec_endio() for every bio_vec.
+void virtio_disk_submit(struct bio *bio) {
+    struct bio_vec *b_new = NULL;
+    int write = (bio->bi_rw == DISK_WRITE);
+    int pending = 0; // queued, but not notified
 
-    if (type == BLOCK_OLD) {
-        while (b_old->disk == 1) {
-            // we don't use this
-            release(&disk.vdisk_lock);
-            sema_wait(&b_old->sem_disk_done);
-            acquire(&disk.vdisk_lock);
-        }
-        disk.info[idx[0]].b_old = 0;
-    } else if (type == BLOCK_NEW) {
-        while (b_new->disk == 1) {
+    acquire(&disk.vdisk_lock);
+    list_for_each_entry(b_new, &bio->list_entry, list) {
+        // allocate the descriptors.
+        int idx[BIO_MAX_SEGS + 2];
+        ASSERT(b_new->nseg > 0 && b_new->nseg <= BIO_MAX_SEGS);
+        while (alloc_n_desc(idx, b_new->nseg + 2) != 0) {
+            // the ring is full, let the device work on what we have queued
+            if (pending) {
+                virtio_disk_notify();
+                pending = 0;
+            }
+            disk.desc_waiters++;
             release(&disk.vdisk_lock);
-            sema_wait(&b_new->sem_disk_done);
+            sema_wait(&disk.sem_disk);
             acquire(&disk.vdisk_lock);
         }
-        disk.info[idx[0]].b_new = 0;
-    } else {
-        panic("error\n");
+        virtio_disk_queue(idx, b_new, write);
+        pending++;
+    }
+    if (pending) {
+        virtio_disk_notify();
     }
-
-    free_chain(idx[0]);
-
     release(&disk.vdisk_lock);
 }
 
 void virtio_disk_intr() {
+    struct bio_vec *done = NULL;
+
     acquire(&disk.vdisk_lock);
 
     // the device won't raise another interrupt until we tell it
@@ -345,27 +316,35 @@ void virtio_disk_intr() {
         if (disk.info[id].status != 0)
             panic("virtio_disk_intr status");
 
-        if (BLOCK_SEL == BLOCK_OLD) {
-            // we don't use this
-            struct buffer_head *b_old = disk.info[id].b_old;
-            b_old->disk = 0; // disk is done with buf
-            sema_signal(&b_old->sem_disk_done);
-        } else if (BLOCK_SEL == BLOCK_NEW) {
-            struct bio_vec *b_new = disk.info[id].b_new;
-            b_new->disk = 0; // disk is done with buf
-            sema_signal(&b_new->sem_disk_done);
-        } else {
-            panic("error\n");
-        }
+        struct bio_vec *b_new = disk.info[id].b_new;
+        disk.info[id].b_new = 0;
+        free_chain(id);
+        b_new->disk = 0; // disk is done with buf
+        b_new->done_next = done;
+        done = b_new;
 
         disk.used_idx += 1;
     }
 
+    // descriptors are freed, wake up submitters
+    while (disk.desc_waiters > 0) {
+        disk.desc_waiters--;
+        sema_signal(&disk.sem_disk);
+    }
+
     release(&disk.vdisk_lock);
+
+    // complete bio_vecs without holding vdisk_lock,
+    // so that end_io of bio is allowed to submit new requests
+    while (done != NULL) {
+        struct bio_vec *b_new = done;
+        done = done->done_next;
+        bio_vec_endio(b_new);
+    }
 }
 
-inline void disk_rw(void *b, int write, int type) {
-    virtio_disk_rw(b, write, type);
+inline void disk_submit_bio(struct bio *bio) {
+    virtio_disk_submit(bio);
 }
 
 inline void disk_intr() {
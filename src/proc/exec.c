@@ -22,7 +22,7 @@ static int map_interpreter(struct mm_struct *mm);
 static int load_elf_interp(char *path);
 static Elf64_Ehdr *load_elf_ehdr(struct binprm *bprm);
 static Elf64_Phdr *load_elf_phdrs(const Elf64_Ehdr *elf_ex, struct inode *ip);
-static int load_program(struct binprm *bprm, Elf64_Phdr *elf_phdata);
+static int load_program(struct binprm *bprm, Elf64_Phdr *elf_phdata, int lazy);
 static uint64 START = 0;
 
 struct interpreter ldso;
@@ -88,31 +88,49 @@ int clear_bss(uint64 elf_bss, uint64 last_bss) {
     return 0;
 }
 
-static int load_elf_interp(char *path) {
-    // if (ldso.valid == 1) {
-    //     clear_bss(ldso.elf_bss, ldso.last_bss);
-    //     return 0;
-    // }
+void ldso_cache_init(void) {
+    mutex_init(&ldso.lock, "ldso");
+}
 
+/* drop the cached image, the processes mapping it keep their references of the pages */
+static void free_elf_interp(void) {
+    free_mm(ldso.mm, 0);
+    ldso.ip->i_op->iput(ldso.ip);
+    ldso.mm = NULL;
+    ldso.ip = NULL;
+    ldso.valid = 0;
+}
+
+/* load the interpreter into ldso, unless the cached image is still the one of path.
+ * holding ldso.lock */
+static int load_elf_interp(char *path) {
     struct binprm bprm;
-    Elf64_Ehdr *elf_ex;
-    Elf64_Phdr *elf_phdata; /* ph poiner */
+    Elf64_Ehdr *elf_ex = NULL;
+    Elf64_Phdr *elf_phdata = NULL; /* ph poiner */
     struct inode *ip = NULL;
-
-    struct mm_struct *mm;
-    mm = ldso.mm = bprm.mm = alloc_mm();
-    if (mm == NULL) {
-        Warn("alloc_mm failed");
-        goto bad;
-    }
+    struct mm_struct *mm = NULL;
 
     if ((ip = namei(path)) == 0) {
         Warn("path not found!");
+        return -1;
+    }
+    ip->i_op->ilock(ip);
+    if (ldso.valid && ldso.ip == ip && ldso.version == ip->i_version) {
+        ip->i_op->iunlock_put(ip);
+        return 0;
+    }
+    if (ldso.valid) {
+        free_elf_interp();
+    }
+
+    memset(&bprm, 0, sizeof(bprm));
+    mm = bprm.mm = alloc_mm();
+    if (mm == NULL) {
+        Warn("alloc_mm failed");
         goto bad;
     }
     bprm.ip = ip;
 
-    ip->i_op->ilock(ip);
     if ((elf_ex = load_elf_ehdr(&bprm)) == NULL) {
         Warn("load_elf_ehdr failed");
         goto bad;
@@ -124,28 +142,35 @@ static int load_elf_interp(char *path) {
         goto bad;
     }
 
-    if (load_program(&bprm, elf_phdata) < 0) {
+    /* map_interpreter shares the pages of ldso, they must be present */
+    if (load_program(&bprm, elf_phdata, 0) < 0) {
         Warn("load_program failed");
         goto bad;
     }
-    ldso.last_bss = bprm.last_bss;
-    ldso.elf_bss = bprm.elf_bss;
 
-    ip->i_op->iunlock_put(ip);
-    ip = 0;
+    /* keep the reference of ip, the inode can't be reused by another file while it is cached */
+    ip->i_op->iunlock(ip);
+    ldso.ip = ip;
+    ldso.version = ip->i_version;
+    ldso.mm = mm;
     ldso.size = bprm.size;
     ldso.entry = elf_ex->e_entry;
-    ldso.valid = 1;
-    // vmprint(ldso.pagetable, 1, 0, 0, 0);
     ldso.last_bss = bprm.last_bss;
     ldso.elf_bss = bprm.elf_bss;
+    ldso.valid = 1;
+    // vmprint(ldso.pagetable, 1, 0, 0, 0);
+    kfree(elf_phdata);
+    kfree(elf_ex);
 
     return 0;
 
 bad:
-    // TODO: error handler
-    // proc_freepagetable(mm->pagetable, sz, 0);
-    // free_mm(mm);
+    if (elf_phdata != NULL)
+        kfree(elf_phdata);
+    if (elf_ex != NULL)
+        kfree(elf_ex);
+    if (mm != NULL)
+        free_mm(mm, 0);
     ip->i_op->iunlock_put(ip);
     return -1;
 }
@@ -161,12 +186,14 @@ static int map_interpreter(struct mm_struct *mm) {
     int flags;
     for (vaddr_t i = 0; i < ldso.size; i += PGSIZE, ldva += PGSIZE) {
         walk(ldso_pagetable, i, 0, 0, &pte);
-        flags = PTE_FLAGS(*pte);
+        /* copy-on-write, the cached image is never written by a process */
+        flags = (PTE_FLAGS(*pte) & ~PTE_W) | PTE_SHARE;
         ldpa = PTE2PA(*pte);
         if (mappages(src_pagetable, ldva, PGSIZE, ldpa, flags, 0) < 0) {
             Warn("mappages failed");
             return -1;
         }
+        share_page(ldpa);
     }
 
     struct vma *pos;
@@ -473,8 +500,86 @@ out:
     return NULL;
 }
 
-/* support misaligned va load */
-static int load_program(struct binprm *bprm, Elf64_Phdr *elf_phdata) {
+/* read a PT_LOAD segment into memory now, support misaligned va load */
+static int load_segment(struct mm_struct *mm, struct inode *ip, Elf64_Phdr *elf_phpnt, uint64 *sz) {
+    /* offset: start offset in misaligned page
+       size: read size of misaligned page
+    */
+    uint64 offset = 0, size = 0;
+    vaddr_t vaddrdown = PGROUNDDOWN(elf_phpnt->p_vaddr);
+    if (elf_phpnt->p_vaddr % PGSIZE != 0) {
+        // Warn("%p", vaddrdown);
+        paddr_t pa = (paddr_t)kmalloc(PGSIZE);
+#ifdef __DEBUG_LDSO__
+        if (mappages(mm->pagetable, START + vaddrdown, PGSIZE, pa, flags2perm(elf_phpnt->p_flags) | PTE_U, COMMONPAGE) < 0) {
+#else
+        if (mappages(mm->pagetable, vaddrdown, PGSIZE, pa, flags2perm(elf_phpnt->p_flags) | PTE_U, COMMONPAGE) < 0) {
+#endif
+            Warn("misaligned load mappages failed");
+            kfree((void *)pa);
+            return -1;
+        }
+        offset = elf_phpnt->p_vaddr - vaddrdown;
+        size = PGROUNDUP(elf_phpnt->p_vaddr) - elf_phpnt->p_vaddr;
+        if (ip->i_op->iread(ip, 0, (uint64)pa + offset, elf_phpnt->p_offset, size) != size) {
+            return -1;
+        }
+        // Log("entry is %p", elf.entry);
+    } else {
+        ASSERT(vaddrdown == elf_phpnt->p_vaddr);
+    }
+    uint64 sz1;
+    ASSERT((elf_phpnt->p_vaddr + size) % PGSIZE == 0);
+    // Log("\nstart end:%p %p", ph.vaddr + size, ph.vaddr + ph.memsz);
+#ifdef __DEBUG_LDSO__
+    if ((sz1 = uvmalloc(mm->pagetable, START + elf_phpnt->p_vaddr + size, START + elf_phpnt->p_vaddr + elf_phpnt->p_memsz, flags2perm(elf_phpnt->p_flags))) == 0)
+#else
+    if ((sz1 = uvmalloc(mm->pagetable, elf_phpnt->p_vaddr + size, elf_phpnt->p_vaddr + elf_phpnt->p_memsz, flags2perm(elf_phpnt->p_flags))) == 0)
+#endif
+        return -1;
+    // vmprint(mm->pagetable, 1, 0, 0, 0);
+    *sz = sz1;
+#ifdef __DEBUG_LDSO__
+    if (loadseg(mm->pagetable, elf_phpnt->p_vaddr + size + START, ip, elf_phpnt->p_offset + size, elf_phpnt->p_filesz - size) < 0)
+        return -1;
+#else
+    if (loadseg(mm->pagetable, elf_phpnt->p_vaddr + size, ip, elf_phpnt->p_offset + size, elf_phpnt->p_filesz - size) < 0)
+        return -1;
+#endif
+
+    vaddr_t vaddrup = PGROUNDUP(elf_phpnt->p_vaddr + elf_phpnt->p_memsz);
+#ifdef __DEBUG_LDSO__
+    if (vma_map(mm, START + vaddrdown, vaddrup - vaddrdown, flags2vmaperm(elf_phpnt->p_flags), VMA_TEXT) < 0) {
+#else
+    if (vma_map(mm, vaddrdown, vaddrup - vaddrdown, flags2vmaperm(elf_phpnt->p_flags), VMA_TEXT) < 0) {
+#endif
+        return -1;
+    }
+
+    return 0;
+}
+
+/* map a PT_LOAD segment, pagefault() reads its pages from the page cache of ip on demand */
+static int map_segment(struct mm_struct *mm, struct inode *ip, Elf64_Phdr *elf_phpnt, uint64 *sz) {
+    vaddr_t base = 0;
+#ifdef __DEBUG_LDSO__
+    base = START;
+#endif
+    vaddr_t vaddrdown = PGROUNDDOWN(elf_phpnt->p_vaddr);
+    vaddr_t vaddrup = PGROUNDUP(elf_phpnt->p_vaddr + elf_phpnt->p_memsz);
+
+    if (vma_map_elf(mm, base + vaddrdown, vaddrup - vaddrdown, flags2vmaperm(elf_phpnt->p_flags),
+                    elf_phpnt->p_offset - ELF_PAGEOFFSET(elf_phpnt->p_vaddr), ip,
+                    base + elf_phpnt->p_vaddr + elf_phpnt->p_filesz)
+        < 0) {
+        return -1;
+    }
+    *sz = base + elf_phpnt->p_vaddr + elf_phpnt->p_memsz;
+    return 0;
+}
+
+/* lazy: map the segments on demand, or load them now (the interpreter) */
+static int load_program(struct binprm *bprm, Elf64_Phdr *elf_phdata, int lazy) {
     Elf64_Ehdr *elf_ex = bprm->elf_ex;
     Elf64_Phdr *elf_phpnt = elf_phdata;
     struct mm_struct *mm = bprm->mm;
@@ -491,58 +596,13 @@ static int load_program(struct binprm *bprm, Elf64_Phdr *elf_phdata) {
         if (elf_phpnt->p_vaddr + elf_phpnt->p_memsz < elf_phpnt->p_vaddr)
             return -1;
 
-        /* offset: start offset in misaligned page
-           size: read size of misaligned page
-        */
-        uint64 offset = 0, size = 0;
-        vaddr_t vaddrdown = PGROUNDDOWN(elf_phpnt->p_vaddr);
-        if (elf_phpnt->p_vaddr % PGSIZE != 0) {
-            // Warn("%p", vaddrdown);
-            paddr_t pa = (paddr_t)kmalloc(PGSIZE);
-#ifdef __DEBUG_LDSO__
-            if (mappages(mm->pagetable, START + vaddrdown, PGSIZE, pa, flags2perm(elf_phpnt->p_flags) | PTE_U, COMMONPAGE) < 0) {
-#else
-            if (mappages(mm->pagetable, vaddrdown, PGSIZE, pa, flags2perm(elf_phpnt->p_flags) | PTE_U, COMMONPAGE) < 0) {
-#endif
-                Warn("misaligned load mappages failed");
-                kfree((void *)pa);
+        /* a page can be mapped from the page cache only if p_vaddr and p_offset are congruent */
+        if (lazy && ELF_PAGEOFFSET(elf_phpnt->p_vaddr) == ELF_PAGEOFFSET(elf_phpnt->p_offset)) {
+            if (map_segment(mm, ip, elf_phpnt, &sz) < 0)
                 return -1;
-            }
-            offset = elf_phpnt->p_vaddr - vaddrdown;
-            size = PGROUNDUP(elf_phpnt->p_vaddr) - elf_phpnt->p_vaddr;
-            if (ip->i_op->iread(ip, 0, (uint64)pa + offset, elf_phpnt->p_offset, size) != size) {
-                return -1;
-            }
-            // Log("entry is %p", elf.entry);
         } else {
-            ASSERT(vaddrdown == elf_phpnt->p_vaddr);
-        }
-        uint64 sz1;
-        ASSERT((elf_phpnt->p_vaddr + size) % PGSIZE == 0);
-        // Log("\nstart end:%p %p", ph.vaddr + size, ph.vaddr + ph.memsz);
-#ifdef __DEBUG_LDSO__
-        if ((sz1 = uvmalloc(mm->pagetable, START + elf_phpnt->p_vaddr + size, START + elf_phpnt->p_vaddr + elf_phpnt->p_memsz, flags2perm(elf_phpnt->p_flags))) == 0)
-#else
-        if ((sz1 = uvmalloc(mm->pagetable, elf_phpnt->p_vaddr + size, elf_phpnt->p_vaddr + elf_phpnt->p_memsz, flags2perm(elf_phpnt->p_flags))) == 0)
-#endif
-            return -1;
-        // vmprint(mm->pagetable, 1, 0, 0, 0);
-        sz = sz1;
-#ifdef __DEBUG_LDSO__
-        if (loadseg(mm->pagetable, elf_phpnt->p_vaddr + size + START, ip, elf_phpnt->p_offset + size, elf_phpnt->p_filesz - size) < 0)
-            return -1;
-#else
-        if (loadseg(mm->pagetable, elf_phpnt->p_vaddr + size, ip, elf_phpnt->p_offset + size, elf_phpnt->p_filesz - size) < 0)
-            return -1;
-#endif
-
-        vaddr_t vaddrup = PGROUNDUP(elf_phpnt->p_vaddr + elf_phpnt->p_memsz);
-#ifdef __DEBUG_LDSO__
-        if (vma_map(mm, START + vaddrdown, vaddrup - vaddrdown, flags2vmaperm(elf_phpnt->p_flags), VMA_TEXT) < 0) {
-#else
-        if (vma_map(mm, vaddrdown, vaddrup - vaddrdown, flags2vmaperm(elf_phpnt->p_flags), VMA_TEXT) < 0) {
-#endif
-            return -1;
+            if (load_segment(mm, ip, elf_phpnt, &sz) < 0)
+                return -1;
         }
 
         uint64 tmp;
@@ -602,7 +662,7 @@ static int load_elf_binary(struct binprm *bprm) {
         }
     }
 
-    if (load_program(bprm, elf_phdata) < 0) {
+    if (load_program(bprm, elf_phdata, 1) < 0) {
         goto bad;
     }
 
@@ -613,8 +673,13 @@ static int load_elf_binary(struct binprm *bprm) {
     for (int i = 0; i < elf_ex->e_phnum; i++, elf_phpnt++) {
         if (elf_phpnt->p_type != PT_INTERP)
             continue;
-        load_elf_interp("/libc.so");
-        map_interpreter(bprm->mm);
+        mutex_lock(&ldso.lock);
+        if (load_elf_interp("/libc.so") < 0 || map_interpreter(bprm->mm) < 0) {
+            mutex_unlock(&ldso.lock);
+            goto bad;
+        }
+        bprm->interp_entry = ldso.entry;
+        mutex_unlock(&ldso.lock);
         bprm->interp = 1;
         break;
     }
@@ -712,7 +777,7 @@ int do_execve(char *path, struct binprm *bprm) {
     t->trapframe->a1 = bprm->a1;
     t->trapframe->a2 = bprm->a2;
     if (bprm->interp) {
-        t->trapframe->epc = ldso.entry + LDSO;
+        t->trapframe->epc = bprm->interp_entry + LDSO;
     } else {
         t->trapframe->epc = bprm->e_entry;
     }
@@ -726,6 +791,10 @@ int do_execve(char *path, struct binprm *bprm) {
     }
     // uvm_thread_trapframe(mm->pagetable, 0);
 
+    /* a vfork child gives the memory back to its parent, and frees its own */
+    vfork_release(p);
+    oldmm = p->mm;
+
     /* free the old pagetable */
     free_mm(oldmm, atomic_read(&p->tg->thread_cnt));
 
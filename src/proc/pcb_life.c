@@ -30,7 +30,6 @@
 #include "test.h"
 
 extern Queue_t unused_p_q, used_p_q, zombie_p_q;
-extern Queue_t unused_t_q, runnable_t_q, sleeping_t_q;
 extern Queue_t *STATES[PCB_STATEMAX];
 extern struct tcb thread[NTCB];
 extern struct hash_table pid_map;
@@ -159,6 +158,12 @@ struct proc *alloc_proc(void) {
     sema_init(&p->sem_wait_chan_parent, 0, "wait_parent");
     sema_init(&p->sem_wait_chan_self, 0, "wait_self");
 
+    // vfork
+    p->vfork = 0;
+    p->vfork_mm = NULL;
+    p->vfork_trapframe = 0;
+    sema_init(&p->sem_vfork, 0, "vfork");
+
     // map <pid, p>
     hash_insert(&pid_map, (void *)&(p->pid), (void *)p, 0); // not holding it
     return p;
@@ -265,8 +270,7 @@ void init_ret(void) {
 
 // find the proc we search using hash map
 inline struct proc *find_get_pid(pid_t pid) {
-    struct hash_node *node = hash_lookup(&pid_map, (void *)&pid, NULL, 1, 0); // realese it, not holiding it
-    return node != NULL ? (struct proc *)(node->value) : NULL;
+    return (struct proc *)hash_find(&pid_map, (void *)&pid); // lock-free
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -282,12 +286,49 @@ void thread_forkret(void) {
     thread_usertrapret();
 }
 
+// vfork: the child runs in the memory of its parent until it execs or exits, nothing is copied.
+// the trapframe of the child takes the place of the parent's in the pagetable,
+// so the parent must be single-threaded and sleep meanwhile.
+// the parent can't exit before the release (see do_clone), so its mm outlives the borrow
+static void vfork_borrow_mm(struct proc *p, struct proc *np, struct tcb *t) {
+    np->vfork_mm = np->mm;
+    np->vfork_trapframe = (uint64)p->tg->group_leader->trapframe;
+    np->mm = p->mm;
+    acquire(&p->mm->lock);
+    uvmunmap(p->mm->pagetable, TRAPFRAME, 1, 0, 0);
+    if (mappages(p->mm->pagetable, TRAPFRAME, PGSIZE, (uint64)t->trapframe, PTE_R | PTE_W, 0) < 0) {
+        panic("vfork_borrow_mm: map failed");
+    }
+    release(&p->mm->lock);
+}
+
+// the vfork child execs or exits, give the memory back and wake up the parent
+void vfork_release(struct proc *p) {
+    if (p->vfork_mm != NULL) {
+        struct mm_struct *mm = p->mm;
+        acquire(&mm->lock);
+        uvmunmap(mm->pagetable, TRAPFRAME, 1, 0, 0);
+        if (mappages(mm->pagetable, TRAPFRAME, PGSIZE, p->vfork_trapframe, PTE_R | PTE_W, 0) < 0) {
+            panic("vfork_release: map failed");
+        }
+        release(&mm->lock);
+        p->mm = p->vfork_mm;
+        p->vfork_mm = NULL;
+        p->vfork_trapframe = 0;
+    }
+    if (p->vfork) {
+        p->vfork = 0;
+        sema_signal(&p->sem_vfork);
+    }
+}
+
 int do_clone(uint64 flags, vaddr_t stack, uint64 ptid, uint64 tls, uint64 ctid) {
     // printfGreen("clone start, mm: %d pages\n", get_free_mem()/4096);
     int pid;
     struct proc *p = proc_current();
     struct proc *np = NULL;
     struct tcb *t = NULL;
+    int borrowed = 0;
 
     // print_clone_flags(flags);
     if (flags & CLONE_THREAD) {
@@ -358,28 +399,33 @@ int do_clone(uint64 flags, vaddr_t stack, uint64 ptid, uint64 tls, uint64 ctid)
     }
     // ==============create proc with group leader=======================
     acquire(&p->lock);
-    /* Copy vma */
-    // print_vma(&p->mm->head_vma);
-    if (vmacopy(p->mm, np->mm) < 0) {
-        free_proc(np);
-        release(&p->lock);
-        release(&np->lock);
-        return -1;
-    }
-    // Copy user memory from parent to child.
-    if (flags & CLONE_VM) {
-        np->mm->pagetable = p->mm->pagetable;
+    if ((flags & CLONE_VM) && (flags & CLONE_VFORK) && atomic_read(&p->tg->thread_cnt) == 1) {
+        vfork_borrow_mm(p, np, t);
+        borrowed = 1;
     } else {
+        /* Copy vma */
+        // print_vma(&p->mm->head_vma);
+        if (vmacopy(p->mm, np->mm) < 0) {
+            free_proc(np);
+            release(&p->lock);
+            release(&np->lock);
+            return -1;
+        }
+        // Copy user memory from parent to child, copy-on-write.
+        // CLONE_VM is copied too unless vfork, the trapframes of two processes can't share a pagetable
         if (uvmcopy(p->mm, np->mm) < 0) {
             free_proc(np);
             release(&p->lock);
             release(&np->lock);
             return -1;
         }
-    }
 
-    np->mm->start_brk = p->mm->start_brk;
-    np->mm->brk = p->mm->brk;
+        np->mm->start_brk = p->mm->start_brk;
+        np->mm->brk = p->mm->brk;
+    }
+    if (flags & CLONE_VFORK) {
+        np->vfork = 1;
+    }
     release(&p->lock);
     // increment reference counts on open file descriptors.
     if (flags & CLONE_FILES) {
@@ -411,6 +457,13 @@ int do_clone(uint64 flags, vaddr_t stack, uint64 ptid, uint64 tls, uint64 ctid)
     acquire(&t->lock);
     TCB_Q_changeState(t, TCB_RUNNABLE);
     release(&t->lock);
+
+    if (borrowed) {
+        // the child runs in our mm, a kill is handled after it gives the mm back
+        sema_wait_uninterruptible(&np->sem_vfork);
+    } else if (flags & CLONE_VFORK) {
+        sema_wait(&np->sem_vfork);
+    }
     return pid;
 }
 
@@ -419,6 +472,8 @@ int exit_process(int status) {
     if (p == initproc)
         panic("init exiting");
 
+    vfork_release(p);
+
     // private to proc, no need to acquire
     for (int fd = 0; fd < NOFILE; fd++) {
         if (p->ofile[fd]) {
@@ -455,7 +510,7 @@ void exit_wakeup(struct proc *p, struct tcb *t) {
         int val = 0;
         if (copyout(p->mm->pagetable, t->clear_child_tid, (char *)&val, sizeof(val)))
             panic("exit error\n");
-        futex_wakeup(t->clear_child_tid, 1);
+        futex_wakeup(t->clear_child_tid, FLAGS_SHARED, 1, FUTEX_BITSET_MATCH_ANY);
     }
 }
 
@@ -528,6 +583,7 @@ int waitpid(pid_t pid, uint64 status, int options) {
         struct proc *p_tmp = NULL;
         struct proc *p_first = firstchild(p);
         int flag = 1;
+        int exit_state;
         list_for_each_entry_safe_given_first(p_child, p_tmp, p_first, sibling_list, flag) {
             // shell won't exit !!!
             if (pid > 0 && p_child->pid == pid) {
@@ -539,10 +595,8 @@ int waitpid(pid_t pid, uint64 status, int options) {
             acquire(&p_child->lock);
             if (p_child->state == PCB_ZOMBIE) {
                 pid = p_child->pid;
-                if (status != 0 && copyout(p->mm->pagetable, status, (char *)&(p_child->exit_state), sizeof(p_child->exit_state)) < 0) {
-                    release(&p_child->lock);
-                    return -1;
-                }
+                // copied out after p_child->lock, a fault on status may sleep
+                exit_state = p_child->exit_state;
                 // ASSERT(list_empty(&p_child->tg->threads)); // !!!
                 free_proc(p_child);
 
@@ -555,6 +609,9 @@ int waitpid(pid_t pid, uint64 status, int options) {
 #ifdef __DEBUG_PROC__
                 printfBlue("wait : %d delete %d\n", p->pid, pid); // debug
 #endif
+                if (status != 0 && copyout(p->mm->pagetable, status, (char *)&exit_state, sizeof(exit_state)) < 0) {
+                    return -1;
+                }
                 return pid;
             }
             release(&p_child->lock);
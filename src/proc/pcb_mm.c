@@ -102,29 +102,8 @@ int growheap(int n) {
     }
 
     if (n > 0) {
-        pte_t *pte;
-        int level = walk(mm->pagetable, oldsz, 0, 0, &pte);
-        if (pte == NULL && level != -1) {
-            panic("growheap: wrong");
-        }
-        ASSERT(level <= 1);
-        if (level == COMMONPAGE) {
-            if (PGROUNDUP(oldsz) >= newsz) {
-                mm->brk = newsz;
-                return 0;
-            }
-        } else if (level == SUPERPAGE) {
-            if (SUPERPG_ROUNDUP(oldsz) >= newsz) {
-                mm->brk = newsz;
-                return 0;
-            }
-        } else if (level != -1) {
-            panic("growheap: wrong level");
-        }
-
-        if ((sz = uvmalloc(mm->pagetable, oldsz, newsz, PTE_W | PTE_R)) == 0) {
-            return -1;
-        }
+        // only the heap vma grows, pagefault() supplies the pages on first touch
+        sz = newsz;
     } else if (n < 0) {
         sz = uvmdealloc(mm->pagetable, oldsz, newsz);
     }
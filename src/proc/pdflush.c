@@ -15,8 +15,10 @@ void pdflush_init() {
     INIT_LIST_HEAD(&pdflush_control.entry);
     cond_init(&pdflush_control.pdflush_cond, "pdflush_cond");
 
-    for (int i = 0; i < MIN_PDFLUSH_THREADS; i++)
+    for (int i = 0; i < MIN_PDFLUSH_THREADS; i++) {
+        atomic_inc_return(&pdflush_control.nr_pdflush_threads);
         start_one_pdflush_thread();
+    }
     // page_writeback_timer_init();
 }
 
@@ -26,10 +28,7 @@ static int __pdflush(struct pdflush_work *my_work) {
     INIT_LIST_HEAD(&my_work->list);
 
     acquire(&pdflush_control.lock);
-    atomic_inc_return(&pdflush_control.nr_pdflush_threads);
     while (1) {
-        struct pdflush_work *pdf;
-
         // suspend this pdflush into list
         list_move(&my_work->list, &pdflush_control.entry);
 
@@ -39,8 +38,6 @@ static int __pdflush(struct pdflush_work *my_work) {
         int wait_ret = cond_wait(&pdflush_control.pdflush_cond, &pdflush_control.lock);
         if (wait_ret == 0) {
             printfRed("pdflush : error\n");
-        } else {
-            printfRed("pdflush : wakeup\n");
         }
 
         // ensure my_work is removed form list
@@ -66,34 +63,22 @@ static int __pdflush(struct pdflush_work *my_work) {
         if (TIME2SEC(rdtime()) - last_empty_time > 1) { // 到最近的1s期间内没有空闲的pdflush
             /* unlocked list_empty() test is OK here */
             if (list_empty(&pdflush_control.entry)) {
-                /* unlocked test is OK here */
-                if (atomic_read(&pdflush_control.nr_pdflush_threads) < MAX_PDFLUSH_THREADS)
+                /* the pool never shrinks, so the slot is taken before the thread starts,
+                   two pdflush may grow the pool at the same time */
+                // atomic_inc_return gives the old count
+                if (atomic_inc_return(&pdflush_control.nr_pdflush_threads) + 1 <= MAX_PDFLUSH_THREADS)
                     start_one_pdflush_thread();
+                else
+                    atomic_dec_return(&pdflush_control.nr_pdflush_threads);
             }
         }
 
         acquire(&pdflush_control.lock);
         my_work->fn = NULL;
 
-        //  * Thread destruction: For how long has the sleepiest thread slept?
-        if (list_empty(&pdflush_control.entry))
-            continue;
-
-        if (atomic_read(&pdflush_control.nr_pdflush_threads) <= MIN_PDFLUSH_THREADS)
-            continue;
-
-        pdf = list_last_entry(pdflush_control.entry.prev, struct pdflush_work, list); // fetch the last pdflush_work
-        if (TIME2SEC(rdtime()) - pdf->when_i_went_to_sleep > 1) {                     // 最近变空闲的时间超过了1s
-            /* Limit exit rate */
-            pdf->when_i_went_to_sleep = TIME2SEC(rdtime());
-            break;
-        }
+        // a kernel thread has no way to exit, so an idle pdflush is kept sleeping in the
+        // list instead of being destroyed, the pool never exceeds MAX_PDFLUSH_THREADS
     }
-    atomic_dec_return(&pdflush_control.nr_pdflush_threads);
-
-    release(&pdflush_control.lock);
-
-    panic("pdflush decrease\n");
     return 0;
 }
 
@@ -1,6 +1,7 @@
 #include "kernel/cpu.h"
 #include "kernel/trap.h"
 #include "atomic/spinlock.h"
+#include "atomic/rcu.h"
 #include "proc/sched.h"
 #include "proc/pcb_life.h"
 #include "proc/tcb_life.h"
@@ -9,6 +10,9 @@
 #include "debug.h"
 #include "common.h"
 #include "lib/timer.h"
+#include "lib/sbi.h"
+#include "kernel/cpu.h"
+#include "errno.h"
 
 Queue_t unused_p_q, used_p_q, zombie_p_q;
 Queue_t *STATES[PCB_STATEMAX] = {
@@ -16,12 +20,12 @@ Queue_t *STATES[PCB_STATEMAX] = {
     [PCB_USED] & used_p_q,
     [PCB_ZOMBIE] & zombie_p_q};
 
-Queue_t unused_t_q, used_t_q, runnable_t_q, sleeping_t_q, zombie_t_q;
-Queue_t *T_STATES[TCB_STATEMAX] = {
-    [TCB_UNUSED] & unused_t_q,
-    [TCB_USED] & used_t_q,
-    [TCB_RUNNABLE] & runnable_t_q,
-    [TCB_SLEEPING] & sleeping_t_q};
+// runnable threads are on runqueues, see enqueue_thread
+// sleeping threads are only on their wait channel (t->wait_chan_entry),
+// free threads are on unused_t_q, others are on no queue
+Queue_t unused_t_q;
+
+struct rq runqueues[NCPU];
 
 extern struct proc proc[NPROC];
 extern struct tcb thread[NTCB];
@@ -34,9 +38,407 @@ void PCB_Q_ALL_INIT() {
 
 void TCB_Q_ALL_INIT() {
     Queue_init(&unused_t_q, "TCB_UNUSED", TCB_STATE_QUEUE);
-    Queue_init(&used_t_q, "TCB_USED", TCB_STATE_QUEUE);
-    Queue_init(&runnable_t_q, "TCB_RUNNABLE", TCB_STATE_QUEUE);
-    Queue_init(&sleeping_t_q, "TCB_SLEEPING", TCB_STATE_QUEUE);
+    for (int i = 0; i < NCPU; i++) {
+        struct rq *rq = &runqueues[i];
+        initlock(&rq->lock, "TCB_RUNNABLE");
+        INIT_LIST_HEAD(&rq->rt);
+        INIT_LIST_HEAD(&rq->fair);
+        rq->nr_running = 0;
+        rq->nr_migratory = 0;
+        rq->load_weight = 0;
+        rq->min_vruntime = 0;
+        rq->need_resched = 0;
+        rq->idle = 0;
+        rq->nr_switches = 0;
+        rq->nr_steals = 0;
+    }
+}
+
+// weight of nice -20 ~ 19, each nice level is about 10% of cpu time (same as linux)
+static const uint32 prio_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906,
+    3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423,
+    335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45,
+    36, 29, 23, 18, 15};
+
+static inline uint64 thread_weight(struct tcb *t) {
+    return prio_to_weight[t->nice - NICE_MIN];
+}
+
+static inline uint64 sched_clock(void) {
+    return TIME2NS(rdtime());
+}
+
+// charge the time since exec_start to t, holding t->lock
+static void update_curr(struct tcb *t) {
+    uint64 now = sched_clock();
+    uint64 delta = now > t->exec_start ? now - t->exec_start : 0;
+    t->exec_start = now;
+    t->sum_exec_runtime += delta;
+    if (!rt_policy(t->policy)) {
+        t->vruntime += delta * NICE_0_WEIGHT / thread_weight(t);
+    }
+}
+
+// a new thread inherits the scheduling attributes of its creator
+void sched_fork(struct tcb *t) {
+    struct tcb *cur = thread_current();
+    t->policy = SCHED_OTHER;
+    t->rt_priority = 0;
+    t->nice = 0;
+    t->sched_reset_on_fork = 0;
+    t->vruntime = 0;
+    t->sum_exec_runtime = 0;
+    t->cpus_allowed = CPU_MASK_ALL;
+    t->cpu = cpuid();
+    if (cur == NULL || cur == t) {
+        return;
+    }
+    // a new thread waits for its turn like its creator
+    t->vruntime = cur->vruntime;
+    t->cpus_allowed = cur->cpus_allowed;
+    if (!cur->sched_reset_on_fork) {
+        t->policy = cur->policy;
+        t->rt_priority = cur->rt_priority;
+        t->nice = cur->nice;
+    } else if (cur->nice > 0) {
+        t->nice = cur->nice;
+    }
+}
+
+static inline int cpu_allowed(struct tcb *t, int cpu) {
+    return (t->cpus_allowed & (1UL << cpu)) != 0;
+}
+
+// can t run on more than one cpu?
+static inline int thread_migratory(struct tcb *t) {
+    return (t->cpus_allowed & (t->cpus_allowed - 1)) != 0;
+}
+
+// the cpu to run t, holding t->lock
+// its last cpu keeps its cache and the pages in the mempool of that cpu, then this cpu
+static int select_task_rq(struct tcb *t) {
+    int self = cpuid();
+    if (cpu_allowed(t, t->cpu)) {
+        return t->cpu;
+    }
+    if (cpu_allowed(t, self)) {
+        return self;
+    }
+    for (int i = 0; i < NCPU; i++) {
+        if (cpu_allowed(t, i)) {
+            return i;
+        }
+    }
+    panic("select_task_rq: empty cpus_allowed");
+    return self;
+}
+
+// t is queued on cpu, let another cpu know it
+// an idle cpu is woken up to run or steal it, a busy cpu is interrupted if it should preempt
+static void kick_cpu(int cpu, struct tcb *t) {
+    int self = cpuid();
+    __sync_synchronize(); // pairs with the one in thread_idle
+    if (cpu != self) {
+        if (runqueues[cpu].idle || runqueues[cpu].need_resched) {
+            sbi_send_ipi(1UL << cpu, 0);
+        }
+        return;
+    }
+    if (!thread_migratory(t)) {
+        return;
+    }
+    for (int i = 0; i < NCPU; i++) {
+        if (i != self && runqueues[i].idle && cpu_allowed(t, i)) {
+            sbi_send_ipi(1UL << i, 0);
+            return;
+        }
+    }
+}
+
+// should t preempt the thread running on cpu? holding rq->lock
+static int wakeup_preempt(int cpu, struct tcb *t) {
+    struct tcb *curr = t_cpus[cpu].thread;
+    if (curr == NULL || curr == t) {
+        return 0;
+    }
+    if (rt_policy(t->policy)) {
+        return !rt_policy(curr->policy) || t->rt_priority > curr->rt_priority;
+    }
+    if (rt_policy(curr->policy)) {
+        return 0;
+    }
+    // racy read of curr->vruntime, it is only a hint
+    return t->vruntime + SCHED_MIN_GRANULARITY_NS < curr->vruntime;
+}
+
+// holding rq->lock
+static void __enqueue_thread(struct rq *rq, struct tcb *t) {
+    struct tcb *pos;
+
+    if (rt_policy(t->policy)) {
+        // FIFO among threads of the same priority
+        list_for_each_entry(pos, &rq->rt, state_list) {
+            if (pos->rt_priority < t->rt_priority) {
+                break;
+            }
+        }
+    } else {
+        // a thread which has slept doesn't get all the time it missed, but it runs soon
+        if (rq->min_vruntime > SCHED_LATENCY_NS / 2) {
+            t->vruntime = MAX(t->vruntime, rq->min_vruntime - SCHED_LATENCY_NS / 2);
+        }
+        list_for_each_entry(pos, &rq->fair, state_list) {
+            if (pos->vruntime > t->vruntime) {
+                break;
+            }
+        }
+        rq->load_weight += thread_weight(t);
+    }
+    // insert before pos (or at the tail if pos is the list head)
+    list_add_tail(&t->state_list, &pos->state_list);
+    rq->nr_running++;
+    if (thread_migratory(t)) {
+        rq->nr_migratory++;
+    }
+}
+
+// holding rq->lock
+static void __dequeue_thread(struct rq *rq, struct tcb *t) {
+    list_del_reinit(&t->state_list);
+    rq->nr_running--;
+    if (thread_migratory(t)) {
+        rq->nr_migratory--;
+    }
+    if (!rt_policy(t->policy)) {
+        rq->load_weight -= thread_weight(t);
+    }
+}
+
+// holding t->lock
+static void enqueue_thread(struct tcb *t) {
+    int cpu = select_task_rq(t);
+    struct rq *rq = &runqueues[cpu];
+
+    acquire(&rq->lock);
+    t->cpu = cpu;
+    __enqueue_thread(rq, t);
+    if (wakeup_preempt(cpu, t)) {
+        rq->need_resched = 1;
+    }
+    release(&rq->lock);
+
+    kick_cpu(cpu, t);
+}
+
+// holding t->lock
+// the scheduler may have taken t off the queue, but it can't run t before we release t->lock
+static void dequeue_thread(struct tcb *t) {
+    struct rq *rq = &runqueues[t->cpu];
+
+    acquire(&rq->lock);
+    if (!list_empty(&t->state_list)) {
+        __dequeue_thread(rq, t);
+    }
+    release(&rq->lock);
+}
+
+// the first thread of rq allowed to run on cpu, holding rq->lock
+static struct tcb *pick_next_thread(struct rq *rq, int cpu) {
+    struct tcb *t;
+    list_for_each_entry(t, &rq->rt, state_list) {
+        if (cpu_allowed(t, cpu)) {
+            return t;
+        }
+    }
+    list_for_each_entry(t, &rq->fair, state_list) {
+        if (cpu_allowed(t, cpu)) {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+// take the next thread of the run queue of cpu, which is allowed to run on self
+static struct tcb *rq_pop(int cpu, int self) {
+    struct rq *rq = &runqueues[cpu];
+    struct tcb *t;
+
+    acquire(&rq->lock);
+    if ((t = pick_next_thread(rq, self)) != NULL) {
+        __dequeue_thread(rq, t);
+        if (!rt_policy(t->policy)) {
+            // the head of fair has the smallest vruntime
+            rq->min_vruntime = MAX(rq->min_vruntime, t->vruntime);
+        }
+    }
+    release(&rq->lock);
+    return t;
+}
+
+// steal a thread allowed to run on self from the cpu with the most migratory threads
+static struct tcb *steal_thread(int self) {
+    int busiest = -1;
+    int most = 0;
+    for (int i = 0; i < NCPU; i++) {
+        if (i != self && runqueues[i].nr_migratory > most) {
+            busiest = i;
+            most = runqueues[i].nr_migratory;
+        }
+    }
+    if (busiest < 0) {
+        return NULL;
+    }
+
+    struct tcb *t = rq_pop(busiest, self);
+    if (t != NULL) {
+        // vruntime is relative to the min_vruntime of its run queue (racy, it is only a hint)
+        uint64 from = runqueues[busiest].min_vruntime;
+        uint64 to = runqueues[self].min_vruntime;
+        t->vruntime = t->vruntime > from ? t->vruntime - from + to : to;
+        runqueues[self].nr_steals++;
+    }
+    return t;
+}
+
+// anything to run or steal for self?
+static int any_runnable(int self) {
+    if (runqueues[self].nr_running > 0) {
+        return 1;
+    }
+    for (int i = 0; i < NCPU; i++) {
+        if (i != self && runqueues[i].nr_migratory > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// nothing to run, wait for interrupt
+// a cpu which makes a thread runnable sees idle and sends an IPI
+static void thread_idle(struct rq *rq) {
+    intr_off();
+    rq->idle = 1;
+    __sync_synchronize(); // pairs with the one in kick_cpu
+    if (!any_runnable(cpuid())) {
+        // no clock interrupt until the next timer of this cpu
+        tick_nohz_idle_enter();
+        rcu_idle_enter();
+        // a pending interrupt wakes us up though interrupts are off, it is taken after intr_on
+        wfi();
+        rcu_idle_exit();
+        tick_nohz_idle_exit();
+    }
+    rq->idle = 0;
+    intr_on();
+}
+
+// does a queued thread want the cpu of current thread?
+int need_resched(void) {
+    push_off();
+    int resched = runqueues[cpuid()].need_resched;
+    pop_off();
+    return resched;
+}
+
+// called on every clock interrupt of this cpu, return 1 if the current thread should yield
+int sched_tick(void) {
+    struct tcb *t = thread_current();
+    int resched = 0;
+
+    push_off();
+    struct rq *rq = &runqueues[cpuid()];
+    if (t == NULL || rq->nr_running == 0) {
+        pop_off();
+        return 0;
+    }
+    uint64 ran = sched_clock() - t->slice_start;
+
+    acquire(&rq->lock);
+    struct tcb *next = pick_next_thread(rq, cpuid());
+    if (rq->need_resched || next == NULL) {
+        resched = rq->need_resched;
+    } else if (t->policy == SCHED_FIFO) {
+        // run until it blocks, unless a higher priority thread comes
+        resched = rt_policy(next->policy) && next->rt_priority > t->rt_priority;
+    } else if (t->policy == SCHED_RR) {
+        resched = rt_policy(next->policy)
+                  && (next->rt_priority > t->rt_priority
+                      || (next->rt_priority == t->rt_priority && ran >= RR_TIMESLICE_NS));
+    } else if (rt_policy(next->policy)) {
+        resched = 1;
+    } else {
+        // slice in proportion to its weight in the run queue
+        uint64 weight = thread_weight(t);
+        uint64 slice = SCHED_LATENCY_NS * weight / (rq->load_weight + weight);
+        resched = ran >= MAX(slice, SCHED_MIN_GRANULARITY_NS);
+    }
+    release(&rq->lock);
+    pop_off();
+    return resched;
+}
+
+// change the scheduling attributes of t
+int sched_setattr(struct tcb *t, int policy, int rt_priority, int nice) {
+    int reset_on_fork = (policy & SCHED_RESET_ON_FORK) != 0;
+    policy &= ~SCHED_RESET_ON_FORK;
+    if (policy != SCHED_OTHER && policy != SCHED_FIFO && policy != SCHED_RR) {
+        return -EINVAL;
+    }
+    if (rt_policy(policy) ? (rt_priority < 1 || rt_priority > MAX_RT_PRIO) : rt_priority != 0) {
+        return -EINVAL;
+    }
+    nice = MIN(MAX(nice, NICE_MIN), NICE_MAX);
+
+    acquire(&t->lock);
+    int queued = (t->state == TCB_RUNNABLE);
+    if (queued) {
+        dequeue_thread(t);
+    } else if (t->state == TCB_RUNNING) {
+        update_curr(t);
+    }
+    t->policy = policy;
+    t->rt_priority = rt_priority;
+    t->nice = nice;
+    t->sched_reset_on_fork = reset_on_fork;
+    if (queued) {
+        enqueue_thread(t);
+    } else if (t->state == TCB_RUNNING) {
+        // let the scheduler decide again
+        runqueues[t->cpu].need_resched = 1;
+    }
+    release(&t->lock);
+    return 0;
+}
+
+// restrict t to the cpus in mask, the running thread moves at its next switch
+int sched_setaffinity(struct tcb *t, uint64 mask) {
+    mask &= CPU_MASK_ALL;
+    if (mask == 0) {
+        return -EINVAL;
+    }
+
+    acquire(&t->lock);
+    int queued = (t->state == TCB_RUNNABLE);
+    if (queued) {
+        dequeue_thread(t);
+    }
+    t->cpus_allowed = mask;
+    if (queued) {
+        enqueue_thread(t);
+    } else if (t->state == TCB_RUNNING && !cpu_allowed(t, t->cpu)) {
+        runqueues[t->cpu].need_resched = 1;
+    }
+    release(&t->lock);
+
+    if (t == thread_current() && !cpu_allowed(t, cpuid())) {
+        thread_yield();
+    }
+    return 0;
 }
 
 void PCB_Q_changeState(struct proc *p, enum procstate state_new) {
@@ -51,15 +453,18 @@ void PCB_Q_changeState(struct proc *p, enum procstate state_new) {
 }
 
 void TCB_Q_changeState(struct tcb *t, enum thread_state state_new) {
-    Queue_t *tcb_q_new = T_STATES[state_new];
-    Queue_t *tcb_q_old = T_STATES[t->state];
-
-    if (t->state != TCB_RUNNING) {
-        Queue_remove_atomic(tcb_q_old, (void *)t);
-    } else {
-        Queue_remove((void *)t, TCB_STATE_QUEUE);
+    if (t->state == TCB_RUNNABLE) {
+        dequeue_thread(t);
+    } else if (t->state == TCB_RUNNING) {
+        update_curr(t);
+    } else if (t->state == TCB_UNUSED) {
+        Queue_remove_atomic(&unused_t_q, (void *)t);
+    }
+    if (state_new == TCB_RUNNABLE) {
+        enqueue_thread(t);
+    } else if (state_new == TCB_UNUSED) {
+        Queue_push_back_atomic(&unused_t_q, (void *)t);
     }
-    Queue_push_back_atomic(tcb_q_new, (void *)t);
 
     // if (t->tid == 4 && state_new == TCB_SLEEPING) {
     //     printfGreen("4 ready\n");
@@ -85,12 +490,27 @@ void thread_yield(void) {
 // holding lock
 void thread_wakeup(struct tcb *t) {
     ASSERT(t->wait_chan_entry != NULL);
-    Queue_remove_atomic(t->wait_chan_entry, (void *)t);
     ASSERT(t->state == TCB_SLEEPING);
+    // a waker which has taken t off the channel doesn't lock the channel again.
+    // t is put on a channel only with t->lock held, so list_empty is stable here
+    if (!list_empty(&t->wait_list)) {
+        Queue_remove_atomic(t->wait_chan_entry, (void *)t);
+    }
     t->wait_chan_entry = NULL;
     TCB_Q_changeState(t, TCB_RUNNABLE);
 }
 
+// holding lock
+// wake up t if it still sleeps on chan, it may be woken up by its timer or a signal
+// after the waker took it off chan. return 1 if t is woken up
+int thread_wakeup_chan(struct tcb *t, struct Queue *chan) {
+    if (t->state != TCB_SLEEPING || t->wait_chan_entry != chan) {
+        return 0;
+    }
+    thread_wakeup(t);
+    return 1;
+}
+
 // it is essential !!!
 void thread_wakeup_atomic(void *t) {
     struct tcb *thread = (struct tcb *)t;
@@ -99,15 +519,14 @@ void thread_wakeup_atomic(void *t) {
 #endif
 
     acquire(&thread->lock);
-    ASSERT(thread->wait_chan_entry != NULL);
-    Queue_remove_atomic(thread->wait_chan_entry, (void *)thread);
-    ASSERT(thread->state == TCB_SLEEPING);
-    thread->wait_chan_entry = NULL;
-    TCB_Q_changeState(t, TCB_RUNNABLE);
+    // woken up by others before the timer cancelled?
+    if (thread->wait_chan_entry != NULL && thread_wakeup_chan(thread, thread->wait_chan_entry)) {
+        thread->timer_woken = 1;
+    }
     release(&thread->lock);
 }
 
-// return the rest of expires of timer
+// sleep with t->time_out (ns) if it is set, return 0 if woken up before it expires
 int thread_sched(void) {
     int intena;
     struct tcb *thread = thread_current();
@@ -124,43 +543,71 @@ int thread_sched(void) {
     intena = t_mycpu()->intena;
 
     // set timer for thread
-    int set_timer = thread->time_out; // !!!
-    struct timer_list timer;
-    timer.expires = 0;
-    timer.count = 1; // only once
-    if (set_timer != 0) {
-        INIT_LIST_HEAD(&timer.list); // bug!!!
-        add_timer_atomic(&timer, thread->time_out, thread_wakeup_atomic, (void *)thread);
+    int set_timer = thread->time_out != 0; // !!!
+    int timed_out = 1;
+    struct hrtimer timer;
+    if (set_timer) {
+        thread->timer_woken = 0;
+        hrtimer_init(&timer, thread_wakeup_atomic, (void *)thread);
+        hrtimer_start(&timer, TIME2NS(rdtime()) + thread->time_out);
     }
 
     swtch(&thread->context, &t_mycpu()->context);
     t_mycpu()->intena = intena;
 
-    if (set_timer != 0) {
+    if (set_timer) {
         thread->time_out = 0; // bug !!!
-        delete_timer_atomic(&timer);
+        // the timer may be running on another cpu, waiting for thread->lock.
+        // it can't outlive this sleep and wake up the next one
+        release(&thread->lock);
+        hrtimer_cancel(&timer);
+        acquire(&thread->lock);
+        // expired after a real wakeup, it is not a timeout
+        timed_out = thread->timer_woken;
     }
 
-    return timer.expires == 0; // if it is 0, is is reasonable
+    return timed_out; // 1 if it is woken up by the timer or there is no timer
 }
 
 void thread_scheduler(void) {
     struct tcb *t;
     struct thread_cpu *c = t_mycpu();
+    int id = cpuid();
+    struct rq *rq = &runqueues[id];
 
     c->thread = 0;
     for (;;) {
         // Avoid deadlock by ensuring that devices can interrupt.
         intr_on();
-        t = (struct tcb *)Queue_provide_atomic(&runnable_t_q, 1); // remove it
-        if (t == NULL)
+        if ((t = rq_pop(id, id)) == NULL && (t = steal_thread(id)) == NULL) {
+            thread_idle(rq);
             continue;
+        }
 
         acquire(&t->lock);
+        if (t->state != TCB_RUNNABLE || !list_empty(&t->state_list)) {
+            // its state was changed after we took it off the queue,
+            // or it is queued again, then it is run from the queue
+            release(&t->lock);
+            continue;
+        }
         t->state = TCB_RUNNING;
+        t->cpu = id;
+        t->exec_start = t->slice_start = sched_clock();
         c->thread = t;
+        rq->need_resched = 0;
+        rq->nr_switches++;
+        rcu_note_context_switch();
         swtch(&c->context, &t->context);
         c->thread = 0;
         release(&t->lock);
     }
+}
+
+// debug, statistics of run queues (racy, but it is enough)
+void sched_stat_print(void) {
+    for (int i = 0; i < NCPU; i++) {
+        printf("cpu %d : %d runnable, %ld switches, %ld steals\n",
+               i, runqueues[i].nr_running, runqueues[i].nr_switches, runqueues[i].nr_steals);
+    }
 }
\ No newline at end of file
@@ -10,11 +10,12 @@
 #include "proc/options.h"
 #include "memory/vm.h"
 
-extern Queue_t unused_t_q, runnable_t_q, sleeping_t_q, zombie_t_q;
+extern Queue_t unused_t_q;
 extern Queue_t *STATES[TCB_STATEMAX];
 extern struct hash_table tid_map;
 extern struct proc *initproc;
 extern struct cond cond_ticks;
+struct cond cond_sleep;
 
 struct tcb thread[NTCB];
 char tcb_lock_name[NTCB][10];
@@ -29,6 +30,7 @@ void tcb_init(void) {
     atomic_set(&count_tid, 0);
 
     TCB_Q_ALL_INIT();
+    cond_init(&cond_sleep, "cond_sleep");
     for (int i = 0; i < NTCB; i++) {
         t = thread + i;
         initlock(&t->lock, tcb_lock_name[i]); // init its spinlock
@@ -83,6 +85,12 @@ struct tcb *alloc_thread(thread_callback callback) {
 
     // timeout for timer
     t->time_out = 0;
+    t->timer_woken = 0;
+
+    t->vmacache = NULL;
+
+    // policy, priority and vruntime
+    sched_fork(t);
 
     // for clone
     t->set_child_tid = 0;
@@ -256,8 +264,7 @@ void thread_send_signal(struct tcb *t_cur, siginfo_t *info) {
 
 // find the tcb* given tid using hash map
 struct tcb *find_get_tid(tid_t tid) {
-    struct hash_node *node = hash_lookup(&tid_map, (void *)&tid, NULL, 1, 0); // release it, not holding it
-    return node != NULL ? (struct tcb *)(node->value) : NULL;
+    return (struct tcb *)hash_find(&tid_map, (void *)&tid); // lock-free
 }
 
 // find tcb given pid and tidx
@@ -296,17 +303,23 @@ void do_tkill(struct tcb *t, sig_t signo) {
 #endif
 }
 
+// sleep until deadline (ns, by rdtime), return 0 if woken up early (by a signal)
+// nobody signals cond_sleep, only the hrtimer of thread_sched wakes us up
+int do_sleep_until(struct tcb *t, uint64 deadline) {
+    uint64 now = TIME2NS(rdtime());
+    if (now >= deadline) {
+        return 1;
+    }
+
+    acquire(&cond_sleep.waiting_queue.lock);
+    t->time_out = deadline - now;
+    int wait_ret = cond_wait(&cond_sleep, &cond_sleep.waiting_queue.lock);
+    release(&cond_sleep.waiting_queue.lock);
+    return wait_ret;
+}
+
 int do_sleep_ns(struct tcb *t, struct timespec ts) {
-        uint64 interval_ns = TIMESEPC2NS(ts);
-
-        acquire(&cond_ticks.waiting_queue.lock);
-        t->time_out = interval_ns;
-    // // printf("from do_sleep_ns: hart = %d\n",cpuid());
-    // // printf("t-time_out = %d\n",interval_ns);
-        int wait_ret = cond_wait(&cond_ticks, &cond_ticks.waiting_queue.lock);
-        release(&cond_ticks.waiting_queue.lock);
-        return wait_ret;
-    // return 0;
+    return do_sleep_until(t, TIME2NS(rdtime()) + TIMESEPC2NS(ts));
 }
 
 // create thread valid inkernel space
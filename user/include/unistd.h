@@ -77,5 +77,6 @@ int renameat2(int olddirfd, const char *oldpath, int newdirfd, const char *newpa
 int print_pgtable();
 int print_vma();
 void print_rawfile(int fd, int print);
+int print_bcache();
 
 #endif // __UNISTD_H__
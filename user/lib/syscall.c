@@ -295,4 +295,8 @@ int print_vma() {
 
 void print_rawfile(int fd, int printdir) {
     return syscall(SYS_print_rawfile, fd, printdir);
+}
+
+int print_bcache() {
+    return syscall(SYS_print_bcache);
 }
\ No newline at end of file
@@ -288,4 +288,5 @@
 #define SYS_fork 0
 #define SYS_print_pgtable 500
 #define SYS_print_vma 501
-#define SYS_print_rawfile 502
\ No newline at end of file
+#define SYS_print_rawfile 502
+#define SYS_print_bcache 503
\ No newline at end of file